@@ -0,0 +1,371 @@
+#include "batchexporter.h"
+#include "qarkdownapplication.h"
+#include "defines.h"
+#include "logger.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTextStream>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QMutexLocker>
+
+#include <stdio.h>
+
+#define kManifestFileName ".qarkdown-export-manifest"
+#define kManifestHeader "# qarkdown-export-manifest "
+
+static void printToStream(FILE *stream, QString message)
+{
+    QByteArray bytes = (message + "\n").toLocal8Bit();
+    fputs(bytes.constData(), stream);
+    fflush(stream);
+}
+
+
+BatchExportWorkerThread::BatchExportWorkerThread(BatchExporter *anExporter)
+{
+    exporter = anExporter;
+}
+
+void BatchExportWorkerThread::run()
+{
+    // Each worker has its own compiler instance because MarkdownCompiler
+    // keeps per-compilation state (the error string):
+    MarkdownCompiler compiler(exporter->settings);
+    BatchExportJob job;
+    while (exporter->takeNextJob(&job))
+        exporter->processJob(job, &compiler);
+}
+
+
+BatchExporter::BatchExporter(QSettings *appSettings, QObject *parent) :
+    QObject(parent)
+{
+    settings = appSettings;
+    _numWorkers = QThread::idealThreadCount();
+    numCompiled = 0;
+    numSkipped = 0;
+    numFailed = 0;
+    bytesCompiled = 0;
+}
+
+BatchExporter::~BatchExporter()
+{
+}
+
+int BatchExporter::numWorkers()
+{
+    return _numWorkers;
+}
+void BatchExporter::setNumWorkers(int value)
+{
+    _numWorkers = qMax(1, value);
+}
+
+
+QByteArray BatchExporter::configurationHash(QString compilerPath)
+{
+    // Changing the compiler, its arguments or the HTML template
+    // invalidates every previously exported file:
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QCoreApplication::applicationVersion().toUtf8());
+    hash.addData(compilerPath.toUtf8());
+    hash.addData(compilerArgs.join(" ").toUtf8());
+    hash.addData(htmlTemplate.toUtf8());
+    return hash.result().toHex();
+}
+
+bool BatchExporter::readManifest(QString path, QByteArray expectedConfigHash)
+{
+    oldManifest.clear();
+
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+        return false;
+
+    QTextStream stream(&file);
+    stream.setEncoding(QStringConverter::Utf8);
+    QString header = stream.readLine();
+    if (header != QString(kManifestHeader) + QString::fromLatin1(expectedConfigHash))
+    {
+        Logger::info("Export manifest is from a different configuration; ignoring it.");
+        return false;
+    }
+
+    while (!stream.atEnd())
+    {
+        QString line = stream.readLine();
+        if (line.isEmpty())
+            continue;
+        // Format: mtime <TAB> size <TAB> hash <TAB> relative path
+        QString relativePath = line.section('\t', 3);
+        if (relativePath.isEmpty())
+            continue;
+        BatchExportManifestEntry entry;
+        entry.lastModified = line.section('\t', 0, 0).toLongLong();
+        entry.size = line.section('\t', 1, 1).toLongLong();
+        entry.hash = line.section('\t', 2, 2).toLatin1();
+        oldManifest.insert(relativePath, entry);
+    }
+    file.close();
+    return true;
+}
+
+bool BatchExporter::writeManifest(QString path, QByteArray configHash)
+{
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly | QFile::Text | QFile::Truncate))
+    {
+        Logger::warning("Cannot write export manifest: " + path);
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream.setEncoding(QStringConverter::Utf8);
+    stream << kManifestHeader << QString::fromLatin1(configHash) << "\n";
+    QHash<QString, BatchExportManifestEntry>::const_iterator i;
+    for (i = newManifest.constBegin(); i != newManifest.constEnd(); ++i)
+    {
+        stream << i.value().lastModified << '\t'
+               << i.value().size << '\t'
+               << QString::fromLatin1(i.value().hash) << '\t'
+               << i.key() << "\n";
+    }
+    file.close();
+    return true;
+}
+
+
+bool BatchExporter::takeNextJob(BatchExportJob *job)
+{
+    QMutexLocker locker(&mutex);
+    if (pendingJobs.isEmpty())
+        return false;
+    *job = pendingJobs.takeFirst();
+    return true;
+}
+
+void BatchExporter::recordResult(const BatchExportJob &job,
+                                 const BatchExportManifestEntry &entry,
+                                 bool compiled, qint64 numBytes)
+{
+    QMutexLocker locker(&mutex);
+    newManifest.insert(job.relativePath, entry);
+    if (compiled)
+    {
+        numCompiled++;
+        bytesCompiled += numBytes;
+        Logger::info("Exported: " + job.relativePath);
+    }
+    else
+        numSkipped++;
+}
+
+void BatchExporter::recordFailure(const BatchExportJob &job, QString reason)
+{
+    QMutexLocker locker(&mutex);
+    numFailed++;
+    // Not recorded into the new manifest, so that it's retried next time.
+    printToStream(stderr, tr("Failed to export %1: %2").arg(job.relativePath).arg(reason));
+}
+
+// Called on worker threads. oldManifest is not modified while the
+// workers are running, so it can be read without locking.
+void BatchExporter::processJob(const BatchExportJob &job, MarkdownCompiler *compiler)
+{
+    QFileInfo inputInfo(job.inputPath);
+    BatchExportManifestEntry entry;
+    entry.lastModified = inputInfo.lastModified().toMSecsSinceEpoch();
+    entry.size = inputInfo.size();
+
+    bool haveOldEntry = oldManifest.contains(job.relativePath)
+                        && QFile::exists(job.outputPath);
+    BatchExportManifestEntry oldEntry;
+    if (haveOldEntry)
+    {
+        oldEntry = oldManifest.value(job.relativePath);
+        // Cheap check first: an unchanged mtime and size means we don't
+        // even need to read the file.
+        if (oldEntry.lastModified == entry.lastModified && oldEntry.size == entry.size)
+        {
+            entry.hash = oldEntry.hash;
+            recordResult(job, entry, false, 0);
+            return;
+        }
+    }
+
+    QFile inputFile(job.inputPath);
+    if (!inputFile.open(QFile::ReadOnly))
+    {
+        recordFailure(job, inputFile.errorString());
+        return;
+    }
+    QByteArray contents = inputFile.readAll();
+    inputFile.close();
+
+    entry.hash = QCryptographicHash::hash(contents, QCryptographicHash::Sha1).toHex();
+
+    // The file was touched but its contents are the same:
+    if (haveOldEntry && oldEntry.hash == entry.hash)
+    {
+        recordResult(job, entry, false, 0);
+        return;
+    }
+
+    QPair<QString, QString> compilationOutput = compiler->executeCompiler(
+                compilerExecutablePath, QString::fromUtf8(contents), compilerArgs,
+                compilerLimits);
+    if (compilationOutput.first.isNull())
+    {
+        QString reason = compiler->errorString();
+        if (reason.isNull())
+            reason = compilationOutput.second;
+        recordFailure(job, reason);
+        return;
+    }
+
+    QString finalHTML = compiler->wrapHTMLContentInTemplate(compilationOutput.first,
+                                                            htmlTemplate);
+    if (finalHTML.isNull())
+    {
+        recordFailure(job, compiler->errorString());
+        return;
+    }
+
+    QFile outputFile(job.outputPath);
+    if (!outputFile.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        recordFailure(job, outputFile.errorString());
+        return;
+    }
+    outputFile.write(finalHTML.toUtf8());
+    outputFile.close();
+
+    recordResult(job, entry, true, contents.size());
+}
+
+
+int BatchExporter::exportDirectory(QString inputDirPath, QString outputDirPath)
+{
+    QDir inputDir(inputDirPath);
+    if (!inputDir.exists())
+    {
+        printToStream(stderr, tr("Input directory does not exist: %1").arg(inputDirPath));
+        return 2;
+    }
+    if (!QDir().mkpath(outputDirPath))
+    {
+        printToStream(stderr, tr("Cannot create output directory: %1").arg(outputDirPath));
+        return 2;
+    }
+    QDir outputDir(outputDirPath);
+
+    QString compilerPath = settings->value(SETTING_COMPILER,
+                                           QVariant(DEF_COMPILER)).toString();
+    MarkdownCompiler compiler(settings);
+    // Resolve (and extract, for the built-in compilers) the executable
+    // once here so that the workers never race on the extraction:
+    compilerExecutablePath = compiler.getExecutablePathForCompiler(compilerPath);
+    if (compilerExecutablePath.isEmpty() || !QFile::exists(compilerExecutablePath))
+    {
+        printToStream(stderr, tr("The Markdown to HTML compiler cannot be found at: %1")
+                              .arg(compilerPath));
+        return 2;
+    }
+    compilerArgs = compiler.getArgsListForCompiler(compilerPath);
+    compilerLimits = compiler.getLimitsForCompiler(compilerPath);
+    htmlTemplate = compiler.getHTMLTemplate();
+
+    QString manifestPath = outputDir.absoluteFilePath(kManifestFileName);
+    QByteArray configHash = configurationHash(compilerPath);
+    readManifest(manifestPath, configHash);
+    newManifest.clear();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Discover input files
+    pendingJobs.clear();
+    QList<BatchExportJob> jobs;
+    // The inputs (relative paths) that map to each output path:
+    QHash<QString, QStringList> inputsForOutputPath;
+    QString outputDirPrefix = outputDir.absolutePath() + "/";
+    QDirIterator it(inputDir.absolutePath(),
+                    QarkdownApplication::markdownFilesFilterList(settings),
+                    QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        QString inputPath = it.next();
+        // Don't pick up our own output if it lives inside the input tree:
+        if (inputPath.startsWith(outputDirPrefix))
+            continue;
+
+        BatchExportJob job;
+        job.inputPath = inputPath;
+        job.relativePath = inputDir.relativeFilePath(inputPath);
+        QFileInfo relativeInfo(job.relativePath);
+        QString outputRelativePath = relativeInfo.completeBaseName() + ".html";
+        if (relativeInfo.path() != ".")
+            outputRelativePath = relativeInfo.path() + "/" + outputRelativePath;
+        job.outputPath = outputDir.absoluteFilePath(outputRelativePath);
+        inputsForOutputPath[job.outputPath].append(job.relativePath);
+        jobs.append(job);
+    }
+
+    foreach (BatchExportJob job, jobs)
+    {
+        // e.g. "a.md" and "a.markdown" side by side would both be written
+        // to "a.html" (by racing workers), so neither is exported:
+        QStringList inputs = inputsForOutputPath.value(job.outputPath);
+        if (1 < inputs.count())
+        {
+            inputs.removeAll(job.relativePath);
+            recordFailure(job, tr("Output file %1 would also be written from: %2")
+                               .arg(outputDir.relativeFilePath(job.outputPath))
+                               .arg(inputs.join(", ")));
+            continue;
+        }
+
+        QString jobOutputDirPath = QFileInfo(job.outputPath).absolutePath();
+        if (!QDir().mkpath(jobOutputDirPath))
+        {
+            recordFailure(job, tr("Cannot create directory: %1").arg(jobOutputDirPath));
+            continue;
+        }
+        pendingJobs.append(job);
+    }
+    int numFiles = pendingJobs.count() + numFailed;
+
+    // Compile
+    int numThreads = qMin(_numWorkers, pendingJobs.count());
+    QList<BatchExportWorkerThread *> threads;
+    for (int i = 0; i < numThreads; i++)
+    {
+        BatchExportWorkerThread *thread = new BatchExportWorkerThread(this);
+        threads.append(thread);
+        thread->start();
+    }
+    foreach (BatchExportWorkerThread *thread, threads)
+    {
+        thread->wait();
+        delete thread;
+    }
+
+    writeManifest(manifestPath, configHash);
+
+    double seconds = qMax(timer.elapsed(), (qint64)1) / 1000.0;
+    printToStream(stdout, tr("Processed %1 files in %2 s using %3 workers: "
+                             "%4 compiled, %5 unchanged, %6 failed.")
+                          .arg(numFiles).arg(seconds, 0, 'f', 2).arg(numThreads)
+                          .arg(numCompiled).arg(numSkipped).arg(numFailed));
+    printToStream(stdout, tr("Throughput: %1 files/s, %2 MB/s of Markdown compiled.")
+                          .arg(numCompiled / seconds, 0, 'f', 1)
+                          .arg((bytesCompiled / (1024.0 * 1024.0)) / seconds, 0, 'f', 2));
+
+    return (numFailed == 0) ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#ifndef BATCHEXPORTER_H
+#define BATCHEXPORTER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+
+#include "markdowncompiler.h"
+
+class BatchExporter;
+
+struct BatchExportJob
+{
+    QString relativePath;
+    QString inputPath;
+    QString outputPath;
+};
+
+struct BatchExportManifestEntry
+{
+    qint64 lastModified; // msecs since epoch
+    qint64 size;
+    QByteArray hash;
+};
+
+class BatchExportWorkerThread : public QThread
+{
+public:
+    explicit BatchExportWorkerThread(BatchExporter *exporter);
+    void run();
+
+private:
+    BatchExporter *exporter;
+};
+
+/** @brief Compiles a whole directory tree of Markdown files into HTML
+  * without any UI, using a number of concurrent compiler processes.
+  *
+  * A manifest in the output directory records the modification time,
+  * size and content hash of each input so that unchanged files are
+  * skipped on subsequent runs.
+  */
+class BatchExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BatchExporter(QSettings *appSettings, QObject *parent = 0);
+    ~BatchExporter();
+
+    int numWorkers();
+    void setNumWorkers(int value);
+
+    /** @brief Export every Markdown file under inputDirPath to outputDirPath.
+      *
+      * Blocks until all files have been processed. Returns a process
+      * exit code: 0 if every file was either compiled or skipped.
+      */
+    int exportDirectory(QString inputDirPath, QString outputDirPath);
+
+private:
+    friend class BatchExportWorkerThread;
+
+    QSettings *settings;
+    int _numWorkers;
+
+    QString compilerExecutablePath;
+    QStringList compilerArgs;
+    CompilerLimits compilerLimits;
+    QString htmlTemplate;
+
+    QMutex mutex;
+    QList<BatchExportJob> pendingJobs;
+    QHash<QString, BatchExportManifestEntry> oldManifest;
+    QHash<QString, BatchExportManifestEntry> newManifest;
+    int numCompiled;
+    int numSkipped;
+    int numFailed;
+    qint64 bytesCompiled;
+
+    bool takeNextJob(BatchExportJob *job);
+    void processJob(const BatchExportJob &job, MarkdownCompiler *compiler);
+    void recordResult(const BatchExportJob &job,
+                      const BatchExportManifestEntry &entry,
+                      bool compiled, qint64 numBytes);
+    void recordFailure(const BatchExportJob &job, QString reason);
+    QByteArray configurationHash(QString compilerPath);
+    bool readManifest(QString path, QByteArray expectedConfigHash);
+    bool writeManifest(QString path, QByteArray configHash);
+};
+
+#endif // BATCHEXPORTER_H
@@ -29,6 +29,9 @@
 #define SETTING_COMPILER "Compiler"
 #define SETTING_OPEN_TARGET_AFTER_COMPILING "OpenTargetAfterCompiling"
 #define SETTING_COMPILER_ARGS "CompilerArgs"
+#define SETTING_COMPILER_TIMEOUTS "CompilerTimeouts"
+#define SETTING_COMPILER_CPU_LIMIT "CompilerCPUTimeLimit"
+#define SETTING_COMPILER_MEMORY_LIMIT "CompilerMemoryLimit"
 
 #define DEF_EXTENSIONS          "md markdown mdtext txt text"
 #define DEF_FONT_SIZE           12
@@ -42,10 +45,14 @@
 #define DEF_ASK_RELOAD_MODIFIED_FILE true
 #define DEF_HIGHLIGHT_CURRENT_LINE true
 #define DEF_LINE_HIGHLIGHT_COLOR QColor(Qt::yellow).lighter(180)
+#define DEF_SEARCH_MATCH_HIGHLIGHT_COLOR QColor(255, 150, 50, 110)
 #define DEF_STYLE               ":/styles/Default"
 #define DEF_OPEN_TARGET_AFTER_COMPILING true
 #define DEF_FORMAT_EMPH_WITH_UNDERSCORES true
 #define DEF_FORMAT_STRONG_WITH_UNDERSCORES false
+#define DEF_COMPILER_TIMEOUT    30 // seconds
+#define DEF_COMPILER_CPU_LIMIT  0 // seconds; 0 = no limit
+#define DEF_COMPILER_MEMORY_LIMIT 0 // megabytes; 0 = no limit
 
 #ifdef Q_OS_MAC
 #define DEF_FONT_FAMILY         "Monaco"
@@ -62,7 +69,7 @@
 #endif
 
 #define HTML_TEMPLATE_FILE_PATH \
-    QDir(((QarkdownApplication *)qApp)->applicationStoragePath()\
+    QDir(QarkdownApplication::applicationStoragePath()\
          + "/template.html").absolutePath()
 
 #endif // DEFAULTPREFERENCES_H
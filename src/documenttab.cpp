@@ -0,0 +1,148 @@
+#include "documenttab.h"
+
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextLayout>
+#include <QtWidgets/QPlainTextDocumentLayout>
+
+// Rough size of the glyphs and line data of a laid out character:
+#define kLayoutBytesPerCharacter 24
+
+
+DocumentTab::DocumentTab(ParseScheduler *scheduler, QString journalDirPath)
+{
+    _document = new QTextDocument();
+    _document->setDocumentLayout(new QPlainTextDocumentLayout(_document));
+    // Owned by the document:
+    _highlighter = new HGMarkdownHighlighter(_document);
+    _highlighter->setParseScheduler(scheduler);
+    _journalDirPath = journalDirPath;
+    _journal = new EditJournal(_document, journalDirPath);
+
+    fileLoader = NULL;
+    largeFileIndexer = NULL;
+    loadProgress = 0;
+    loadFinishPending = false;
+    pendingSelectionPosition = -1;
+    pendingSelectionLength = 0;
+    discardingChangesOnQuit = false;
+
+    styleGeneration = -1;
+    lastShown = 0;
+    knownSize = -1;
+    layoutReleased = false;
+    parseResultsReleased = false;
+    memoryUsageValid = false;
+}
+
+DocumentTab::~DocumentTab()
+{
+    cancelLoading();
+    // Writes out whatever is still queued:
+    delete _journal;
+    delete _document;
+}
+
+QTextDocument *DocumentTab::document()
+{
+    return _document;
+}
+
+HGMarkdownHighlighter *DocumentTab::highlighter()
+{
+    return _highlighter;
+}
+
+EditJournal *DocumentTab::journal()
+{
+    return _journal;
+}
+
+QString DocumentTab::journalDirPath()
+{
+    return _journalDirPath;
+}
+
+bool DocumentTab::isLoading()
+{
+    return fileLoader != NULL || largeFileIndexer != NULL;
+}
+
+void DocumentTab::cancelLoading()
+{
+    // deleteLater() so that the sender of already queued signals stays
+    // valid (and distinct from any new loader) until they arrive:
+    if (fileLoader != NULL)
+    {
+        fileLoader->cancel();
+        fileLoader->deleteLater();
+        fileLoader = NULL;
+    }
+    if (largeFileIndexer != NULL)
+    {
+        largeFileIndexer->cancel();
+        largeFileIndexer->deleteLater();
+        largeFileIndexer = NULL;
+    }
+    loadFinishPending = false;
+}
+
+DocumentTabMemoryUsage DocumentTab::memoryUsage()
+{
+    if (memoryUsageValid)
+        return cachedMemoryUsage;
+
+    cachedMemoryUsage.textBytes = _document->characterCount() * sizeof(QChar);
+    cachedMemoryUsage.layoutBytes = 0;
+    if (!layoutReleased)
+    {
+        for (QTextBlock block = _document->begin(); block.isValid(); block = block.next())
+        {
+            QTextLayout *layout = block.layout();
+            if (0 < layout->lineCount())
+                cachedMemoryUsage.layoutBytes += block.length() * kLayoutBytesPerCharacter;
+            cachedMemoryUsage.layoutBytes += layout->formats().size()
+                                             * sizeof(QTextLayout::FormatRange);
+        }
+    }
+    cachedMemoryUsage.parseBytes = _highlighter->parseResultsBytes();
+    memoryUsageValid = true;
+    return cachedMemoryUsage;
+}
+
+void DocumentTab::invalidateMemoryUsage()
+{
+    memoryUsageValid = false;
+}
+
+void DocumentTab::releaseLayout()
+{
+    if (layoutReleased)
+        return;
+    _highlighter->clearHighlighting();
+    for (QTextBlock block = _document->begin(); block.isValid(); block = block.next())
+        block.layout()->clearLayout();
+    layoutReleased = true;
+    memoryUsageValid = false;
+}
+
+void DocumentTab::releaseParseResults()
+{
+    if (parseResultsReleased)
+        return;
+    releaseLayout();
+    _highlighter->releaseParseResults();
+    parseResultsReleased = true;
+    memoryUsageValid = false;
+}
+
+void DocumentTab::prepareForShowing(bool restyled)
+{
+    // (The layout itself is redone lazily, for the blocks that get shown)
+    if (parseResultsReleased)
+        _highlighter->parseAndHighlightNow();
+    else if ((layoutReleased || restyled) && _highlighter->hasParseResults())
+        _highlighter->highlightNow();
+    layoutReleased = false;
+    parseResultsReleased = false;
+    memoryUsageValid = false;
+}
@@ -0,0 +1,103 @@
+#ifndef DOCUMENTTAB_H
+#define DOCUMENTTAB_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QByteArray>
+#include <QtCore/QSharedPointer>
+#include <QtGui/QTextDocument>
+
+#include "peg-markdown-highlight/highlighter.h"
+#include "peg-markdown-highlight/parsescheduler.h"
+#include "editjournal.h"
+#include "fileloader.h"
+
+/** @brief Approximate memory used by a DocumentTab, in bytes. */
+struct DocumentTabMemoryUsage
+{
+    qint64 textBytes;
+    // Line layouts and highlighting formats:
+    qint64 layoutBytes;
+    qint64 parseBytes;
+};
+
+/** @brief A document open in a tab, along with its own highlighter and
+  * edit journal.
+  *
+  * A tab in the background may have unsaved changes (which its journal
+  * keeps safe) or still be loading its file. Its document keeps its
+  * layout, highlighting and parse results, so that switching back to it
+  * is instant. Those caches can be dropped (least recently shown tabs
+  * first) to keep memory use in check; prepareForShowing() then
+  * recreates them, with as little work as what was dropped allows.
+  */
+class DocumentTab
+{
+public:
+    /** @brief The journal is written into journalDirPath, which no other
+      * tab may use at the same time. */
+    DocumentTab(ParseScheduler *scheduler, QString journalDirPath);
+    ~DocumentTab();
+
+    QTextDocument *document();
+    HGMarkdownHighlighter *highlighter();
+    EditJournal *journal();
+    QString journalDirPath();
+
+    // The state of the file, as of when the tab was last current:
+    QString filePath;
+    QDateTime knownLastModified;
+    qint64 knownSize;
+    QByteArray knownHash;
+    QString lastCompileTargetPath;
+    // Loading the file goes on while the tab is in the background (the
+    // threads report to the main window):
+    FileLoaderThread *fileLoader;
+    LargeTextFileIndexThread *largeFileIndexer;
+    int loadProgress;
+    // Set once loading has finished while the tab was in the background;
+    // the rest (e.g. starting the journal) is done when it is shown:
+    bool loadFinishPending;
+    QString loadFinishErrorString;
+    // Set for a file too large to be loaded as a whole (see
+    // QarkdownTextEdit::setLargeFile()); the document only holds the
+    // lines on display while the tab is current:
+    QSharedPointer<LargeTextFile> largeFile;
+    // Selected once the file is in:
+    int pendingSelectionPosition;
+    int pendingSelectionLength;
+    // The user chose to quit without saving the changes:
+    bool discardingChangesOnQuit;
+    // The highlighter settings that the tab's highlighting was made with:
+    int styleGeneration;
+    // When the tab was last current (a counter that only goes up):
+    qint64 lastShown;
+
+    /** @brief Computed by going through the blocks, and cached until
+      * invalidateMemoryUsage() (a background document doesn't change,
+      * except for when a parse finishes or its file is loading). */
+    DocumentTabMemoryUsage memoryUsage();
+    void invalidateMemoryUsage();
+
+    bool isLoading();
+    /** @brief Stop loading the file; the document keeps what's in. */
+    void cancelLoading();
+
+    void releaseLayout();
+    void releaseParseResults();
+    /** @brief Recreate whatever was released (reparsing via the
+      * scheduler if the parse results were), or just the highlighting if
+      * restyled. */
+    void prepareForShowing(bool restyled);
+
+private:
+    QTextDocument *_document;
+    HGMarkdownHighlighter *_highlighter;
+    EditJournal *_journal;
+    QString _journalDirPath;
+    bool layoutReleased;
+    bool parseResultsReleased;
+    bool memoryUsageValid;
+    DocumentTabMemoryUsage cachedMemoryUsage;
+};
+
+#endif // DOCUMENTTAB_H
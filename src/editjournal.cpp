@@ -0,0 +1,404 @@
+#include "editjournal.h"
+#include "fileloader.h"
+#include "logger.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QDataStream>
+#include <QtCore/QSaveFile>
+#include <QtCore/QMutexLocker>
+#include <QtGui/QTextDocument>
+#include <QtGui/QTextCursor>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define kJournalFileName "journal.bin"
+#define kSnapshotFileName "snapshot.bin"
+#define kJournalMagic 0x514b4a32 // "QKJ2"
+#define kSnapshotMagic 0x514b5331 // "QKS1"
+#define kDataStreamVersion QDataStream::Qt_6_0
+
+// How long the writer waits for more records before writing a batch:
+#define kBatchIntervalMilliseconds 250
+// A snapshot is taken once this much has been journaled since the last
+// one, or once the last one is this old:
+#define kCheckpointThresholdBytes (512 * 1024)
+#define kCheckpointIntervalMilliseconds (5 * 60 * 1000)
+// ..but only after typing has paused for a moment:
+#define kCheckpointDelayMilliseconds 2000
+
+
+static void syncToDisk(QFile *file)
+{
+    if (!file->isOpen())
+        return;
+    file->flush();
+#ifdef Q_OS_WIN
+    _commit(file->handle());
+#else
+    fsync(file->handle());
+#endif
+}
+
+
+EditJournalWriterThread::EditJournalWriterThread(QString journalDirPath)
+{
+    dirPath = journalDirPath;
+    busy = false;
+    flushRequests = 0;
+    stopRequested = false;
+}
+
+EditJournalWriterThread::~EditJournalWriterThread()
+{
+    stop();
+}
+
+void EditJournalWriterThread::enqueue(const EditJournalOperation &operation)
+{
+    QMutexLocker locker(&mutex);
+    queue.append(operation);
+    // No need to wake the writer up for every record while it's
+    // already waiting for the current batch to fill up:
+    if (queue.count() == 1)
+        queueCondition.wakeOne();
+}
+
+void EditJournalWriterThread::flush()
+{
+    QMutexLocker locker(&mutex);
+    flushRequests++;
+    queueCondition.wakeOne();
+    while (!queue.isEmpty() || busy)
+        idleCondition.wait(&mutex);
+    flushRequests--;
+}
+
+void EditJournalWriterThread::stop()
+{
+    mutex.lock();
+    stopRequested = true;
+    queueCondition.wakeOne();
+    mutex.unlock();
+    wait();
+}
+
+void EditJournalWriterThread::run()
+{
+    QFile journalFile(QDir(dirPath).absoluteFilePath(kJournalFileName));
+
+    QMutexLocker locker(&mutex);
+    forever
+    {
+        while (queue.isEmpty() && !stopRequested)
+            queueCondition.wait(&mutex);
+        if (queue.isEmpty())
+            break; // stop requested and nothing left to write
+
+        // Let more records arrive so that they get written and synced
+        // to disk together:
+        if (!stopRequested && flushRequests == 0)
+            queueCondition.wait(&mutex, kBatchIntervalMilliseconds);
+
+        QList<EditJournalOperation> batch = queue;
+        queue.clear();
+        busy = true;
+        locker.unlock();
+
+        foreach (const EditJournalOperation &operation, batch)
+            process(operation, &journalFile);
+        syncToDisk(&journalFile);
+
+        locker.relock();
+        busy = false;
+        idleCondition.wakeAll();
+    }
+
+    journalFile.close();
+}
+
+bool EditJournalWriterThread::openJournal(QFile *journalFile, bool snapshotBased,
+                                          QString baseFilePath, QByteArray baseFileHash)
+{
+    journalFile->close();
+    if (!journalFile->open(QFile::WriteOnly | QFile::Truncate))
+    {
+        Logger::warning("Cannot open edit journal: " + journalFile->errorString());
+        return false;
+    }
+    QDataStream stream(journalFile);
+    stream.setVersion(kDataStreamVersion);
+    stream << (quint32)kJournalMagic << snapshotBased << baseFilePath << baseFileHash;
+    return true;
+}
+
+void EditJournalWriterThread::process(const EditJournalOperation &operation,
+                                      QFile *journalFile)
+{
+    QString snapshotPath = QDir(dirPath).absoluteFilePath(kSnapshotFileName);
+
+    if (operation.type == EditJournalOperation::Reset)
+    {
+        QFile::remove(snapshotPath);
+        openJournal(journalFile, false, operation.baseFilePath, operation.baseFileHash);
+    }
+    else if (operation.type == EditJournalOperation::Records)
+    {
+        if (journalFile->isOpen())
+            journalFile->write(operation.data);
+    }
+    else if (operation.type == EditJournalOperation::Checkpoint)
+    {
+        // The old journal stays valid until the snapshot has been
+        // atomically put in place:
+        QSaveFile snapshotFile(snapshotPath);
+        if (!snapshotFile.open(QFile::WriteOnly))
+        {
+            Logger::warning("Cannot write edit journal snapshot: " + snapshotFile.errorString());
+            return;
+        }
+        QDataStream stream(&snapshotFile);
+        stream.setVersion(kDataStreamVersion);
+        stream << (quint32)kSnapshotMagic << operation.baseFilePath << operation.snapshotText;
+        if (!snapshotFile.commit())
+        {
+            Logger::warning("Cannot write edit journal snapshot: " + snapshotFile.errorString());
+            return;
+        }
+        // (The snapshot is the base, whatever happens to the file)
+        openJournal(journalFile, true, operation.baseFilePath, QByteArray());
+    }
+    else if (operation.type == EditJournalOperation::Discard)
+    {
+        journalFile->close();
+        journalFile->remove();
+        QFile::remove(snapshotPath);
+    }
+}
+
+
+EditJournal::EditJournal(QTextDocument *aDocument, QString journalDirPath,
+                         QObject *parent) : QObject(parent)
+{
+    document = aDocument;
+    recording = false;
+    bytesSinceCheckpoint = 0;
+
+    QDir().mkpath(journalDirPath);
+    writer = new EditJournalWriterThread(journalDirPath);
+    writer->start();
+
+    checkpointTimer = new QTimer(this);
+    checkpointTimer->setSingleShot(true);
+    checkpointTimer->setInterval(kCheckpointDelayMilliseconds);
+    connect(checkpointTimer, SIGNAL(timeout()), this, SLOT(checkpointTimerTimeout()));
+
+    connect(document, SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(handleContentsChange(int,int,int)));
+}
+
+EditJournal::~EditJournal()
+{
+    // Writes out whatever is still queued:
+    delete writer;
+}
+
+bool EditJournal::isRecording()
+{
+    return recording;
+}
+
+void EditJournal::startRecording(QString baseFilePath, QByteArray baseFileHash)
+{
+    _baseFilePath = baseFilePath;
+    recording = true;
+    bytesSinceCheckpoint = 0;
+    sinceCheckpoint.start();
+    checkpointTimer->stop();
+
+    EditJournalOperation operation;
+    operation.type = EditJournalOperation::Reset;
+    operation.baseFilePath = baseFilePath;
+    operation.baseFileHash = baseFileHash;
+    writer->enqueue(operation);
+}
+
+void EditJournal::stopRecording()
+{
+    recording = false;
+    checkpointTimer->stop();
+}
+
+void EditJournal::setBaseFilePath(QString path)
+{
+    _baseFilePath = path;
+}
+
+void EditJournal::checkpoint()
+{
+    if (!recording)
+        return;
+    checkpointTimer->stop();
+    bytesSinceCheckpoint = 0;
+    sinceCheckpoint.start();
+
+    EditJournalOperation operation;
+    operation.type = EditJournalOperation::Checkpoint;
+    operation.baseFilePath = _baseFilePath;
+    operation.snapshotText = document->toPlainText();
+    writer->enqueue(operation);
+}
+
+void EditJournal::flush()
+{
+    writer->flush();
+}
+
+void EditJournal::discard()
+{
+    stopRecording();
+    EditJournalOperation operation;
+    operation.type = EditJournalOperation::Discard;
+    writer->enqueue(operation);
+    writer->flush();
+}
+
+void EditJournal::checkpointTimerTimeout()
+{
+    checkpoint();
+}
+
+void EditJournal::handleContentsChange(int position, int charsRemoved, int charsAdded)
+{
+    if (!recording || (charsRemoved == 0 && charsAdded == 0))
+        return;
+
+    // Changes that span the whole document report one character too
+    // many (the implicit last block separator), hence the clamping:
+    int end = qMin(position + charsAdded, document->characterCount() - 1);
+    QString inserted;
+    if (position < end)
+    {
+        QTextCursor cursor(document);
+        cursor.setPosition(position);
+        cursor.setPosition(end, QTextCursor::KeepAnchor);
+        inserted = cursor.selectedText();
+    }
+
+    EditJournalOperation operation;
+    operation.type = EditJournalOperation::Records;
+    QDataStream stream(&operation.data, QIODevice::WriteOnly);
+    stream.setVersion(kDataStreamVersion);
+    stream << (qint32)position << (qint32)charsRemoved << inserted.toUtf8();
+    writer->enqueue(operation);
+
+    bytesSinceCheckpoint += operation.data.size();
+    if (!checkpointTimer->isActive()
+        && (kCheckpointThresholdBytes <= bytesSinceCheckpoint
+            || kCheckpointIntervalMilliseconds <= sinceCheckpoint.elapsed()))
+        checkpointTimer->start();
+}
+
+
+bool EditJournal::recover(QString journalDirPath, QString *baseFilePath, QString *text)
+{
+    QDir dir(journalDirPath);
+    QFile journalFile(dir.absoluteFilePath(kJournalFileName));
+    if (!journalFile.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream stream(&journalFile);
+    stream.setVersion(kDataStreamVersion);
+    quint32 magic = 0;
+    bool snapshotBased = false;
+    QString journalBaseFilePath;
+    QByteArray journalBaseFileHash;
+    stream >> magic >> snapshotBased >> journalBaseFilePath >> journalBaseFileHash;
+    if (stream.status() != QDataStream::Ok || magic != kJournalMagic)
+    {
+        Logger::warning("Ignoring unreadable edit journal");
+        return false;
+    }
+
+    // A journal on top of the file on disk without any records means
+    // there were no unsaved changes:
+    if (!snapshotBased && stream.atEnd())
+        return false;
+
+    QString baseText;
+    if (snapshotBased)
+    {
+        QFile snapshotFile(dir.absoluteFilePath(kSnapshotFileName));
+        if (!snapshotFile.open(QFile::ReadOnly))
+        {
+            Logger::warning("Edit journal snapshot is missing");
+            return false;
+        }
+        QDataStream snapshotStream(&snapshotFile);
+        snapshotStream.setVersion(kDataStreamVersion);
+        QString snapshotBaseFilePath;
+        snapshotStream >> magic >> snapshotBaseFilePath >> baseText;
+        if (snapshotStream.status() != QDataStream::Ok || magic != kSnapshotMagic)
+        {
+            Logger::warning("Ignoring unreadable edit journal snapshot");
+            return false;
+        }
+    }
+    else if (!journalBaseFilePath.isNull())
+    {
+        // Read the same way as when the file was originally opened, so
+        // that the journaled positions match:
+        DecodedTextFile baseFile;
+        if (!baseFile.open(journalBaseFilePath))
+        {
+            Logger::warning("Cannot open the base file of the edit journal: "
+                            + journalBaseFilePath);
+            return false;
+        }
+        // The file may have changed after the crash, or a save may have
+        // made it to disk before the journal was started over on top of
+        // it; the journaled positions would then be applied to different
+        // text, garbling it:
+        if (journalBaseFileHash.isEmpty() || baseFile.contentHash() != journalBaseFileHash)
+        {
+            Logger::warning("Not recovering the edit journal: its base file has changed: "
+                            + journalBaseFilePath);
+            return false;
+        }
+        baseText = baseFile.text();
+    }
+
+    QTextDocument replayDocument;
+    replayDocument.setUndoRedoEnabled(false);
+    replayDocument.setPlainText(baseText);
+    QTextCursor cursor(&replayDocument);
+
+    // Records are applied until the end, or until a record that was
+    // only partially written before the crash:
+    forever
+    {
+        qint32 position = 0;
+        qint32 charsRemoved = 0;
+        QByteArray inserted;
+        stream >> position >> charsRemoved >> inserted;
+        if (stream.status() != QDataStream::Ok)
+            break;
+
+        int maxPosition = replayDocument.characterCount() - 1;
+        position = qBound(0, (int)position, maxPosition);
+        cursor.setPosition(position);
+        cursor.setPosition(qMin(position + (int)charsRemoved, maxPosition),
+                           QTextCursor::KeepAnchor);
+        cursor.insertText(QString::fromUtf8(inserted));
+
+        if (stream.atEnd())
+            break;
+    }
+
+    *baseFilePath = journalBaseFilePath;
+    *text = replayDocument.toPlainText();
+    return true;
+}
@@ -0,0 +1,144 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QList>
+#include <QtCore/QTimer>
+#include <QtCore/QFile>
+#include <QtCore/QElapsedTimer>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+struct EditJournalOperation
+{
+    enum Type
+    {
+        Reset,      // start a new journal on top of a file on disk
+        Records,    // append edit records
+        Checkpoint, // write a full snapshot, restart the journal on top of it
+        Discard     // remove the journal and the snapshot
+    };
+    Type type;
+    QString baseFilePath;
+    // SHA-1 of the contents of baseFilePath that a Reset starts on:
+    QByteArray baseFileHash;
+    QByteArray data;
+    QString snapshotText;
+};
+
+/** @brief Writes the journal operations queued by an EditJournal.
+  *
+  * Records are written in batches: after being woken up, the thread
+  * waits a moment for more records to arrive, and then writes and
+  * fsyncs everything it has with a single call each.
+  */
+class EditJournalWriterThread : public QThread
+{
+public:
+    explicit EditJournalWriterThread(QString journalDirPath);
+    ~EditJournalWriterThread();
+
+    void enqueue(const EditJournalOperation &operation);
+    /** @brief Blocks until everything enqueued so far has been written. */
+    void flush();
+    void stop();
+
+protected:
+    void run();
+
+private:
+    QString dirPath;
+    QMutex mutex;
+    QWaitCondition queueCondition;
+    QWaitCondition idleCondition;
+    QList<EditJournalOperation> queue;
+    bool busy;
+    int flushRequests;
+    bool stopRequested;
+
+    void process(const EditJournalOperation &operation, QFile *journalFile);
+    bool openJournal(QFile *journalFile, bool snapshotBased, QString baseFilePath,
+                     QByteArray baseFileHash);
+};
+
+/** @brief A write-ahead journal of the unsaved edits made to a document.
+  *
+  * Every change to the document is appended as a compact record
+  * (position, number of characters removed, inserted text) to a journal
+  * file in the application storage directory. The journal starts on top
+  * of the file on disk, and every now and then a full snapshot of the
+  * document is checkpointed so that the journal can start over. After a
+  * crash, recover() replays the journal to reconstruct the unsaved text.
+  *
+  * All disk access happens on a background thread, so recording an edit
+  * only costs copying the inserted text.
+  */
+class EditJournal : public QObject
+{
+    Q_OBJECT
+public:
+    EditJournal(QTextDocument *document, QString journalDirPath,
+                QObject *parent = 0);
+    ~EditJournal();
+
+    /** @brief Start journaling edits made on top of the given file (or
+      * an empty document if the path is null). Drops the previous journal.
+      *
+      * baseFileHash is the SHA-1 of the file's contents as they were
+      * loaded into the document (see DecodedTextFile::contentHash()); the
+      * edits are only replayed onto a file that still matches it.
+      */
+    void startRecording(QString baseFilePath, QByteArray baseFileHash = QByteArray());
+    /** @brief Stop journaling (e.g. while the document is being replaced).
+      * The existing journal is kept until recording is started again.
+      */
+    void stopRecording();
+    bool isRecording();
+
+    /** @brief Write a full snapshot of the document now, so that the
+      * journal does not depend on the base file anymore.
+      */
+    void checkpoint();
+    /** @brief Set the file that future checkpoints (and a recovered
+      * document) are associated with, e.g. after "save as".
+      */
+    void setBaseFilePath(QString path);
+    /** @brief Block until everything recorded so far is on disk. */
+    void flush();
+    /** @brief Remove the journal; there is nothing to recover anymore. */
+    void discard();
+
+    /** @brief Reconstruct the text of a document from a journal left
+      * behind by a previous session.
+      *
+      * Returns false if there is nothing to recover, or if the edits were
+      * journaled on top of a file that has changed since (and were not
+      * checkpointed), since they cannot be replayed onto different text.
+      * Otherwise, sets
+      * baseFilePath to the file the edits were made on (null for new
+      * documents) and text to the recovered contents.
+      */
+    static bool recover(QString journalDirPath, QString *baseFilePath, QString *text);
+
+private slots:
+    void handleContentsChange(int position, int charsRemoved, int charsAdded);
+    void checkpointTimerTimeout();
+
+private:
+    QTextDocument *document;
+    EditJournalWriterThread *writer;
+    QTimer *checkpointTimer;
+    QElapsedTimer sinceCheckpoint;
+    QString _baseFilePath;
+    bool recording;
+    qint64 bytesSinceCheckpoint;
+};
+
+#endif // EDITJOURNAL_H
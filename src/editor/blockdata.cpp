@@ -0,0 +1,64 @@
+#include "blockdata.h"
+
+#include <algorithm>
+
+QarkdownBlockData::QarkdownBlockData()
+{
+    searchGeneration = -1;
+    searchRevision = -1;
+    linksRevision = -1;
+    headingLevel = 0;
+    foldableLines = 0;
+    folded = false;
+}
+
+QarkdownBlockData *QarkdownBlockData::forBlock(QTextBlock block, bool create)
+{
+    QarkdownBlockData *data = static_cast<QarkdownBlockData *>(block.userData());
+    if (data == NULL && create && block.isValid())
+    {
+        data = new QarkdownBlockData();
+        block.setUserData(data); // the document takes ownership
+    }
+    return data;
+}
+
+static bool linkStartsBefore(const BlockLink &link, const BlockLink &other)
+{
+    return link.start < other.start;
+}
+
+static bool positionBeforeLink(int position, const BlockLink &link)
+{
+    return position < link.start;
+}
+
+void QarkdownBlockData::addLink(int start, int end, QString href, int revision)
+{
+    if (linksRevision != revision)
+        links.clear();
+    linksRevision = revision;
+    BlockLink link;
+    link.start = start;
+    link.end = end;
+    link.href = href;
+    links.append(link);
+}
+
+void QarkdownBlockData::sortLinks()
+{
+    std::stable_sort(links.begin(), links.end(), linkStartsBefore);
+}
+
+QString QarkdownBlockData::linkHrefAt(int positionInBlock)
+{
+    // The last link that starts at or before the position:
+    QVector<BlockLink>::const_iterator it = std::upper_bound(links.constBegin(), links.constEnd(),
+                                                             positionInBlock, positionBeforeLink);
+    if (it == links.constBegin())
+        return QString();
+    --it;
+    if (positionInBlock <= it->end)
+        return it->href;
+    return QString();
+}
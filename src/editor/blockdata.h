@@ -0,0 +1,85 @@
+#ifndef BLOCKDATA_H
+#define BLOCKDATA_H
+
+#include <QtCore/QVector>
+#include <QtGui/QTextBlock>
+
+/** @brief A range of text that matches a search. */
+struct TextSearchMatch
+{
+    int position;
+    int length;
+};
+Q_DECLARE_TYPEINFO(TextSearchMatch, Q_PRIMITIVE_TYPE);
+
+/** @brief A clickable link: positions start through end (inclusive, so
+  * that clicking on the right half of its last character counts) within
+  * a block. */
+struct BlockLink
+{
+    int start;
+    int end;
+    QString href;
+};
+
+/** @brief A heading, block quote, code block, list item (marker) or
+  * link, as found by the parser (positions in the document at the time
+  * of parsing). */
+struct MarkdownStructureElement
+{
+    enum Kind
+    {
+        Heading,
+        BlockQuote,
+        CodeBlock,
+        ListItem,
+        Link
+    };
+    Kind kind;
+    int headingLevel; // 1 - 6 for headings, 0 otherwise
+    int position;
+    int end;
+};
+
+/** @brief What the editor caches about each block of the document.
+  *
+  * Cached values are tagged with the block's revision at the time they
+  * were computed; QTextBlock::revision() changes whenever the block's
+  * text does, so a mismatch means the value is stale.
+  */
+class QarkdownBlockData : public QTextBlockUserData
+{
+public:
+    QarkdownBlockData();
+
+    /** @brief The data of block, created if asked to (otherwise NULL if
+      * there is none). */
+    static QarkdownBlockData *forBlock(QTextBlock block, bool create);
+
+    // Matches of a search (relative to the start of the block). The
+    // generation identifies the search pattern and options:
+    int searchGeneration;
+    int searchRevision;
+    QVector<TextSearchMatch> searchMatches;
+
+    // Links, sorted by start, as found by the highlighter:
+    int linksRevision;
+    QVector<BlockLink> links;
+
+    /** @brief The href of the link at positionInBlock, or a null string
+      * (a binary search in the links). */
+    QString linkHrefAt(int positionInBlock);
+    /** @brief Add a link (keeping them sorted is up to sortLinks()). */
+    void addLink(int start, int end, QString href, int revision);
+    void sortLinks();
+
+    // Folding: a heading's level (1 - 6) folds everything up to the next
+    // heading of the same or a higher level; foldableLines is the number
+    // of lines after this one in a block quote or code block that starts
+    // here. Both come from the latest parse; folded is up to the user.
+    int headingLevel;
+    int foldableLines;
+    bool folded;
+};
+
+#endif // BLOCKDATA_H
@@ -3,6 +3,15 @@
 
 #include <QTextBlock>
 #include <QPainter>
+#include <QtGui/QMouseEvent>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QCoreApplication>
+#include <QtWidgets/QScrollBar>
+
+// Upper limit for the frames of a scrolling benchmark:
+#define kMaxBenchmarkFrames 2000
+// ..and the number of lines a mouse wheel step scrolls by:
+#define kWheelScrollLines 3
 
 LineNumberingPlainTextEdit::LineNumberingPlainTextEdit(QWidget *parent) :
     QPlainTextEdit(parent)
@@ -15,6 +24,16 @@ LineNumberingPlainTextEdit::LineNumberingPlainTextEdit(QWidget *parent) :
             this, SLOT(updateLineNumberArea(QRect,int)));
 
     _lineNumberAreaColor = QColor(Qt::lightGray).lighter(120);
+    updateLineNumberColors();
+
+    cachedLineNumberAreaWidth = -1;
+    lineNumberDigitCount = 1;
+    lineNumberOffset = 0;
+    lineNumberCount = 0;
+    appliedLineNumberAreaWidth = -1;
+    digitTextsValid = false;
+    paintTimingEnabled = false;
+    resetPaintTimings();
 
     updateLineNumberAreaWidth(0);
 }
@@ -32,9 +51,41 @@ QColor LineNumberingPlainTextEdit::lineNumberAreaColor()
 void LineNumberingPlainTextEdit::setLineNumberAreaColor(QColor newColor)
 {
     _lineNumberAreaColor = newColor;
+    updateLineNumberColors();
     repaint();
 }
 
+void LineNumberingPlainTextEdit::setLineNumberOffset(int offset, int lineCount)
+{
+    if (offset == lineNumberOffset && lineCount == lineNumberCount)
+        return;
+    lineNumberOffset = offset;
+    lineNumberCount = lineCount;
+    updateLineNumberAreaWidth(0);
+    lineNumberArea->update();
+}
+
+int LineNumberingPlainTextEdit::lastLineNumber()
+{
+    return qMax(lineNumberCount, lineNumberOffset + document()->blockCount());
+}
+
+void LineNumberingPlainTextEdit::changeEvent(QEvent *event)
+{
+    QPlainTextEdit::changeEvent(event);
+    if (event->type() != QEvent::FontChange)
+        return;
+    invalidateFontDependentCaches();
+    updateLineNumberAreaWidth(0);
+    lineNumberArea->update();
+}
+
+void LineNumberingPlainTextEdit::invalidateFontDependentCaches()
+{
+    cachedLineNumberAreaWidth = -1;
+    digitTextsValid = false;
+}
+
 
 
 void LineNumberingPlainTextEdit::resizeEvent(QResizeEvent *e)
@@ -49,23 +100,42 @@ void LineNumberingPlainTextEdit::resizeEvent(QResizeEvent *e)
 #define kLeftMargin 5
 #define kRightMargin 3
 
-int LineNumberingPlainTextEdit::lineNumberAreaWidth()
+static int digitCount(int number)
 {
     int numDigits = 1;
-    int max = qMax(1, document()->blockCount());
-    while (max >= 10) {
-        max /= 10;
+    while (number >= 10) {
+        number /= 10;
         ++numDigits;
     }
+    return numDigits;
+}
+
+int LineNumberingPlainTextEdit::lineNumberAreaWidth()
+{
+    if (cachedLineNumberAreaWidth != -1)
+        return cachedLineNumberAreaWidth;
 
+    lineNumberDigitCount = digitCount(qMax(1, lastLineNumber()));
     int nineCharWidth = fontMetrics().horizontalAdvance(QLatin1Char('9'));
-    int digitsWidth = nineCharWidth * numDigits;
-    return kLeftMargin + digitsWidth + kRightMargin;
+    int digitsWidth = nineCharWidth * lineNumberDigitCount;
+    cachedLineNumberAreaWidth = kLeftMargin + digitsWidth + kRightMargin;
+    return cachedLineNumberAreaWidth;
 }
 
 void LineNumberingPlainTextEdit::updateLineNumberAreaWidth(int /* newBlockCount */)
 {
-    setViewportMargins(lineNumberAreaWidth(), 0, 0, 0);
+    // The width only changes along with the number of digits (or the
+    // font), and setting the margins relayouts the viewport, so:
+    if (digitCount(qMax(1, lastLineNumber())) != lineNumberDigitCount)
+        cachedLineNumberAreaWidth = -1;
+    int width = lineNumberAreaWidth();
+    if (width == appliedLineNumberAreaWidth)
+        return;
+    appliedLineNumberAreaWidth = width;
+    setViewportMargins(width, 0, 0, 0);
+
+    QRect cr = contentsRect();
+    lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), width, cr.height()));
 }
 
 void LineNumberingPlainTextEdit::updateLineNumberArea(const QRect &rect, int dy)
@@ -74,52 +144,138 @@ void LineNumberingPlainTextEdit::updateLineNumberArea(const QRect &rect, int dy)
         lineNumberArea->scroll(0, dy);
     else
         lineNumberArea->update(0, rect.y(), lineNumberArea->width(), rect.height());
-    if (rect.contains(viewport()->rect()))
-        updateLineNumberAreaWidth(0);
 }
 
 
 #define kMinTextLightness 50
 #define kMaxTextLightness 205
 
-void LineNumberingPlainTextEdit::lineNumberAreaPaintEvent(QPaintEvent *event)
+void LineNumberingPlainTextEdit::updateLineNumberColors()
 {
     QColor backgroundColor = _lineNumberAreaColor;
     bool lightBackground = (128 <= backgroundColor.lightness());
-    QColor lineNumberTextColor = lightBackground
-                                 ? backgroundColor.darker(180)
-                                 : backgroundColor.lighter(180);
-    QColor borderLineColor = lightBackground
-                             ? backgroundColor.darker(130)
-                             : backgroundColor.lighter(130);
+    lineNumberTextColor = lightBackground
+                          ? backgroundColor.darker(180)
+                          : backgroundColor.lighter(180);
+    lineNumberBorderColor = lightBackground
+                            ? backgroundColor.darker(130)
+                            : backgroundColor.lighter(130);
 
     if (lineNumberTextColor.lightness() < kMinTextLightness)
         lineNumberTextColor.setHsl(lineNumberTextColor.hslHue(), lineNumberTextColor.hslSaturation(), kMinTextLightness);
     else if (kMaxTextLightness < lineNumberTextColor.lightness())
         lineNumberTextColor.setHsl(lineNumberTextColor.hslHue(), lineNumberTextColor.hslSaturation(), kMaxTextLightness);
+}
+
+void LineNumberingPlainTextEdit::prepareDigitTexts()
+{
+    QFontMetrics metrics = fontMetrics();
+    for (int digit = 0; digit < 10; digit++)
+    {
+        digitTexts[digit] = QStaticText(QString::number(digit));
+        digitTexts[digit].setTextFormat(Qt::PlainText);
+        digitTexts[digit].setPerformanceHint(QStaticText::AggressiveCaching);
+        digitTexts[digit].prepare(QTransform(), font());
+        digitAdvances[digit] = metrics.horizontalAdvance(QLatin1Char('0' + digit));
+    }
+    digitTextsValid = true;
+}
+
+void LineNumberingPlainTextEdit::setPaintTimingEnabled(bool enabled)
+{
+    paintTimingEnabled = enabled;
+}
+
+PaintTimings LineNumberingPlainTextEdit::paintTimings()
+{
+    return _paintTimings;
+}
+
+void LineNumberingPlainTextEdit::resetPaintTimings()
+{
+    _paintTimings.editorPaintCount = _paintTimings.gutterPaintCount = 0;
+    _paintTimings.editorPaintNanoseconds = _paintTimings.gutterPaintNanoseconds = 0;
+}
+
+void LineNumberingPlainTextEdit::paintEvent(QPaintEvent *event)
+{
+    if (!paintTimingEnabled)
+    {
+        QPlainTextEdit::paintEvent(event);
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    QPlainTextEdit::paintEvent(event);
+    _paintTimings.editorPaintNanoseconds += timer.nsecsElapsed();
+    _paintTimings.editorPaintCount++;
+}
+
+void LineNumberingPlainTextEdit::lineNumberAreaPaintEvent(QPaintEvent *event)
+{
+    if (!paintTimingEnabled)
+    {
+        paintLineNumbers(event);
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    paintLineNumbers(event);
+    _paintTimings.gutterPaintNanoseconds += timer.nsecsElapsed();
+    _paintTimings.gutterPaintCount++;
+}
 
+void LineNumberingPlainTextEdit::paintLineNumbers(QPaintEvent *event)
+{
+    if (!digitTextsValid)
+        prepareDigitTexts();
+
+    QRect dirtyRect = event->rect();
     QPainter painter(lineNumberArea);
-    painter.fillRect(event->rect(), backgroundColor);
+    painter.setClipRect(dirtyRect);
+    painter.fillRect(dirtyRect, _lineNumberAreaColor);
+
+    int right = lineNumberArea->width() - 1;
+    if (dirtyRect.left() <= right && right <= dirtyRect.right())
+    {
+        painter.setPen(lineNumberBorderColor);
+        painter.drawLine(right, dirtyRect.top(), right, dirtyRect.bottom());
+    }
 
-    painter.setPen(borderLineColor);
-    painter.drawLine(event->rect().topRight(), event->rect().bottomRight());
+    painter.setPen(lineNumberTextColor);
+    painter.setFont(font());
 
+    // Skip ahead to the first block in the dirty rect (its position is
+    // known without laying anything out above it):
     QTextBlock block = firstVisibleBlock();
     int blockNumber = block.blockNumber();
     int top = (int) blockBoundingGeometry(block).translated(contentOffset()).top();
     int bottom = top + (int) blockBoundingRect(block).height();
+    while (block.isValid() && bottom < dirtyRect.top())
+    {
+        block = block.next();
+        top = bottom;
+        bottom = top + (int) blockBoundingRect(block).height();
+        ++blockNumber;
+    }
 
-    while (block.isValid() && top <= event->rect().bottom())
+    int textRight = lineNumberArea->width() - kRightMargin;
+    while (block.isValid() && top <= dirtyRect.bottom())
     {
-        if (block.isVisible() && bottom >= event->rect().top())
+        if (block.isVisible())
         {
-            QString lineNumberString = QString::number(blockNumber + 1);
-            painter.setPen(lineNumberTextColor);
-            painter.setFont(this->font());
-            painter.drawText(0, top,
-                             lineNumberArea->width() - kRightMargin,
-                             fontMetrics().height(),
-                             Qt::AlignRight|Qt::AlignBottom, lineNumberString);
+            if (isFoldedBlock(block))
+                painter.fillRect(0, top, right, bottom - top, lineNumberBorderColor);
+            // Right-aligned, like the text of the line:
+            int x = textRight;
+            int number = lineNumberOffset + blockNumber + 1;
+            do
+            {
+                int digit = number % 10;
+                x -= digitAdvances[digit];
+                painter.drawStaticText(x, top, digitTexts[digit]);
+                number /= 10;
+            } while (0 < number);
         }
 
         block = block.next();
@@ -129,6 +285,74 @@ void LineNumberingPlainTextEdit::lineNumberAreaPaintEvent(QPaintEvent *event)
     }
 }
 
+bool LineNumberingPlainTextEdit::isFoldedBlock(const QTextBlock & /* block */)
+{
+    return false;
+}
+
+void LineNumberingPlainTextEdit::lineNumberClicked(QTextBlock /* block */)
+{
+}
+
+void LineNumberingPlainTextEdit::lineNumberAreaMousePressEvent(QMouseEvent *event)
+{
+    if (event->button() != Qt::LeftButton)
+        return;
+    QTextBlock block = cursorForPosition(QPoint(0, event->position().toPoint().y())).block();
+    if (block.isValid())
+        lineNumberClicked(block);
+}
+
+ScrollingBenchmarkResult LineNumberingPlainTextEdit::benchmarkScrolling()
+{
+    ScrollingBenchmarkResult result;
+    result.frameCount = 0;
+    result.averageMilliseconds = result.maxMilliseconds = 0;
+    result.editorPaintMilliseconds = result.gutterPaintMilliseconds = 0;
+
+    bool wasPaintTimingEnabled = paintTimingEnabled;
+    setPaintTimingEnabled(true);
+    resetPaintTimings();
+
+    QScrollBar *scrollBar = verticalScrollBar();
+    int originalValue = scrollBar->value();
+    // Each scroll bar step is a line in a QPlainTextEdit:
+    int step = qMax(kWheelScrollLines,
+                    (scrollBar->maximum() - scrollBar->minimum()) / kMaxBenchmarkFrames);
+
+    QElapsedTimer totalTimer;
+    totalTimer.start();
+    QElapsedTimer frameTimer;
+    for (int value = scrollBar->minimum(); value <= scrollBar->maximum(); value += step)
+    {
+        frameTimer.start();
+        scrollBar->setValue(value);
+        // Paint the frame now (scrolling the viewport, and then painting
+        // whatever got exposed) instead of whenever the event loop would:
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+        double milliseconds = frameTimer.nsecsElapsed() / 1000000.0;
+        result.maxMilliseconds = qMax(result.maxMilliseconds, milliseconds);
+        result.frameCount++;
+    }
+    if (0 < result.frameCount)
+    {
+        double frames = result.frameCount;
+        result.averageMilliseconds = totalTimer.nsecsElapsed() / 1000000.0 / frames;
+        result.editorPaintMilliseconds = _paintTimings.editorPaintNanoseconds / 1000000.0 / frames;
+        result.gutterPaintMilliseconds = _paintTimings.gutterPaintNanoseconds / 1000000.0 / frames;
+    }
+    setPaintTimingEnabled(wasPaintTimingEnabled);
+
+    scrollBar->setValue(originalValue);
+    Logger::debug(QString("Scrolling benchmark: %1 frames, %2 ms on average, %3 ms at most"
+                          " (painting: editor %4 ms, gutter %5 ms)")
+                  .arg(result.frameCount).arg(result.averageMilliseconds, 0, 'f', 2)
+                  .arg(result.maxMilliseconds, 0, 'f', 2)
+                  .arg(result.editorPaintMilliseconds, 0, 'f', 2)
+                  .arg(result.gutterPaintMilliseconds, 0, 'f', 2));
+    return result;
+}
+
 
 
 
@@ -142,6 +366,11 @@ void LineNumberArea::paintEvent(QPaintEvent *event)
     editor->lineNumberAreaPaintEvent(event);
 }
 
+void LineNumberArea::mousePressEvent(QMouseEvent *event)
+{
+    editor->lineNumberAreaMousePressEvent(event);
+}
+
 QSize LineNumberArea::sizeHint() const {
     return QSize(editor->lineNumberAreaWidth(), 0);
 }
@@ -2,9 +2,33 @@
 #define LINENUMBERINGPLAINTEXTEDIT_H
 
 #include <QtWidgets/QPlainTextEdit>
+#include <QtGui/QStaticText>
+#include <QtGui/QTextBlock>
 
 class LineNumberArea; // forward declaration
 
+/** @brief Frame times measured by
+  * LineNumberingPlainTextEdit::benchmarkScrolling(). */
+struct ScrollingBenchmarkResult
+{
+    int frameCount;
+    double averageMilliseconds;
+    double maxMilliseconds;
+    // Per frame, on average:
+    double editorPaintMilliseconds;
+    double gutterPaintMilliseconds;
+};
+
+/** @brief Time spent painting the text and the line number gutter,
+  * while LineNumberingPlainTextEdit::setPaintTimingEnabled() is on. */
+struct PaintTimings
+{
+    int editorPaintCount;
+    qint64 editorPaintNanoseconds;
+    int gutterPaintCount;
+    qint64 gutterPaintNanoseconds;
+};
+
 class LineNumberingPlainTextEdit : public QPlainTextEdit
 {
     Q_OBJECT
@@ -13,23 +37,71 @@ public:
     ~LineNumberingPlainTextEdit();
 
     void lineNumberAreaPaintEvent(QPaintEvent *event);
+    void lineNumberAreaMousePressEvent(QMouseEvent *event);
     int lineNumberAreaWidth();
 
     QColor lineNumberAreaColor();
     void setLineNumberAreaColor(QColor newColor);
 
+    /** @brief Number the lines as if the document started at line
+      * offset + 1 of a text with lineCount lines (for showing a part of a
+      * larger text). The defaults, 0 and 0, number the document itself. */
+    void setLineNumberOffset(int offset, int lineCount);
+
+    /** @brief Scroll through the whole document the way the mouse wheel
+      * would, painting each step, and time the frames. */
+    ScrollingBenchmarkResult benchmarkScrolling();
+
+    void setPaintTimingEnabled(bool enabled);
+    PaintTimings paintTimings();
+    void resetPaintTimings();
+
 protected:
     QColor _lineNumberAreaColor;
     LineNumberArea *lineNumberArea;
     void resizeEvent(QResizeEvent *event);
+    void changeEvent(QEvent *event);
+    void paintEvent(QPaintEvent *event);
+
+    /** @brief Folded blocks get their line number marked. */
+    virtual bool isFoldedBlock(const QTextBlock &block);
+    virtual void lineNumberClicked(QTextBlock block);
 
 signals:
 
 public slots:
 
-private slots:
+protected slots:
     void updateLineNumberAreaWidth(int newBlockCount);
+
+private slots:
     void updateLineNumberArea(const QRect &, int);
+
+private:
+    // Derived from _lineNumberAreaColor:
+    QColor lineNumberTextColor;
+    QColor lineNumberBorderColor;
+    // -1 until computed; depends only on the font and the number of
+    // digits in the block count:
+    int cachedLineNumberAreaWidth;
+    int lineNumberDigitCount;
+    int lineNumberOffset;
+    int lineNumberCount;
+    // What the viewport margin has been set to (changing it relayouts):
+    int appliedLineNumberAreaWidth;
+    // The digits, laid out once for the current font and then just
+    // drawn (right to left) for each line number:
+    QStaticText digitTexts[10];
+    int digitAdvances[10];
+    bool digitTextsValid;
+    bool paintTimingEnabled;
+    PaintTimings _paintTimings;
+
+    void updateLineNumberColors();
+    int lastLineNumber();
+    void prepareDigitTexts();
+    void paintLineNumbers(QPaintEvent *event);
+    void invalidateFontDependentCaches();
 };
 
 
@@ -42,6 +114,7 @@ public:
 
 protected:
     void paintEvent(QPaintEvent *event);
+    void mousePressEvent(QMouseEvent *event);
 
 private:
     LineNumberingPlainTextEdit *editor;
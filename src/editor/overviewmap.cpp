@@ -0,0 +1,281 @@
+#include "overviewmap.h"
+
+#include <QtGui/QPainter>
+#include <QtGui/QMouseEvent>
+#include <QtGui/QTextBlock>
+#include <QtWidgets/QScrollBar>
+
+#define kMapWidth 64
+#define kMapMargin 2
+// Lines longer than this many characters get a full-width bar:
+#define kMaxMapColumns 100
+// The image has at most this many rows (longer documents get several
+// lines per row):
+#define kMaxMapRows 2048
+// ..each of which is drawn at most this tall:
+#define kMaxPixelsPerRow 3
+
+
+OverviewMap::OverviewMap(QarkdownTextEdit *anEditor, QWidget *parent) :
+    QWidget(parent)
+{
+    editor = anEditor;
+    setFixedWidth(kMapWidth);
+    setCursor(Qt::PointingHandCursor);
+
+    backgroundColor = editor->palette().base().color();
+    kindColors[PlainLine] = editor->palette().text().color();
+    kindColors[LinkLine] = QColor(Qt::blue);
+    kindColors[ListLine] = QColor(Qt::darkGreen);
+    kindColors[CodeLine] = QColor(Qt::darkGray);
+    kindColors[HeadingLine] = QColor(Qt::darkRed);
+
+    linesPerRow = 1;
+    rowCount = 0;
+    fullRenderNeeded = true;
+    image = QImage(kMapWidth, kMaxMapRows, QImage::Format_RGB32);
+
+    rebuildTimer = new QTimer(this);
+    rebuildTimer->setSingleShot(true);
+    rebuildTimer->setInterval(0);
+    connect(rebuildTimer, SIGNAL(timeout()), this, SLOT(rebuild()));
+
+    connect(editor->document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(documentContentsChanged(int,int,int)));
+    connect(editor, SIGNAL(documentSwitched(QTextDocument*)),
+            this, SLOT(editorDocumentSwitched(QTextDocument*)));
+    connect(editor->verticalScrollBar(), SIGNAL(valueChanged(int)),
+            this, SLOT(update()));
+    connect(editor->verticalScrollBar(), SIGNAL(rangeChanged(int,int)),
+            this, SLOT(update()));
+}
+
+QSize OverviewMap::sizeHint() const
+{
+    return QSize(kMapWidth, 0);
+}
+
+void OverviewMap::setBackgroundColor(QColor color)
+{
+    backgroundColor = color;
+    fullRenderNeeded = true;
+    rebuildTimer->start();
+}
+
+void OverviewMap::setKindColor(LineKind kind, QColor color)
+{
+    kindColors[kind] = color;
+    fullRenderNeeded = true;
+    rebuildTimer->start();
+}
+
+void OverviewMap::setStructure(const QVector<MarkdownStructureElement> &structure)
+{
+    QTextDocument *document = editor->document();
+    lineKinds.fill(PlainLine, document->blockCount());
+    for (int i = 0; i < structure.size(); i++)
+    {
+        const MarkdownStructureElement &element = structure.at(i);
+        LineKind kind;
+        if (element.kind == MarkdownStructureElement::Heading)
+            kind = HeadingLine;
+        else if (element.kind == MarkdownStructureElement::CodeBlock)
+            kind = CodeLine;
+        else if (element.kind == MarkdownStructureElement::ListItem)
+            kind = ListLine;
+        else if (element.kind == MarkdownStructureElement::Link)
+            kind = LinkLine;
+        else
+            continue;
+
+        int first = document->findBlock(element.position).blockNumber();
+        int last = first;
+        if (kind == CodeLine)
+            last = document->findBlock(qMax(element.position, element.end - 1)).blockNumber();
+        if (first < 0)
+            continue;
+        for (int line = first; line <= last && line < lineKinds.size(); line++)
+        {
+            if (lineKinds.at(line) < kind)
+                lineKinds[line] = kind;
+        }
+    }
+    rebuild();
+}
+
+void OverviewMap::editorDocumentSwitched(QTextDocument *previousDocument)
+{
+    disconnect(previousDocument, SIGNAL(contentsChange(int,int,int)), this, 0);
+    connect(editor->document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(documentContentsChanged(int,int,int)));
+    // Until the new document's structure is set:
+    lineKinds.clear();
+    fullRenderNeeded = true;
+    rebuild();
+}
+
+quint16 OverviewMap::rowSignature(QTextBlock *block)
+{
+    int kind = PlainLine;
+    int columns = 0;
+    for (int i = 0; i < linesPerRow && block->isValid(); i++)
+    {
+        int line = block->blockNumber();
+        if (line < lineKinds.size())
+            kind = qMax(kind, (int)lineKinds.at(line));
+        columns = qMax(columns, block->length() - 1);
+        *block = block->next();
+    }
+    int width = qMin(columns, kMaxMapColumns) * (kMapWidth - 2 * kMapMargin) / kMaxMapColumns;
+    if (0 < columns)
+        width = qMax(width, 1);
+    return (quint16)((kind << 8) | width);
+}
+
+void OverviewMap::renderRow(QPainter *painter, int row, quint16 signature)
+{
+    painter->fillRect(0, row, kMapWidth, 1, backgroundColor);
+    int width = signature & 0xff;
+    if (width == 0)
+        return;
+    QColor color = kindColors[signature >> 8];
+    if ((signature >> 8) == PlainLine)
+        color.setAlpha(110); // Subdued, so that the other kinds stand out
+    painter->fillRect(kMapMargin, row, width, 1, color);
+}
+
+void OverviewMap::rebuild()
+{
+    rebuildTimer->stop();
+    int lineCount = editor->document()->blockCount();
+    int newLinesPerRow = qMax(1, (lineCount + kMaxMapRows - 1) / kMaxMapRows);
+    int newRowCount = (lineCount + newLinesPerRow - 1) / newLinesPerRow;
+    bool full = fullRenderNeeded || newLinesPerRow != linesPerRow;
+    int oldRowCount = rowCount;
+    linesPerRow = newLinesPerRow;
+    rowCount = newRowCount;
+    fullRenderNeeded = false;
+    rowSignatures.resize(rowCount);
+
+    QPainter painter(&image);
+    int firstChanged = -1;
+    int lastChanged = -1;
+    QTextBlock block = editor->document()->begin();
+    for (int row = 0; row < rowCount; row++)
+    {
+        quint16 signature = rowSignature(&block);
+        if (!full && row < oldRowCount && rowSignatures.at(row) == signature)
+            continue;
+        rowSignatures[row] = signature;
+        renderRow(&painter, row, signature);
+        if (firstChanged == -1)
+            firstChanged = row;
+        lastChanged = row;
+    }
+    painter.end();
+
+    if (full || rowCount != oldRowCount)
+        update(); // Rows are drawn at a different scale
+    else if (firstChanged != -1)
+    {
+        int height = mapHeight();
+        int top = firstChanged * height / qMax(1, rowCount);
+        int bottom = (lastChanged + 1) * height / qMax(1, rowCount);
+        update(0, top, width(), bottom - top + 1);
+    }
+}
+
+void OverviewMap::documentContentsChanged(int position, int charsRemoved, int charsAdded)
+{
+    Q_UNUSED(charsRemoved);
+    if (rebuildTimer->isActive())
+        return;
+    // Lines added or removed shift all the rows below; that waits for the
+    // parse that the edit triggers (which brings new line kinds anyway):
+    if (editor->document()->blockCount() != lineKinds.size())
+        return;
+
+    QTextDocument *document = editor->document();
+    int firstRow = document->findBlock(position).blockNumber() / linesPerRow;
+    int lastRow = document->findBlock(position + charsAdded).blockNumber() / linesPerRow;
+    if (firstRow < 0 || rowSignatures.size() <= lastRow)
+        return;
+
+    QPainter painter(&image);
+    int firstChanged = -1;
+    int lastChanged = -1;
+    QTextBlock block = document->findBlockByNumber(firstRow * linesPerRow);
+    for (int row = firstRow; row <= lastRow; row++)
+    {
+        quint16 signature = rowSignature(&block);
+        if (rowSignatures.at(row) == signature)
+            continue;
+        rowSignatures[row] = signature;
+        renderRow(&painter, row, signature);
+        if (firstChanged == -1)
+            firstChanged = row;
+        lastChanged = row;
+    }
+    painter.end();
+
+    if (firstChanged != -1)
+    {
+        int height = mapHeight();
+        int top = firstChanged * height / qMax(1, rowCount);
+        int bottom = (lastChanged + 1) * height / qMax(1, rowCount);
+        update(0, top, width(), bottom - top + 1);
+    }
+}
+
+int OverviewMap::mapHeight()
+{
+    return qMin(height(), rowCount * kMaxPixelsPerRow);
+}
+
+void OverviewMap::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    painter.fillRect(event->rect(), backgroundColor);
+    if (rowCount == 0)
+        return;
+
+    int height = mapHeight();
+    painter.drawImage(QRect(0, 0, kMapWidth, height), image,
+                      QRect(0, 0, kMapWidth, rowCount));
+
+    // The part of the document that is in view (the scroll bar counts
+    // lines in a QPlainTextEdit):
+    QScrollBar *scrollBar = editor->verticalScrollBar();
+    double total = scrollBar->maximum() + scrollBar->pageStep();
+    if (total <= 0)
+        return;
+    int top = (int)(scrollBar->value() * height / total);
+    int bottom = (int)((scrollBar->value() + scrollBar->pageStep()) * height / total);
+    QColor viewColor = kindColors[PlainLine];
+    viewColor.setAlpha(40);
+    painter.fillRect(0, top, kMapWidth, qMax(2, bottom - top), viewColor);
+}
+
+void OverviewMap::scrollToY(int y)
+{
+    int height = mapHeight();
+    if (height <= 0)
+        return;
+    QScrollBar *scrollBar = editor->verticalScrollBar();
+    double total = scrollBar->maximum() + scrollBar->pageStep();
+    // Centered on the clicked line:
+    int value = (int)(qBound(0, y, height) * total / height) - scrollBar->pageStep() / 2;
+    scrollBar->setValue(value);
+}
+
+void OverviewMap::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton)
+        scrollToY(event->position().toPoint().y());
+}
+
+void OverviewMap::mouseMoveEvent(QMouseEvent *event)
+{
+    if (event->buttons() & Qt::LeftButton)
+        scrollToY(event->position().toPoint().y());
+}
@@ -0,0 +1,77 @@
+#ifndef OVERVIEWMAP_H
+#define OVERVIEWMAP_H
+
+#include <QtCore/QVector>
+#include <QtCore/QTimer>
+#include <QtGui/QImage>
+#include <QtWidgets/QWidget>
+
+#include "qarkdowntextedit.h"
+
+/** @brief A strip next to the editor showing a downscaled map of the
+  * whole document (each line as a bar as long as the line, colored by
+  * what the parser found on it) and the part of it that is in view.
+  *
+  * The map is a cached image with a row per line (or per group of lines
+  * in long documents). Rows are only rendered again when what they show
+  * changes: for the edited lines while typing, and for the lines whose
+  * kind changed after a parse. Painting the widget (e.g. while
+  * scrolling) just draws the image scaled to fit.
+  */
+class OverviewMap : public QWidget
+{
+    Q_OBJECT
+public:
+    // In order of precedence, for lines (or rows) that are several:
+    enum LineKind
+    {
+        PlainLine,
+        LinkLine,
+        ListLine,
+        CodeLine,
+        HeadingLine,
+        LineKindCount
+    };
+
+    explicit OverviewMap(QarkdownTextEdit *editor, QWidget *parent = 0);
+
+    void setBackgroundColor(QColor color);
+    void setKindColor(LineKind kind, QColor color);
+    /** @brief Update the kinds of lines from the latest parse. */
+    void setStructure(const QVector<MarkdownStructureElement> &structure);
+
+    QSize sizeHint() const;
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+
+private slots:
+    void documentContentsChanged(int position, int charsRemoved, int charsAdded);
+    void editorDocumentSwitched(QTextDocument *previousDocument);
+    void rebuild();
+
+private:
+    QarkdownTextEdit *editor;
+    QColor backgroundColor;
+    QColor kindColors[LineKindCount];
+    // Per line, as of the latest parse:
+    QVector<quint8> lineKinds;
+    // Per image row: the kind and bar width it was rendered with
+    // (kind << 8 | width):
+    QVector<quint16> rowSignatures;
+    int linesPerRow;
+    int rowCount;
+    bool fullRenderNeeded;
+    QImage image;
+    // Coalesces color changes into one render:
+    QTimer *rebuildTimer;
+
+    quint16 rowSignature(QTextBlock *block);
+    void renderRow(QPainter *painter, int row, quint16 signature);
+    int mapHeight();
+    void scrollToY(int y);
+};
+
+#endif // OVERVIEWMAP_H
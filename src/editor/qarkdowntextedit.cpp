@@ -7,7 +7,11 @@
 #include <QtGui/QTextDocumentFragment>
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QToolTip>
+#include <QtWidgets/QScrollBar>
 #include <QtCore/QDebug>
+#include <QtCore/QTimer>
+
+#include <algorithm>
 
 QarkdownTextEdit::QarkdownTextEdit(QWidget *parent) :
     LineNumberingPlainTextEdit(parent)
@@ -25,9 +29,25 @@ QarkdownTextEdit::QarkdownTextEdit(QWidget *parent) :
     _anchorClickKeyModifiers = Qt::NoModifier;
     _highlightCurrentLine = true;
     _lineHighlightColor = DEF_LINE_HIGHLIGHT_COLOR;
+    _searchMatchHighlightColor = DEF_SEARCH_MATCH_HIGHLIGHT_COLOR;
+    highlightedRangeStart = highlightedRangeEnd = -1;
+    _largeFileWindowStart = 0;
+    movingLargeFileWindow = false;
+    anchorLookupBlockNumber = 0;
+    anchorLookupDocumentRevision = -1;
 
     connect(this, SIGNAL(cursorPositionChanged()),
             this, SLOT(applyHighlightingToCurrentLine()));
+    connect(this, SIGNAL(updateRequest(QRect,int)),
+            this, SLOT(handleUpdateRequest(QRect,int)));
+    connect(document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(adjustSearchMatches(int,int,int)));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)),
+            this, SLOT(largeFileScrolled()));
+    connect(document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(adjustFolds(int,int,int)));
+    connect(this, SIGNAL(cursorPositionChanged()),
+            this, SLOT(revealCursorBlock()));
     applyHighlightingToCurrentLine();
 }
 
@@ -105,6 +125,16 @@ void QarkdownTextEdit::setCurrentLineHighlightColor(QColor value)
     _lineHighlightColor = (value.isValid()) ? value : DEF_LINE_HIGHLIGHT_COLOR;
 }
 
+QColor QarkdownTextEdit::searchMatchHighlightColor()
+{
+    return _searchMatchHighlightColor;
+}
+void QarkdownTextEdit::setSearchMatchHighlightColor(QColor value)
+{
+    _searchMatchHighlightColor = (value.isValid()) ? value : DEF_SEARCH_MATCH_HIGHLIGHT_COLOR;
+    updateExtraSelections();
+}
+
 
 bool QarkdownTextEdit::isBorderChar(QChar character)
 {
@@ -142,28 +172,12 @@ bool QarkdownTextEdit::selectionContainsOnlyFullLines(QTextCursor selection)
     return (startsAtLineStart && endsAtLineEnd);
 }
 
-QList<int> QarkdownTextEdit::getLineStartPositionsInSelection(QTextCursor selection)
-{
-    QList<int> lineStarts;
-    QTextCursor c(document());
-    c.setPosition(selection.selectionStart());
-    QTextBlock b = c.block();
-    int pos = b.position();
-    while (pos < selection.selectionEnd())
-    {
-        lineStarts.append(pos);
-        b = b.next();
-        if (!b.isValid())
-            break;
-        pos = b.position();
-    }
-    return lineStarts;
-}
-
-
 bool QarkdownTextEdit::event(QEvent *e)
 {
-    if (e->type() == QEvent::KeyPress)
+    // The edits below go through QTextCursor, which doesn't care about
+    // read-only (e.g. the window of a large file, or a file that is
+    // still loading), so they have to check for it themselves:
+    if (e->type() == QEvent::KeyPress && !isReadOnly())
     {
         QKeyEvent *ke = static_cast<QKeyEvent *>(e);
 
@@ -221,26 +235,59 @@ bool QarkdownTextEdit::event(QEvent *e)
         }
         return true;
     }
+    else if (e->type() == QEvent::ReadOnlyChange)
+    {
+        emit readOnlyChanged(isReadOnly());
+    }
     return LineNumberingPlainTextEdit::event(e);
 }
 
 QString QarkdownTextEdit::getAnchorHrefAtPos(QPoint pos)
 {
-    QTextCursor cur = cursorForPosition(pos);
-    // "\n" is not clickable:
-    if (document()->characterAt(cur.position()) == QChar::ParagraphSeparator)
+    // The mouse mostly moves within the same block, so the block that
+    // the last lookup found is tried first (if the document hasn't
+    // changed since):
+    QTextBlock block;
+    QRectF blockRect;
+    if (anchorLookupDocumentRevision == document()->revision())
+    {
+        block = document()->findBlockByNumber(anchorLookupBlockNumber);
+        if (block.isValid() && block.isVisible())
+            blockRect = blockBoundingGeometry(block).translated(contentOffset());
+        if (!blockRect.contains(pos))
+            block = QTextBlock();
+    }
+    if (!block.isValid())
+    {
+        block = cursorForPosition(pos).block();
+        if (!block.isValid())
+            return QString();
+        blockRect = blockBoundingGeometry(block).translated(contentOffset());
+        anchorLookupBlockNumber = block.blockNumber();
+        anchorLookupDocumentRevision = document()->revision();
+    }
+
+    QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+    if (data == NULL || data->links.isEmpty() || data->linksRevision != block.revision())
         return QString();
-    QList<QTextLayout::FormatRange> formats = cur.block().layout()->formats();
-    int posInBlock = cur.position() - cur.block().position();
-    foreach (QTextLayout::FormatRange range, formats)
+
+    // Same as cursorForPosition(), within the block:
+    QTextLayout *layout = block.layout();
+    QPointF layoutPos = QPointF(pos) - blockRect.topLeft();
+    int posInBlock = -1;
+    for (int i = 0; i < layout->lineCount(); i++)
     {
-        if (posInBlock < range.start || range.start + range.length < posInBlock)
-            continue;
-        QString href = range.format.anchorHref();
-        if (!href.isNull())
-            return href;
+        QTextLine line = layout->lineAt(i);
+        if (layoutPos.y() < line.y() + line.height() || i == layout->lineCount() - 1)
+        {
+            posInBlock = line.xToCursor(layoutPos.x());
+            break;
+        }
     }
-    return QString();
+    // "\n" is not clickable:
+    if (posInBlock < 0 || block.length() - 1 <= posInBlock)
+        return QString();
+    return data->linkHrefAt(posInBlock);
 }
 
 
@@ -297,171 +344,173 @@ int QarkdownTextEdit::guessNumOfSpacesToDeleteUponUnindenting()
     return spacesToDelete;
 }
 
+void QarkdownTextEdit::selectedBlocks(QTextCursor selection, QTextBlock *first, QTextBlock *last)
+{
+    *first = document()->findBlock(selection.selectionStart());
+    *last = document()->findBlock(selection.selectionEnd());
+    // A multi-line selection that ends at the start of a block (i.e. at
+    // the end of the previous one) doesn't include that block:
+    if (selection.hasSelection() && selection.selectionEnd() == last->position()
+        && *last != *first)
+        *last = last->previous();
+}
+
+void QarkdownTextEdit::replaceBlocks(QTextBlock first, QTextBlock last, QString text)
+{
+    // One edit for all the lines: a single undo step and a single
+    // contentsChange (so e.g. the highlighter reparses once):
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
+    cursor.setPosition(first.position());
+    cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+    cursor.insertText(text);
+    cursor.endEditBlock();
+}
+
 void QarkdownTextEdit::moveSelectedLines(int keyUpOrDown) // keyUpOrDown can be either Qt::Key_Up or Qt::Key_Down
 {
     QTextCursor cursor = this->textCursor();
-
     int originalSelectionStart = cursor.selectionStart();
     int originalSelectionEnd = cursor.selectionEnd();
 
-    // Expand selection to encompass entire lines
-    int selectionStart = cursor.selectionStart();
-    int selectionEnd = cursor.selectionEnd();
+    QTextBlock first;
+    QTextBlock last;
+    selectedBlocks(cursor, &first, &last);
 
-    QTextCursor startCursor(this->document());
-    startCursor.setPosition(selectionStart);
-    startCursor.movePosition(QTextCursor::StartOfBlock);
+    // Instead of the selected lines (of which there may be many), the
+    // line next to them is moved to their other side:
+    QTextBlock neighbor = (keyUpOrDown == Qt::Key_Up) ? first.previous() : last.next();
+    if (!neighbor.isValid())
+        return;
+    QString neighborText = neighbor.text();
+    int shift = neighborText.length() + 1;
 
-    QTextCursor endCursor(this->document());
-    endCursor.setPosition(selectionEnd);
-    if (selectionStart == selectionEnd || endCursor.positionInBlock() != 0)
+    QTextCursor editCursor(document());
+    editCursor.beginEditBlock();
+    if (keyUpOrDown == Qt::Key_Up)
     {
-        // Select until end of block, unless there is a multi-line selection that
-        // already ends at the end of a block (i.e. ends at the start of the next block)
-        endCursor.movePosition(QTextCursor::EndOfBlock);
-        if (!endCursor.atEnd()) {
-            endCursor.movePosition(QTextCursor::NextCharacter); // Include newline at end of block
+        // Insert after the selected lines first, so that the position
+        // of the line to remove stays valid:
+        if (last.next().isValid())
+        {
+            editCursor.setPosition(last.next().position());
+            editCursor.insertText(neighborText + "\n");
+        }
+        else
+        {
+            editCursor.setPosition(last.position() + last.length() - 1);
+            editCursor.insertText("\n" + neighborText);
         }
+        editCursor.setPosition(neighbor.position());
+        editCursor.setPosition(first.position(), QTextCursor::KeepAnchor);
+        editCursor.removeSelectedText();
+        shift = -shift;
     }
-
-    selectionStart = startCursor.position();
-    selectionEnd = endCursor.position();
-    cursor.setPosition(selectionStart);
-    cursor.setPosition(selectionEnd, QTextCursor::KeepAnchor);
-
-    QString selectedText = cursor.selection().toPlainText();
-
-    if (keyUpOrDown == Qt::Key_Up) // Move line(s) up
+    else
     {
-        if (startCursor.block().blockNumber() == 0)
-            return;
-
-        // Get the block before the selection
-        QTextBlock previousBlock = startCursor.block().previous();
-
-        int prevBlockStart = previousBlock.position();
-        int prevBlockEnd = prevBlockStart + previousBlock.length();
-
-        QTextCursor prevBlockCursor(this->document());
-        prevBlockCursor.setPosition(prevBlockStart);
-        prevBlockCursor.setPosition(prevBlockEnd, QTextCursor::KeepAnchor);
-        QString prevBlockText = prevBlockCursor.selection().toPlainText();
-
-        cursor.beginEditBlock();
-
-        // Remove the previous block and the selected blocks
-        cursor.removeSelectedText();
-        prevBlockCursor.removeSelectedText();
-
-        // Insert the selected text before the previous block
-        QTextCursor insertCursor(this->document());
-        insertCursor.setPosition(prevBlockStart);
-        insertCursor.insertText(selectedText);
-        insertCursor.insertText(prevBlockText);
-
-        cursor.endEditBlock();
-
-        // Restore cursor position & selection
-        QTextCursor newCursor(this->document());
-        newCursor.setPosition(originalSelectionStart - prevBlockText.length());
-        newCursor.setPosition(originalSelectionEnd - prevBlockText.length(), QTextCursor::KeepAnchor);
-        this->setTextCursor(newCursor);
+        // Remove the line below first, so that the position where it
+        // is inserted stays valid:
+        if (neighbor.next().isValid())
+        {
+            editCursor.setPosition(neighbor.position());
+            editCursor.setPosition(neighbor.next().position(), QTextCursor::KeepAnchor);
+        }
+        else
+        {
+            editCursor.setPosition(neighbor.position() - 1);
+            editCursor.setPosition(neighbor.position() + neighbor.length() - 1,
+                                   QTextCursor::KeepAnchor);
+        }
+        editCursor.removeSelectedText();
+        editCursor.setPosition(first.position());
+        editCursor.insertText(neighborText + "\n");
     }
-    else if (keyUpOrDown == Qt::Key_Down) // Move line(s) down
-    {
-        // Get the block after the selection
-        QTextBlock nextBlock = endCursor.block();
-        if (!nextBlock.isValid())
-            return;
-
-        QTextCursor nextBlockCursor(this->document());
-        nextBlockCursor.setPosition(nextBlock.position());
-        nextBlockCursor.setPosition(nextBlock.position() + nextBlock.length(), QTextCursor::KeepAnchor);
-        QString nextBlockText = nextBlockCursor.selection().toPlainText();
-
-        cursor.beginEditBlock();
-
-        // Remove selected blocks and the next block
-        nextBlockCursor.removeSelectedText();
-        cursor.removeSelectedText();
-
-        // Insert the next block text before the selected text
-        QTextCursor insertCursor(this->document());
-        insertCursor.setPosition(selectionStart);
-        insertCursor.insertText(nextBlockText);
-        insertCursor.insertText(selectedText);
+    editCursor.endEditBlock();
 
-        cursor.endEditBlock();
-
-        // Restore cursor position & selection
-        QTextCursor newCursor(this->document());
-        newCursor.setPosition(originalSelectionStart + nextBlockText.length());
-        newCursor.setPosition(originalSelectionEnd + nextBlockText.length(), QTextCursor::KeepAnchor);
-        this->setTextCursor(newCursor);
-    }
+    // Restore cursor position & selection
+    QTextCursor newCursor(this->document());
+    newCursor.setPosition(originalSelectionStart + shift);
+    newCursor.setPosition(originalSelectionEnd + shift, QTextCursor::KeepAnchor);
+    this->setTextCursor(newCursor);
 }
 
 void QarkdownTextEdit::indentSelectedLines()
 {
     QTextCursor cursor = this->textCursor();
-
-    QList<int> lineStarts = getLineStartPositionsInSelection(cursor);
-
-    // Insert indentString to line start positions
-    QTextCursor insertCursor(document());
-    insertCursor.beginEditBlock();
-    int shift = 0;
-    foreach (int lineStart, lineStarts)
-    {
-        insertCursor.setPosition(lineStart+shift);
-        insertCursor.insertText(_indentString);
-        shift += _indentString.length();
-    }
-    insertCursor.endEditBlock();
-
-    if (cursor.hasSelection())
+    QTextBlock first;
+    QTextBlock last;
+    selectedBlocks(cursor, &first, &last);
+
+    // The indented lines are put together and swapped in as a whole
+    QString text;
+    int indentedLines = 0;
+    for (QTextBlock block = first; block.isValid(); block = block.next())
     {
-        // Adjust selection to include first added indentString
-        int selEnd = cursor.selectionEnd();
-        cursor.setPosition(cursor.selectionStart()-_indentString.length());
-        cursor.setPosition(selEnd, QTextCursor::KeepAnchor);
-        this->setTextCursor(cursor);
+        if (block != first)
+            text.append('\n');
+        text.append(_indentString);
+        text.append(block.text());
+        indentedLines++;
+        if (block == last)
+            break;
     }
+    int firstPosition = first.position();
+    int selectionEnd = cursor.selectionEnd();
+    replaceBlocks(first, last, text);
+
+    // Select the lines, including the first added indentString (only
+    // full lines get here, so the selection starts at a line start):
+    cursor.setPosition(firstPosition);
+    cursor.setPosition(selectionEnd + indentedLines * _indentString.length(),
+                       QTextCursor::KeepAnchor);
+    this->setTextCursor(cursor);
 }
 
 void QarkdownTextEdit::unindentSelectedLines()
 {
     QTextCursor cursor = this->textCursor();
+    QTextBlock first;
+    QTextBlock last;
+    selectedBlocks(cursor, &first, &last);
 
-    QList<int> lineStarts = getLineStartPositionsInSelection(cursor);
-
-    QTextCursor removalCursor(document());
-    removalCursor.beginEditBlock();
+    int spacesIndentWidth = guessNumOfSpacesToDeleteUponUnindenting();
+    QString text;
     int deletedChars = 0;
-    foreach (int lineStart, lineStarts)
+    for (QTextBlock block = first; block.isValid(); block = block.next())
     {
-        int adjustedStart = lineStart - deletedChars;
-        removalCursor.setPosition(adjustedStart);
-        if (document()->characterAt(adjustedStart) == QChar('\t'))
+        QString line = block.text();
+        int charsToDelete = 0;
+        if (line.startsWith('\t'))
         {
             // line starts with tab -> just delete the tab.
-            removalCursor.deleteChar();
-            deletedChars++;
+            charsToDelete = 1;
         }
-        else if (document()->characterAt(adjustedStart) == QChar(' '))
+        else
         {
-            // line starts with a space -> must guess how many spaces to delete.
-            int spacesToDelete = guessNumOfSpacesToDeleteUponUnindenting();
-
-            while (spacesToDelete > 0 && document()->characterAt(adjustedStart) == QChar(' '))
-            {
-                removalCursor.deleteChar();
-                deletedChars++;
-                spacesToDelete--;
-            }
+            // line starts with spaces -> must guess how many to delete.
+            while (charsToDelete < spacesIndentWidth && charsToDelete < line.length()
+                   && line.at(charsToDelete) == QChar(' '))
+                charsToDelete++;
         }
+        if (block != first)
+            text.append('\n');
+        text.append(QStringView(line).mid(charsToDelete));
+        deletedChars += charsToDelete;
+        if (block == last)
+            break;
     }
-    removalCursor.endEditBlock();
+    if (deletedChars == 0)
+        return;
+
+    int firstPosition = first.position();
+    int selectionEnd = cursor.selectionEnd();
+    replaceBlocks(first, last, text);
+
+    // The selection covers full lines, so it starts where the first one
+    // does and ends after all of the deleted characters:
+    cursor.setPosition(firstPosition);
+    cursor.setPosition(selectionEnd - deletedChars, QTextCursor::KeepAnchor);
+    this->setTextCursor(cursor);
 }
 
 int QarkdownTextEdit::numCharsFromCursorToNextTabStop()
@@ -575,6 +624,9 @@ QPoint QarkdownTextEdit::getSelectionStartBaselinePoint()
 
 void QarkdownTextEdit::toggleFormattingForCurrentSelection(FormatStyle formatStyle)
 {
+    if (isReadOnly())
+        return;
+
     // Find formatted range
 
     QTextCursor selectionCursor = textCursor();
@@ -662,7 +714,7 @@ void QarkdownTextEdit::applyHighlightingToCurrentLine()
     if (!_highlightCurrentLine)
         return;
 
-    QList<QTextEdit::ExtraSelection> extraSelections;
+    currentLineSelections.clear();
 
     if (!isReadOnly())
     {
@@ -678,15 +730,642 @@ void QarkdownTextEdit::applyHighlightingToCurrentLine()
         {
             selection.format.setBackground(_lineHighlightColor);
             selection.cursor = selCur;
-            extraSelections.append(selection);
+            currentLineSelections.append(selection);
         }
     }
 
-    setExtraSelections(extraSelections);
+    updateExtraSelections();
 }
 
 void QarkdownTextEdit::removeCurrentLineHighlighting()
 {
-    QList<QTextEdit::ExtraSelection> extraSelections;
+    currentLineSelections.clear();
+    updateExtraSelections();
+}
+
+
+// Even the visible part of a single huge line can contain a silly
+// number of matches:
+#define kMaxVisibleSearchMatchSelections 1000
+
+void QarkdownTextEdit::setSearchMatches(const QVector<TextSearchMatch> &matches)
+{
+    _searchMatches = matches;
+    updateExtraSelections();
+}
+
+void QarkdownTextEdit::appendSearchMatches(const QVector<TextSearchMatch> &matches)
+{
+    if (matches.isEmpty())
+        return;
+    bool visibleRangeAffected = (matches.first().position <= highlightedRangeEnd);
+    _searchMatches += matches;
+    if (visibleRangeAffected)
+        updateExtraSelections();
+}
+
+void QarkdownTextEdit::clearSearchMatches()
+{
+    if (_searchMatches.isEmpty())
+        return;
+    _searchMatches.clear();
+    updateExtraSelections();
+}
+
+const QVector<TextSearchMatch> &QarkdownTextEdit::searchMatches()
+{
+    return _searchMatches;
+}
+
+static bool searchMatchPositionLessThan(const TextSearchMatch &match, int position)
+{
+    return match.position < position;
+}
+
+int QarkdownTextEdit::searchMatchIndexAtOrAfter(int position)
+{
+    return std::lower_bound(_searchMatches.constBegin(), _searchMatches.constEnd(),
+                            position, searchMatchPositionLessThan)
+           - _searchMatches.constBegin();
+}
+
+void QarkdownTextEdit::getVisibleTextRange(int *start, int *end)
+{
+    QTextBlock block = firstVisibleBlock();
+    *start = block.position();
+    *end = *start;
+    QPointF offset = contentOffset();
+    int viewportBottom = viewport()->rect().bottom();
+    while (block.isValid())
+    {
+        *end = block.position() + block.length();
+        if (viewportBottom < blockBoundingGeometry(block).translated(offset).bottom())
+            break;
+        block = block.next();
+    }
+}
+
+void QarkdownTextEdit::updateExtraSelections()
+{
+    QList<QTextEdit::ExtraSelection> extraSelections = currentLineSelections;
+
+    getVisibleTextRange(&highlightedRangeStart, &highlightedRangeEnd);
+    if (!_searchMatches.isEmpty())
+    {
+        int i = searchMatchIndexAtOrAfter(highlightedRangeStart);
+        if (0 < i && highlightedRangeStart < _searchMatches.at(i - 1).position
+                                             + _searchMatches.at(i - 1).length)
+            i--; // starts above the viewport but reaches into it
+        int maxPosition = document()->characterCount() - 1;
+        int count = _searchMatches.count();
+        QTextEdit::ExtraSelection selection;
+        selection.format.setBackground(_searchMatchHighlightColor);
+        selection.cursor = QTextCursor(document());
+        for (int added = 0;
+             i < count && _searchMatches.at(i).position < highlightedRangeEnd
+             && added < kMaxVisibleSearchMatchSelections;
+             i++, added++)
+        {
+            const TextSearchMatch &match = _searchMatches.at(i);
+            selection.cursor.setPosition(qMin(match.position, maxPosition));
+            selection.cursor.setPosition(qMin(match.position + match.length, maxPosition),
+                                         QTextCursor::KeepAnchor);
+            extraSelections.append(selection);
+        }
+    }
+
     setExtraSelections(extraSelections);
 }
+
+void QarkdownTextEdit::handleUpdateRequest(const QRect &rect, int dy)
+{
+    Q_UNUSED(rect);
+    Q_UNUSED(dy);
+    if (_searchMatches.isEmpty())
+        return;
+    // Setting the extra selections causes an update request of its own,
+    // so this only does something when the visible range has changed:
+    int start, end;
+    getVisibleTextRange(&start, &end);
+    if (start != highlightedRangeStart || end != highlightedRangeEnd)
+        updateExtraSelections();
+}
+
+void QarkdownTextEdit::adjustSearchMatches(int position, int charsRemoved, int charsAdded)
+{
+    if (_searchMatches.isEmpty() || (charsRemoved == 0 && charsAdded == 0))
+        return;
+
+    int first = searchMatchIndexAtOrAfter(position);
+    if (0 < first && position < _searchMatches.at(first - 1).position
+                                + _searchMatches.at(first - 1).length)
+        first--;
+    int last = first;
+    int changeEnd = position + charsRemoved;
+    int count = _searchMatches.count();
+    while (last < count && _searchMatches.at(last).position < changeEnd)
+        last++;
+
+    // Whatever the edit touched may not match anymore:
+    if (first < last)
+    {
+        _searchMatches.remove(first, last - first);
+        // Not in the middle of the document change:
+        QTimer::singleShot(0, this, SLOT(updateExtraSelections()));
+    }
+
+    int delta = charsAdded - charsRemoved;
+    if (delta != 0)
+    {
+        TextSearchMatch *matches = _searchMatches.data();
+        count = _searchMatches.count();
+        for (int i = first; i < count; i++)
+            matches[i].position += delta;
+    }
+}
+
+
+// In large-file mode, this many lines are kept in the document..
+#define kLargeFileWindowLines 6000
+// ..and the window is moved once the view gets this close to its ends:
+#define kLargeFileWindowMargin 1500
+
+void QarkdownTextEdit::setLargeFile(QSharedPointer<LargeTextFile> file)
+{
+    largeFile = file;
+    _largeFileWindowStart = 0;
+    if (largeFile.isNull())
+    {
+        setLineNumberOffset(0, 0);
+        clear();
+        setReadOnly(false);
+        document()->setUndoRedoEnabled(true);
+        return;
+    }
+
+    setReadOnly(true);
+    document()->setUndoRedoEnabled(false);
+    setLineNumberOffset(0, largeFile->lineCount());
+    QString text;
+    if (!largeFile->lines(0, kLargeFileWindowLines, &text))
+        emit largeFileReadFailed(largeFile->errorString());
+    movingLargeFileWindow = true;
+    setPlainText(text);
+    movingLargeFileWindow = false;
+}
+
+bool QarkdownTextEdit::isInLargeFileMode()
+{
+    return !largeFile.isNull();
+}
+
+int QarkdownTextEdit::largeFileWindowStart()
+{
+    return _largeFileWindowStart;
+}
+
+void QarkdownTextEdit::largeFileScrolled()
+{
+    if (largeFile.isNull() || movingLargeFileWindow)
+        return;
+
+    int firstVisible = firstVisibleBlock().blockNumber();
+    int residentLines = document()->blockCount();
+    bool nearStart = (0 < _largeFileWindowStart
+                      && firstVisible < kLargeFileWindowMargin);
+    bool nearEnd = (_largeFileWindowStart + residentLines < largeFile->lineCount()
+                    && residentLines - firstVisible < kLargeFileWindowMargin);
+    if (nearStart || nearEnd)
+        moveLargeFileWindow(_largeFileWindowStart + firstVisible - kLargeFileWindowLines / 2);
+}
+
+void QarkdownTextEdit::moveLargeFileWindow(int newStart)
+{
+    int lineCount = largeFile->lineCount();
+    newStart = qBound(0, newStart, qMax(0, lineCount - kLargeFileWindowLines));
+    if (newStart == _largeFileWindowStart)
+        return;
+    int oldStart = _largeFileWindowStart;
+    int oldEnd = oldStart + document()->blockCount();
+    int newEnd = qMin(lineCount, newStart + kLargeFileWindowLines);
+
+    // What's in view (and the cursor) must stay put, in terms of lines
+    // of the whole file:
+    int firstVisibleLine = oldStart + firstVisibleBlock().blockNumber();
+    QTextCursor textCursor = this->textCursor();
+    int cursorLine = oldStart + textCursor.blockNumber();
+    int cursorColumn = textCursor.positionInBlock();
+
+    // Everything is read before the document is touched, so that a failed
+    // read leaves it as it was:
+    bool replaceAll = (newEnd <= oldStart || oldEnd <= newStart);
+    QString textAtStart;
+    QString textAtEnd;
+    bool readOK = true;
+    if (replaceAll)
+        readOK = largeFile->lines(newStart, newEnd - newStart, &textAtStart);
+    else
+    {
+        if (oldEnd < newEnd)
+            readOK = largeFile->lines(oldEnd, newEnd - oldEnd, &textAtEnd);
+        if (readOK && newStart < oldStart)
+            readOK = largeFile->lines(newStart, oldStart - newStart, &textAtStart);
+    }
+    if (!readOK)
+    {
+        emit largeFileReadFailed(largeFile->errorString());
+        return;
+    }
+
+    movingLargeFileWindow = true;
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
+    if (replaceAll)
+    {
+        cursor.select(QTextCursor::Document);
+        cursor.insertText(textAtStart);
+    }
+    else
+    {
+        // Only the lines that enter or leave the window are touched (the
+        // end first, so that positions at the start stay valid):
+        if (newEnd < oldEnd)
+        {
+            cursor.setPosition(document()->findBlockByNumber(newEnd - oldStart).position() - 1);
+            cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+            cursor.removeSelectedText();
+        }
+        else if (oldEnd < newEnd)
+        {
+            cursor.movePosition(QTextCursor::End);
+            cursor.insertText("\n" + textAtEnd);
+        }
+        if (oldStart < newStart)
+        {
+            cursor.setPosition(0);
+            cursor.setPosition(document()->findBlockByNumber(newStart - oldStart).position(),
+                               QTextCursor::KeepAnchor);
+            cursor.removeSelectedText();
+        }
+        else if (newStart < oldStart)
+        {
+            cursor.setPosition(0);
+            cursor.insertText(textAtStart + "\n");
+        }
+    }
+    cursor.endEditBlock();
+    document()->setModified(false);
+    _largeFileWindowStart = newStart;
+    setLineNumberOffset(newStart, lineCount);
+
+    if (newStart <= cursorLine && cursorLine < newEnd)
+    {
+        QTextBlock block = document()->findBlockByNumber(cursorLine - newStart);
+        textCursor.setPosition(block.position() + qMin(cursorColumn, block.length() - 1));
+        setTextCursor(textCursor);
+    }
+    verticalScrollBar()->setValue(firstVisibleLine - newStart);
+    movingLargeFileWindow = false;
+
+    Logger::debug(QString("Large file window: lines %1 - %2").arg(newStart).arg(newEnd));
+}
+
+int QarkdownTextEdit::lineCount()
+{
+    return largeFile.isNull() ? document()->blockCount() : largeFile->lineCount();
+}
+
+int QarkdownTextEdit::firstVisibleLine()
+{
+    return _largeFileWindowStart + firstVisibleBlock().blockNumber();
+}
+
+int QarkdownTextEdit::cursorLine()
+{
+    return _largeFileWindowStart + textCursor().blockNumber();
+}
+
+int QarkdownTextEdit::cursorColumn()
+{
+    return textCursor().positionInBlock();
+}
+
+QTextBlock QarkdownTextEdit::blockForLine(int line)
+{
+    line = qBound(0, line, lineCount() - 1);
+    if (!largeFile.isNull()
+        && (line < _largeFileWindowStart
+            || _largeFileWindowStart + document()->blockCount() <= line))
+        moveLargeFileWindow(line - kLargeFileWindowLines / 2);
+    return document()->findBlockByNumber(line - _largeFileWindowStart);
+}
+
+void QarkdownTextEdit::goToLine(int line)
+{
+    QTextBlock block = blockForLine(line);
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(block.position());
+    setTextCursor(cursor);
+    centerCursor();
+}
+
+void QarkdownTextEdit::setViewPosition(int firstVisibleLine, int cursorLine, int cursorColumn)
+{
+    // The window of a large file goes where the view will be:
+    blockForLine(firstVisibleLine);
+    int windowEnd = _largeFileWindowStart + document()->blockCount();
+    if (_largeFileWindowStart <= cursorLine && cursorLine < windowEnd)
+    {
+        QTextBlock block = document()->findBlockByNumber(cursorLine - _largeFileWindowStart);
+        QTextCursor cursor = textCursor();
+        cursor.setPosition(block.position() + qBound(0, cursorColumn, block.length() - 1));
+        setTextCursor(cursor);
+    }
+    // Setting the text cursor might also scroll, so the scroll position
+    // is set only after it (in blocks, which is what a QPlainTextEdit's
+    // scroll bar counts):
+    verticalScrollBar()->setValue(firstVisibleLine - _largeFileWindowStart);
+}
+
+
+static bool isFoldable(QarkdownBlockData *data)
+{
+    return data != NULL && (0 < data->headingLevel || 0 < data->foldableLines);
+}
+
+void QarkdownTextEdit::setFoldableStructure(const QVector<MarkdownStructureElement> &structure)
+{
+    // The previous parse's marks (user data moves along with the blocks
+    // as they are edited, so these are where the old marks ended up):
+    QList<QTextBlock> foldedBlocks;
+    for (QTextBlock block = document()->begin(); block.isValid(); block = block.next())
+    {
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+        if (data == NULL)
+            continue;
+        if (data->folded)
+            foldedBlocks.append(block);
+        data->headingLevel = 0;
+        data->foldableLines = 0;
+    }
+
+    for (int i = 0; i < structure.size(); i++)
+    {
+        const MarkdownStructureElement &element = structure.at(i);
+        QTextBlock block = document()->findBlock(element.position);
+        if (!block.isValid())
+            continue;
+        if (element.kind == MarkdownStructureElement::Heading)
+        {
+            QarkdownBlockData::forBlock(block, true)->headingLevel = element.headingLevel;
+            continue;
+        }
+        if (element.kind != MarkdownStructureElement::BlockQuote
+            && element.kind != MarkdownStructureElement::CodeBlock)
+            continue;
+        // The parser's element ends after the final newline:
+        int lines = document()->findBlock(qMax(element.position, element.end - 1)).blockNumber()
+                    - block.blockNumber();
+        if (0 < lines)
+        {
+            QarkdownBlockData *data = QarkdownBlockData::forBlock(block, true);
+            data->foldableLines = qMax(data->foldableLines, lines);
+        }
+    }
+
+    // Folds whose heading, block quote or code block is gone:
+    for (int i = 0; i < foldedBlocks.size(); i++)
+    {
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(foldedBlocks.at(i), false);
+        if (data->folded && !isFoldable(data))
+            unfoldBlock(foldedBlocks.at(i));
+    }
+}
+
+bool QarkdownTextEdit::isFoldedBlock(const QTextBlock &block)
+{
+    QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+    return data != NULL && data->folded;
+}
+
+QTextBlock QarkdownTextEdit::lastBlockInFold(QTextBlock block)
+{
+    QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+    if (!isFoldable(data))
+        return block;
+    if (data->headingLevel == 0)
+    {
+        QTextBlock last = document()->findBlockByNumber(block.blockNumber() + data->foldableLines);
+        return last.isValid() ? last : document()->lastBlock();
+    }
+
+    QTextBlock last = block;
+    for (QTextBlock next = block.next(); next.isValid(); next = next.next())
+    {
+        QarkdownBlockData *nextData = QarkdownBlockData::forBlock(next, false);
+        if (nextData != NULL && 0 < nextData->headingLevel
+            && nextData->headingLevel <= data->headingLevel)
+            break;
+        last = next;
+    }
+    return last;
+}
+
+void QarkdownTextEdit::setBlocksVisible(QTextBlock first, QTextBlock last, bool visible)
+{
+    if (!first.isValid() || last.blockNumber() < first.blockNumber())
+        return;
+    for (QTextBlock block = first; block.isValid(); block = block.next())
+    {
+        if (visible && isFoldedBlock(block))
+        {
+            // Folds within the one being unfolded stay folded:
+            block.setVisible(true);
+            QTextBlock nestedLast = lastBlockInFold(block);
+            if (last.blockNumber() <= nestedLast.blockNumber())
+                break;
+            block = nestedLast;
+            continue;
+        }
+        block.setVisible(visible);
+        if (block == last)
+            break;
+    }
+    // Only the changed blocks are laid out again:
+    document()->markContentsDirty(first.position(),
+                                  last.position() + last.length() - first.position());
+    viewport()->update();
+    lineNumberArea->update();
+}
+
+void QarkdownTextEdit::foldBlock(QTextBlock block)
+{
+    QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+    if (!isFoldable(data) || data->folded)
+        return;
+    QTextBlock last = lastBlockInFold(block);
+    if (last == block)
+        return;
+    data->folded = true;
+    setBlocksVisible(block.next(), last, false);
+    if (!textCursor().block().isVisible())
+    {
+        QTextCursor cursor(block);
+        setTextCursor(cursor);
+    }
+}
+
+void QarkdownTextEdit::unfoldBlock(QTextBlock block)
+{
+    QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+    if (data == NULL || !data->folded)
+        return;
+    data->folded = false;
+    // What the block folded may have changed since (or it may not be
+    // foldable anymore), so what is shown is whatever is hidden after it:
+    QTextBlock last = block;
+    while (last.next().isValid() && !last.next().isVisible())
+        last = last.next();
+    setBlocksVisible(block.next(), last, true);
+}
+
+QTextBlock QarkdownTextEdit::foldableBlockAround(QTextBlock block)
+{
+    for (QTextBlock candidate = block; candidate.isValid(); candidate = candidate.previous())
+    {
+        if (!candidate.isVisible())
+            continue;
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(candidate, false);
+        if (isFoldable(data)
+            && block.blockNumber() <= lastBlockInFold(candidate).blockNumber())
+            return candidate;
+    }
+    return QTextBlock();
+}
+
+void QarkdownTextEdit::toggleFoldAtCursor()
+{
+    QTextBlock block = textCursor().block();
+    if (isFoldedBlock(block))
+    {
+        unfoldBlock(block);
+        return;
+    }
+    QTextBlock foldable = foldableBlockAround(block);
+    if (foldable.isValid())
+        foldBlock(foldable);
+}
+
+void QarkdownTextEdit::foldAll()
+{
+    // Innermost first, so that the outer folds hide the inner ones:
+    for (QTextBlock block = document()->lastBlock(); block.isValid(); block = block.previous())
+        foldBlock(block);
+}
+
+void QarkdownTextEdit::unfoldAll()
+{
+    for (QTextBlock block = document()->begin(); block.isValid(); block = block.next())
+    {
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+        if (data != NULL)
+            data->folded = false;
+    }
+    setBlocksVisible(document()->begin(), document()->lastBlock(), true);
+}
+
+void QarkdownTextEdit::lineNumberClicked(QTextBlock block)
+{
+    if (isFoldedBlock(block))
+        unfoldBlock(block);
+    else
+        foldBlock(block);
+}
+
+void QarkdownTextEdit::revealCursorBlock()
+{
+    // Moving the cursor (e.g. to a search match, or by deleting the
+    // newline after a fold) into a fold opens it:
+    QTextBlock block = textCursor().block();
+    while (!block.isVisible())
+    {
+        QTextBlock folded = block;
+        while (folded.isValid() && !folded.isVisible())
+            folded = folded.previous();
+        if (!folded.isValid())
+        {
+            setBlocksVisible(document()->begin(), block, true);
+            break;
+        }
+        if (isFoldedBlock(folded))
+            unfoldBlock(folded);
+        else
+            setBlocksVisible(folded.next(), block, true);
+    }
+}
+
+void QarkdownTextEdit::adjustFolds(int position, int charsRemoved, int charsAdded)
+{
+    Q_UNUSED(charsRemoved);
+    if (movingLargeFileWindow)
+        return;
+    // A visible block followed by hidden ones must be a folded one; if
+    // an edit took away a fold's first line (its data went with it),
+    // the rest of the fold is shown again. Only the edited blocks need
+    // to be checked:
+    QTextBlock block = document()->findBlock(position);
+    if (block.previous().isValid())
+        block = block.previous();
+    QTextBlock last = document()->findBlock(position + charsAdded);
+    while (block.isValid())
+    {
+        QTextBlock next = block.next();
+        if (block.isVisible() && next.isValid() && !next.isVisible() && !isFoldedBlock(block))
+        {
+            QTextBlock hiddenEnd = next;
+            while (hiddenEnd.next().isValid() && !hiddenEnd.next().isVisible())
+                hiddenEnd = hiddenEnd.next();
+            for (QTextBlock hidden = next; ; hidden = hidden.next())
+            {
+                QarkdownBlockData *data = QarkdownBlockData::forBlock(hidden, false);
+                if (data != NULL)
+                    data->folded = false;
+                if (hidden == hiddenEnd)
+                    break;
+            }
+            setBlocksVisible(next, hiddenEnd, true);
+        }
+        if (block == last)
+            break;
+        block = next;
+    }
+}
+
+
+void QarkdownTextEdit::switchDocument(QTextDocument *newDocument)
+{
+    QTextDocument *oldDocument = document();
+    if (newDocument == oldDocument)
+        return;
+    disconnect(oldDocument, SIGNAL(contentsChange(int,int,int)), this, 0);
+
+    // The font and tab stops are set on the editor, but kept in the
+    // document:
+    newDocument->setDefaultFont(oldDocument->defaultFont());
+    newDocument->setDefaultTextOption(oldDocument->defaultTextOption());
+    _searchMatches.clear();
+    highlightedRangeStart = highlightedRangeEnd = -1;
+    anchorLookupBlockNumber = 0;
+    anchorLookupDocumentRevision = -1;
+
+    setDocument(newDocument);
+    connect(newDocument, SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(adjustSearchMatches(int,int,int)));
+    connect(newDocument, SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(adjustFolds(int,int,int)));
+
+    updateLineNumberAreaWidth(0);
+    lineNumberArea->update();
+    applyHighlightingToCurrentLine();
+    emit documentSwitched(oldDocument);
+}
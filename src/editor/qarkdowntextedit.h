@@ -3,10 +3,13 @@
 
 #include <QtCore/QEvent>
 #include <QtCore/QUrl>
+#include <QtCore/QSharedPointer>
 #include <QtWidgets/QPlainTextEdit>
 
 #include "linenumberingplaintextedit.h"
+#include "blockdata.h"
 #include "defines.h"
+#include "fileloader.h"
 
 class QarkdownTextEdit : public LineNumberingPlainTextEdit
 {
@@ -37,6 +40,24 @@ public:
     QColor currentLineHighlightColor();
     void setCurrentLineHighlightColor(QColor value);
 
+    /** @brief Highlight search matches (sorted by position).
+      *
+      * Extra selections are created only for the matches in the visible
+      * part of the document, so there can be any number of them. The
+      * matches are kept up to date as the text is edited: the ones that
+      * an edit touches are dropped and the ones after it are shifted.
+      */
+    void setSearchMatches(const QVector<TextSearchMatch> &matches);
+    void appendSearchMatches(const QVector<TextSearchMatch> &matches);
+    void clearSearchMatches();
+    const QVector<TextSearchMatch> &searchMatches();
+    /** @brief Index of the first search match that starts at or after
+      * position, or the number of matches if there is none. */
+    int searchMatchIndexAtOrAfter(int position);
+
+    QColor searchMatchHighlightColor();
+    void setSearchMatchHighlightColor(QColor value);
+
     QTextCursor selectWordUnderCursor(QTextCursor cursor);
     QString getSelectedText();
     QPoint getSelectionStartBaselinePoint();
@@ -54,6 +75,52 @@ public:
     bool formatStrongWithUnderscores();
     void setFormatStrongWithUnderscores(bool value);
 
+    /** @brief Show (read-only) an indexed file too large to be loaded as
+      * a whole, or leave large-file mode with a null file.
+      *
+      * Only a window of lines around the viewport is kept in the
+      * document (and thus laid out and highlighted); lines are decoded
+      * from the file and added and dropped at the window's ends as
+      * the view nears them.
+      */
+    void setLargeFile(QSharedPointer<LargeTextFile> file);
+    bool isInLargeFileMode();
+    /** @brief The line (of the whole file) that the document starts at. */
+    int largeFileWindowStart();
+
+    /** @brief Lines are numbered from 0, and in large-file mode refer to
+      * the whole file rather than the part of it in the document.
+      * Finding a line is a lookup in the document's block tree (or the
+      * large file's line index), so it takes O(log n) time and only the
+      * blocks that end up in view get laid out. */
+    int lineCount();
+    int firstVisibleLine();
+    int cursorLine();
+    int cursorColumn();
+    /** @brief Put the cursor at the start of line and center it in view. */
+    void goToLine(int line);
+    /** @brief Restore a view saved as firstVisibleLine(), cursorLine()
+      * and cursorColumn(). */
+    void setViewPosition(int firstVisibleLine, int cursorLine, int cursorColumn);
+
+    /** @brief Show and edit another document (which must have a
+      * QPlainTextDocumentLayout, and is not owned by the editor). Unlike
+      * setDocument(), keeps the editor's own connections to the document
+      * and its font and tab stops, and emits documentSwitched() for
+      * everyone else's connections. */
+    void switchDocument(QTextDocument *newDocument);
+
+    /** @brief Mark the blocks that can be folded: headings (up to the
+      * next heading of the same or a higher level) and block quotes and
+      * code blocks that span several lines.
+      *
+      * Folding hides the blocks (QTextBlock::setVisible()), so only the
+      * folded range is laid out again. The marks live in the blocks'
+      * user data and thus move along with them as the text is edited;
+      * they are refreshed from here after each parse. */
+    void setFoldableStructure(const QVector<MarkdownStructureElement> &structure);
+    bool isFoldedBlock(const QTextBlock &block);
+
 protected:
     QString _emphFormatString;
     QString _strongFormatString;
@@ -63,6 +130,17 @@ protected:
     Qt::KeyboardModifiers _anchorClickKeyModifiers;
     bool _highlightCurrentLine;
     QColor _lineHighlightColor;
+    QList<QTextEdit::ExtraSelection> currentLineSelections;
+    QVector<TextSearchMatch> _searchMatches;
+    QColor _searchMatchHighlightColor;
+    int highlightedRangeStart;
+    int highlightedRangeEnd;
+    QSharedPointer<LargeTextFile> largeFile;
+    int _largeFileWindowStart;
+    bool movingLargeFileWindow;
+    // The block that getAnchorHrefAtPos() last found under the mouse:
+    int anchorLookupBlockNumber;
+    int anchorLookupDocumentRevision;
 
     bool event(QEvent *e);
     void mouseMoveEvent(QMouseEvent *e);
@@ -70,10 +148,12 @@ protected:
     void mouseReleaseEvent(QMouseEvent *e);
 
     QString getAnchorHrefAtPos(QPoint pos);
+    void getVisibleTextRange(int *start, int *end);
     bool isBorderChar(QChar character);
     bool cursorIsBeforeLineContentStart(QTextCursor cursor);
     bool selectionContainsOnlyFullLines(QTextCursor selection);
-    QList<int> getLineStartPositionsInSelection(QTextCursor selection);
+    void selectedBlocks(QTextCursor selection, QTextBlock *first, QTextBlock *last);
+    void replaceBlocks(QTextBlock first, QTextBlock last, QString text);
     int guessNumOfSpacesToDeleteUponUnindenting();
     void moveSelectedLines(int keyUpOrDown);
     void indentSelectedLines();
@@ -81,13 +161,41 @@ protected:
     int numCharsFromCursorToNextTabStop();
     void indentAtCursor();
     void unindentAtCursor();
+    void moveLargeFileWindow(int newStart);
+    QTextBlock blockForLine(int line);
+    QTextBlock lastBlockInFold(QTextBlock block);
+    QTextBlock foldableBlockAround(QTextBlock block);
+    void setBlocksVisible(QTextBlock first, QTextBlock last, bool visible);
+    void foldBlock(QTextBlock block);
+    void unfoldBlock(QTextBlock block);
+    void lineNumberClicked(QTextBlock block);
+
+public slots:
+    /** @brief Fold the innermost foldable part around the cursor, or
+      * unfold the line the cursor is on. */
+    void toggleFoldAtCursor();
+    void foldAll();
+    void unfoldAll();
 
 signals:
     void anchorClicked(QUrl url);
+    void documentSwitched(QTextDocument *previousDocument);
+    /** @brief Lines of the large file could not be read (e.g. as it has
+      * been truncated); what's shown stays as it was. */
+    void largeFileReadFailed(QString errorString);
+    /** @brief The editor has been made read-only (e.g. while a file
+      * loads, or for a large file) or editable again. */
+    void readOnlyChanged(bool readOnly);
 
 private slots:
     void applyHighlightingToCurrentLine();
     void removeCurrentLineHighlighting();
+    void updateExtraSelections();
+    void handleUpdateRequest(const QRect &rect, int dy);
+    void adjustSearchMatches(int position, int charsRemoved, int charsAdded);
+    void largeFileScrolled();
+    void adjustFolds(int position, int charsRemoved, int charsAdded);
+    void revealCursorBlock();
 };
 
 
@@ -0,0 +1,539 @@
+#include "fileloader.h"
+#include "logger.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QStringDecoder>
+#include <QtCore/QCryptographicHash>
+#include <string.h>
+
+#define kChunkSizeBytes (1024 * 1024)
+#define kMaxChunksInFlight 4
+#define kSlotWaitMilliseconds 100
+
+// Every this many line starts are stored in a LargeTextFile's index:
+#define kLineIndexStride 64
+// ..which is built this many bytes at a time:
+#define kIndexChunkSizeBytes (16 * 1024 * 1024)
+
+
+// The number of bytes at the end of bytes that start a UTF-8 sequence
+// but don't complete it (0 if there is no such incomplete sequence):
+static int incompleteUtf8TailLength(const QByteArray &bytes)
+{
+    int size = bytes.size();
+    for (int i = 1; i <= qMin(3, size); i++)
+    {
+        uchar c = (uchar)bytes.at(size - i);
+        if ((c & 0xC0) == 0x80) // continuation byte
+            continue;
+        int sequenceLength = 1;
+        if ((c & 0xE0) == 0xC0)
+            sequenceLength = 2;
+        else if ((c & 0xF0) == 0xE0)
+            sequenceLength = 3;
+        else if ((c & 0xF8) == 0xF0)
+            sequenceLength = 4;
+        return (i < sequenceLength) ? i : 0;
+    }
+    return 0;
+}
+
+
+DecodedTextFile::DecodedTextFile()
+{
+    _utf8MatchesText = false;
+}
+
+QString DecodedTextFile::errorString()
+{
+    return _errorString;
+}
+QString DecodedTextFile::text()
+{
+    return _text;
+}
+QByteArray DecodedTextFile::utf8()
+{
+    return _utf8;
+}
+bool DecodedTextFile::utf8MatchesText()
+{
+    return _utf8MatchesText;
+}
+
+QByteArray DecodedTextFile::contentHash()
+{
+    return QCryptographicHash::hash(_utf8, QCryptographicHash::Sha1);
+}
+
+QByteArray DecodedTextFile::hashFileContents(QString filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(&file);
+    return hash.result();
+}
+
+bool DecodedTextFile::open(QString filePath)
+{
+    // (Read rather than mapped; see the class documentation.) No
+    // QFile::Text here: line endings are handled below.
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly))
+    {
+        _errorString = file.errorString();
+        return false;
+    }
+    _utf8 = file.readAll();
+    if (file.error() != QFile::NoError)
+    {
+        _errorString = file.errorString();
+        _utf8 = QByteArray();
+        return false;
+    }
+
+    qint64 size = _utf8.size();
+    const uchar *data = (const uchar *)_utf8.constData();
+
+    bool isASCII = true;
+    bool hasCRs = false;
+    bool hasNULs = false;
+    const uchar *end = data + size;
+    for (const uchar *c = data; c < end; c++)
+    {
+        if (0x80 <= *c)
+            isASCII = false;
+        else if (*c == '\r')
+            hasCRs = true;
+        else if (*c == '\0')
+            hasNULs = true;
+    }
+
+    bool decodingFailed = false;
+    if (isASCII)
+        _text = QString::fromLatin1((const char *)data, size);
+    else
+    {
+        QStringDecoder decoder(QStringConverter::Utf8);
+        _text = decoder.decode(_utf8);
+        decodingFailed = decoder.hasError();
+        // (See FileLoaderThread::run())
+        if (0 < incompleteUtf8TailLength(_utf8))
+        {
+            _text.append(QChar(QChar::ReplacementCharacter));
+            decodingFailed = true;
+        }
+    }
+
+    if (hasCRs)
+        _text.replace("\r\n", "\n");
+
+    _utf8MatchesText = !(hasCRs || hasNULs || decodingFailed);
+    return true;
+}
+
+
+FileLoaderThread::FileLoaderThread(QString filePath, QObject *parent) :
+    QThread(parent), availableChunkSlots(kMaxChunksInFlight)
+{
+    _filePath = filePath;
+    _decodingFailed = false;
+}
+
+FileLoaderThread::~FileLoaderThread()
+{
+    cancel();
+}
+
+QString FileLoaderThread::filePath()
+{
+    return _filePath;
+}
+
+QByteArray FileLoaderThread::contentHash()
+{
+    return _contentHash;
+}
+
+bool FileLoaderThread::decodingFailed()
+{
+    return _decodingFailed;
+}
+
+void FileLoaderThread::chunkConsumed()
+{
+    availableChunkSlots.release();
+}
+
+void FileLoaderThread::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+// Returns false if interrupted while waiting:
+bool FileLoaderThread::acquireChunkSlot()
+{
+    while (!availableChunkSlots.tryAcquire(1, kSlotWaitMilliseconds))
+    {
+        if (isInterruptionRequested())
+            return false;
+    }
+    return true;
+}
+
+void FileLoaderThread::run()
+{
+    // No QFile::Text: it drops every CR, whereas DecodedTextFile only
+    // turns CRLFs into LFs, and both must give the same text (e.g. the
+    // full-text index's character positions come from the latter).
+    QFile file(_filePath);
+    if (!file.open(QFile::ReadOnly))
+    {
+        emit loadFinished(file.errorString());
+        return;
+    }
+
+    qint64 totalBytes = file.size();
+    qint64 bytesRead = 0;
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    // The decoder is stateful, so multi-byte sequences that straddle
+    // chunk boundaries are decoded correctly:
+    QStringDecoder decoder(QStringConverter::Utf8);
+    QByteArray lastBytes;
+    // A CR at the end of a chunk may be the first half of a CRLF:
+    bool heldBackCR = false;
+
+    while (!file.atEnd())
+    {
+        if (isInterruptionRequested())
+            return;
+
+        QByteArray bytes = file.read(kChunkSizeBytes);
+        if (bytes.isEmpty())
+        {
+            if (file.error() != QFile::NoError)
+            {
+                emit loadFinished(file.errorString());
+                return;
+            }
+            break;
+        }
+        bytesRead += bytes.size();
+        hash.addData(bytes);
+        QString text = decoder.decode(bytes);
+        lastBytes = bytes;
+
+        if (heldBackCR)
+            text.prepend('\r');
+        heldBackCR = text.endsWith('\r');
+        if (heldBackCR)
+            text.chop(1);
+        text.replace("\r\n", "\n");
+
+        if (!acquireChunkSlot())
+            return;
+        emit chunkLoaded(text, qMin(bytesRead, totalBytes), totalBytes);
+    }
+
+    // The decoder holds on to a sequence that the file ends in the middle
+    // of (waiting for the rest of it), and would drop it silently; like
+    // any other invalid sequence, it becomes a replacement character:
+    _decodingFailed = decoder.hasError();
+    QString remainingText;
+    if (heldBackCR)
+        remainingText.append('\r');
+    if (0 < incompleteUtf8TailLength(lastBytes))
+    {
+        _decodingFailed = true;
+        remainingText.append(QChar(QChar::ReplacementCharacter));
+    }
+    if (!remainingText.isEmpty())
+    {
+        if (!acquireChunkSlot())
+            return;
+        emit chunkLoaded(remainingText, qMin(bytesRead, totalBytes), totalBytes);
+    }
+
+    // (Same as DecodedTextFile::contentHash(), as the bytes are untouched)
+    _contentHash = hash.result();
+    emit loadFinished(QString());
+}
+
+
+FileHashThread::FileHashThread(QString filePath, QObject *parent) :
+    QThread(parent)
+{
+    _filePath = filePath;
+}
+
+FileHashThread::~FileHashThread()
+{
+    cancel();
+}
+
+QString FileHashThread::filePath()
+{
+    return _filePath;
+}
+
+QByteArray FileHashThread::contentHash()
+{
+    return _contentHash;
+}
+
+void FileHashThread::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+void FileHashThread::run()
+{
+    QFile file(_filePath);
+    if (file.open(QFile::ReadOnly))
+    {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        while (!file.atEnd())
+        {
+            if (isInterruptionRequested())
+                return;
+            QByteArray bytes = file.read(kChunkSizeBytes);
+            if (bytes.isEmpty())
+                break;
+            hash.addData(bytes);
+        }
+        if (file.error() == QFile::NoError)
+            _contentHash = hash.result();
+    }
+    emit hashFinished();
+}
+
+
+LargeTextFile::LargeTextFile()
+{
+    _size = 0;
+    indexedBytes = 0;
+    _lineCount = 1;
+    lineCheckpoints.append(0);
+}
+
+bool LargeTextFile::open(QString filePath)
+{
+    _file.setFileName(filePath);
+    // Unbuffered, so that nothing read before the file changed is served
+    // from QFile's buffer:
+    if (!_file.open(QFile::ReadOnly | QFile::Unbuffered))
+    {
+        _errorString = _file.errorString();
+        return false;
+    }
+    _size = _file.size();
+    return true;
+}
+
+QString LargeTextFile::filePath()
+{
+    return _file.fileName();
+}
+QString LargeTextFile::errorString()
+{
+    return _errorString;
+}
+qint64 LargeTextFile::size()
+{
+    return _size;
+}
+bool LargeTextFile::isIndexed()
+{
+    return indexedBytes == _size;
+}
+int LargeTextFile::lineCount()
+{
+    return _lineCount;
+}
+
+bool LargeTextFile::read(qint64 offset, qint64 length, QByteArray *bytes)
+{
+    // The index (and everything read so far) describes the file as it
+    // was when it was opened; a file that has shrunk since has been
+    // truncated or rewritten, and what's there now is something else:
+    if (_file.size() < _size)
+    {
+        _errorString = QObject::tr("The file has been truncated");
+        return false;
+    }
+    if (!_file.seek(offset))
+    {
+        _errorString = _file.errorString();
+        return false;
+    }
+    *bytes = _file.read(length);
+    if (bytes->size() != length)
+    {
+        _errorString = (_file.error() != QFile::NoError)
+                       ? _file.errorString()
+                       : QObject::tr("The file has been truncated");
+        return false;
+    }
+    return true;
+}
+
+qint64 LargeTextFile::indexLines(qint64 maxBytes)
+{
+    qint64 start = indexedBytes;
+    qint64 length = qMin(_size - start, maxBytes);
+    QByteArray bytes;
+    if (!read(start, length, &bytes))
+        return -1;
+
+    const char *data = bytes.constData();
+    const char *c = data;
+    const char *end = data + length;
+    while (c < end)
+    {
+        const char *newline = (const char *)memchr(c, '\n', end - c);
+        if (newline == NULL)
+            break;
+        c = newline + 1;
+        if (_lineCount % kLineIndexStride == 0)
+            lineCheckpoints.append(start + (c - data));
+        _lineCount++;
+    }
+    indexedBytes = start + length;
+    return indexedBytes;
+}
+
+bool LargeTextFile::lines(int firstLine, int count, QString *text)
+{
+    *text = QString();
+    count = qMin(count, _lineCount - firstLine);
+    if (count <= 0 || firstLine < 0)
+        return true;
+
+    // Read from the checkpoint at or before firstLine up to the one at or
+    // after the end of the range (or the end of the file):
+    qint64 from = lineCheckpoints.at(firstLine / kLineIndexStride);
+    int endLine = firstLine + count;
+    int endCheckpoint = (endLine + kLineIndexStride - 1) / kLineIndexStride;
+    qint64 to = (endCheckpoint < lineCheckpoints.count())
+                ? lineCheckpoints.at(endCheckpoint)
+                : _size;
+    QByteArray bytes;
+    if (!read(from, to - from, &bytes))
+        return false;
+
+    const char *data = bytes.constData();
+    const char *end = data + bytes.size();
+    const char *start = data;
+    for (int i = firstLine % kLineIndexStride; 0 < i; i--)
+    {
+        const char *newline = (const char *)memchr(start, '\n', end - start);
+        if (newline == NULL)
+        {
+            // Rewritten in place since it was indexed
+            _errorString = QObject::tr("The file has been modified");
+            return false;
+        }
+        start = newline + 1;
+    }
+    const char *stop = start;
+    for (int i = count; 0 < i && stop < end; i--)
+    {
+        const char *newline = (const char *)memchr(stop, '\n', end - stop);
+        stop = (newline == NULL) ? end : newline + 1;
+    }
+    if (endLine < _lineCount)
+        stop--; // The newline that ends the last line
+
+    *text = QString::fromUtf8(start, stop - start);
+    if (text->contains('\r'))
+    {
+        text->replace("\r\n", "\n");
+        if (text->endsWith('\r'))
+            text->chop(1);
+    }
+    return true;
+}
+
+QByteArray LargeTextFile::contentHash()
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (qint64 offset = 0; offset < _size; offset += kIndexChunkSizeBytes)
+    {
+        QByteArray bytes;
+        if (!read(offset, qMin((qint64)kIndexChunkSizeBytes, _size - offset), &bytes))
+            return QByteArray();
+        hash.addData(bytes);
+    }
+    return hash.result();
+}
+
+
+LargeTextFileIndexThread::LargeTextFileIndexThread(QString filePath, QObject *parent) :
+    QThread(parent)
+{
+    _filePath = filePath;
+}
+
+LargeTextFileIndexThread::~LargeTextFileIndexThread()
+{
+    cancel();
+}
+
+QString LargeTextFileIndexThread::filePath()
+{
+    return _filePath;
+}
+
+QSharedPointer<LargeTextFile> LargeTextFileIndexThread::file()
+{
+    return _file;
+}
+
+QByteArray LargeTextFileIndexThread::contentHash()
+{
+    return _contentHash;
+}
+
+void LargeTextFileIndexThread::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+void LargeTextFileIndexThread::run()
+{
+    QSharedPointer<LargeTextFile> file(new LargeTextFile());
+    if (!file->open(_filePath))
+    {
+        emit indexFinished(file->errorString());
+        return;
+    }
+
+    while (!file->isIndexed())
+    {
+        if (isInterruptionRequested())
+            return;
+        qint64 bytesIndexed = file->indexLines(kIndexChunkSizeBytes);
+        if (bytesIndexed == -1)
+        {
+            emit indexFinished(file->errorString());
+            return;
+        }
+        emit indexProgress(bytesIndexed, file->size());
+    }
+
+    // The file is in the page cache by now:
+    _contentHash = file->contentHash();
+    if (_contentHash.isNull())
+    {
+        emit indexFinished(file->errorString());
+        return;
+    }
+    _file = file;
+    emit indexFinished(QString());
+}
@@ -0,0 +1,207 @@
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include <QtCore/QThread>
+#include <QtCore/QSemaphore>
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+/** @brief A UTF-8 text file, read into memory in one go and decoded.
+  *
+  * Pure ASCII files take a faster path that skips UTF-8 validation. The
+  * raw bytes stay available via utf8() (e.g. for handing them to the
+  * parser without re-encoding the text).
+  *
+  * The file is read rather than memory mapped. A mapping would have to
+  * stay alive until the parser thread is done with utf8(), and if
+  * another process truncates the file in the meantime, touching the
+  * mapped pages past its new end raises SIGBUS. Files that are small
+  * enough to be opened this way are read in a single read() into a
+  * buffer of the right size, so reading costs one copy more than mapping.
+  */
+class DecodedTextFile
+{
+public:
+    DecodedTextFile();
+
+    /** @brief Read and decode the file; returns false upon failure. */
+    bool open(QString filePath);
+
+    QString errorString();
+    QString text();
+    QByteArray utf8();
+
+    /** @brief Whether utf8() decodes to exactly text().
+      *
+      * Not the case if e.g. line endings had to be normalized, or if the
+      * file contains invalid UTF-8 or NUL bytes.
+      */
+    bool utf8MatchesText();
+
+    /** @brief Hash of the raw file contents, for telling whether the
+      * file has really changed later on. */
+    QByteArray contentHash();
+    static QByteArray hashFileContents(QString filePath);
+
+private:
+    QString _errorString;
+    QString _text;
+    QByteArray _utf8;
+    bool _utf8MatchesText;
+};
+
+/** @brief Reads and decodes a UTF-8 text file in chunks on a background
+  * thread.
+  *
+  * Decoded chunks are delivered via chunkLoaded(), in order. At most a
+  * few chunks are in flight at any time: the receiver must call
+  * chunkConsumed() after handling each one, so a slow receiver throttles
+  * the reader instead of the whole file piling up in the event queue.
+  */
+class FileLoaderThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit FileLoaderThread(QString filePath, QObject *parent = 0);
+    ~FileLoaderThread();
+
+    QString filePath();
+    /** @brief Hash of the raw file contents (valid once finished). */
+    QByteArray contentHash();
+    /** @brief Whether some of the file was not valid UTF-8 (and was
+      * loaded as U+FFFD instead); valid once finished. */
+    bool decodingFailed();
+    void chunkConsumed();
+    void cancel();
+
+signals:
+    void chunkLoaded(QString text, qint64 bytesRead, qint64 totalBytes);
+    /** @brief Emitted when done; errorString is null upon success. */
+    void loadFinished(QString errorString);
+
+protected:
+    void run();
+
+private:
+    QString _filePath;
+    QByteArray _contentHash;
+    bool _decodingFailed;
+    QSemaphore availableChunkSlots;
+
+    bool acquireChunkSlot();
+};
+
+/** @brief Hashes the contents of a file like
+  * DecodedTextFile::hashFileContents(), on a background thread.
+  */
+class FileHashThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit FileHashThread(QString filePath, QObject *parent = 0);
+    ~FileHashThread();
+
+    QString filePath();
+    /** @brief Valid once finished; null if the file could not be read
+      * (or hashing was canceled). */
+    QByteArray contentHash();
+    void cancel();
+
+signals:
+    void hashFinished();
+
+protected:
+    void run();
+
+private:
+    QString _filePath;
+    QByteArray _contentHash;
+};
+
+/** @brief A UTF-8 text file too large to be loaded into the editor as a
+  * whole, read a range of lines at a time.
+  *
+  * An index of line starts (built with indexLines(), possibly on a
+  * background thread) lets any range of lines be read and decoded on
+  * demand. Only every kLineIndexStride-th line start is stored, so the
+  * index stays small even for files with tens of millions of lines.
+  *
+  * The file is not memory mapped: these are typically logs, which may
+  * get truncated or rotated while open, and touching mapped pages past
+  * the end of a truncated file raises SIGBUS. Reads fail instead once
+  * the file is smaller than when it was indexed.
+  */
+class LargeTextFile
+{
+public:
+    LargeTextFile();
+
+    /** @brief Open the file; returns false upon failure. */
+    bool open(QString filePath);
+
+    QString filePath();
+    QString errorString();
+    qint64 size();
+
+    /** @brief Index the line starts in (at most) the next maxBytes of the
+      * file; returns how many bytes have been indexed so far, or -1 if
+      * the file could not be read (see errorString()). */
+    qint64 indexLines(qint64 maxBytes);
+    bool isIndexed();
+
+    /** @brief The number of lines (as blocks in a document: a file that
+      * ends with a newline has an empty last line). */
+    int lineCount();
+
+    /** @brief Set text to lines [firstLine, firstLine + count),
+      * separated by \n (with no trailing newline). Requires the file to
+      * be indexed. Returns false if the file could not be read (e.g. as
+      * it has been truncated since; see errorString()). */
+    bool lines(int firstLine, int count, QString *text);
+
+    /** @brief Null if the file could not be read. */
+    QByteArray contentHash();
+
+private:
+    QFile _file;
+    QString _errorString;
+    qint64 _size;
+    qint64 indexedBytes;
+    int _lineCount;
+    QVector<qint64> lineCheckpoints;
+
+    bool read(qint64 offset, qint64 length, QByteArray *bytes);
+};
+
+/** @brief Opens and indexes a LargeTextFile on a background thread. */
+class LargeTextFileIndexThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit LargeTextFileIndexThread(QString filePath, QObject *parent = 0);
+    ~LargeTextFileIndexThread();
+
+    QString filePath();
+    /** @brief The indexed file (valid once finished successfully). */
+    QSharedPointer<LargeTextFile> file();
+    QByteArray contentHash();
+    void cancel();
+
+signals:
+    void indexProgress(qint64 bytesIndexed, qint64 totalBytes);
+    /** @brief Emitted when done; errorString is null upon success. */
+    void indexFinished(QString errorString);
+
+protected:
+    void run();
+
+private:
+    QString _filePath;
+    QSharedPointer<LargeTextFile> _file;
+    QByteArray _contentHash;
+};
+
+#endif // FILELOADER_H
@@ -0,0 +1,69 @@
+#include "filesaver.h"
+#include "fileloader.h"
+
+#include <QtCore/QSaveFile>
+
+FileSaverThread::FileSaverThread(QString filePath, QString text,
+                                 int documentRevision, QObject *parent) :
+    QThread(parent)
+{
+    _filePath = filePath;
+    _text = text;
+    _documentRevision = documentRevision;
+}
+
+QString FileSaverThread::filePath()
+{
+    return _filePath;
+}
+
+int FileSaverThread::documentRevision()
+{
+    return _documentRevision;
+}
+
+QString FileSaverThread::errorString()
+{
+    return _errorString;
+}
+
+QByteArray FileSaverThread::contentHash()
+{
+    return _contentHash;
+}
+
+void FileSaverThread::run()
+{
+    QByteArray bytes = _text.toUtf8();
+    _text = QString();
+
+    QSaveFile file(_filePath);
+    if (!file.open(QFile::WriteOnly | QFile::Text))
+    {
+        _errorString = file.errorString();
+        emit saveFinished(_errorString);
+        return;
+    }
+
+    if (file.write(bytes) != bytes.size())
+    {
+        _errorString = file.errorString();
+        file.cancelWriting();
+        emit saveFinished(_errorString);
+        return;
+    }
+
+    // Syncs the data to disk and renames the temporary file over the
+    // target; leaves the target untouched upon failure:
+    if (!file.commit())
+    {
+        _errorString = file.errorString();
+        emit saveFinished(_errorString);
+        return;
+    }
+
+    // Read back rather than hashing `bytes`, which may differ from what
+    // ended up on disk by their line endings (QFile::Text):
+    _contentHash = DecodedTextFile::hashFileContents(_filePath);
+    emit saveFinished(QString());
+}
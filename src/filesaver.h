@@ -0,0 +1,46 @@
+#ifndef FILESAVER_H
+#define FILESAVER_H
+
+#include <QtCore/QThread>
+#include <QtCore/QString>
+
+/** @brief Encodes a snapshot of a document as UTF-8 and writes it to
+  * disk on a background thread.
+  *
+  * Writes go through QSaveFile, so the target is replaced atomically
+  * (after the data has been flushed to disk) and is never left
+  * truncated, even if the application dies mid-write.
+  */
+class FileSaverThread : public QThread
+{
+    Q_OBJECT
+public:
+    FileSaverThread(QString filePath, QString text, int documentRevision,
+                    QObject *parent = 0);
+
+    QString filePath();
+    /** @brief Identifies the snapshot; the caller compares it against its
+      * own change counter to see whether the document was edited while
+      * it was being saved. */
+    int documentRevision();
+    /** @brief Null if the save succeeded (valid once finished). */
+    QString errorString();
+    /** @brief Hash of the file contents as written (valid once finished). */
+    QByteArray contentHash();
+
+signals:
+    /** @brief Emitted when done; errorString is null upon success. */
+    void saveFinished(QString errorString);
+
+protected:
+    void run();
+
+private:
+    QString _filePath;
+    QString _text;
+    int _documentRevision;
+    QString _errorString;
+    QByteArray _contentHash;
+};
+
+#endif // FILESAVER_H
@@ -3,21 +3,271 @@
 #include "logger.h"
 #include <QtCore/QFileInfo>
 
+#include <algorithm>
+
+#define PATH_ROLE Qt::UserRole
+
+// Only the best matches are ranked and shown for non-empty queries:
+#define kMaxResults 1000
+
+#define kBasenameMatchBonus 50
+#define kBasenameCharBonus 2
+#define kWordBoundaryBonus 8
+#define kConsecutiveBonus 5
+
+
+FileExistenceCheckThread::FileExistenceCheckThread(QStringList somePaths,
+                                                   QObject *parent) :
+    QThread(parent)
+{
+    paths = somePaths;
+}
+
+FileExistenceCheckThread::~FileExistenceCheckThread()
+{
+    cancel();
+}
+
+void FileExistenceCheckThread::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+void FileExistenceCheckThread::run()
+{
+    QVector<int> missing;
+    int count = paths.count();
+    for (int i = 0; i < count; i++)
+    {
+        if (isInterruptionRequested())
+            return;
+        if (!QFile::exists(paths.at(i)))
+            missing.append(i);
+    }
+    if (!missing.isEmpty())
+        emit missingPathsFound(missing);
+}
+
+
+FileSearchResultsModel::FileSearchResultsModel(QVector<FileSearchEntry> *someEntries,
+                                               QObject *parent) :
+    QAbstractListModel(parent)
+{
+    entries = someEntries;
+}
+
+void FileSearchResultsModel::setResults(const QVector<int> &entryIndexes)
+{
+    if (entryIndexes == results)
+        return;
+    if (rowOfEntry.count() != entries->count())
+        rowOfEntry.fill(-1, entries->count());
+
+    // Afterwards, the rows that are left are a subset of entryIndexes
+    // in the same order, which the insertions then complete:
+    removeRowsNotIn(entryIndexes);
+    reorderRowsLike(entryIndexes);
+    insertRowsMissingFrom(entryIndexes);
+}
+
+void FileSearchResultsModel::removeRowsNotIn(const QVector<int> &entryIndexes)
+{
+    foreach (int entryIndex, entryIndexes)
+        rowOfEntry[entryIndex] = 0;
+    // Contiguous runs of removed rows, from the end so that the rows
+    // before each run keep their numbers:
+    int row = results.count() - 1;
+    while (0 <= row)
+    {
+        if (rowOfEntry.at(results.at(row)) != -1)
+        {
+            row--;
+            continue;
+        }
+        int last = row;
+        while (0 < row && rowOfEntry.at(results.at(row - 1)) == -1)
+            row--;
+        beginRemoveRows(QModelIndex(), row, last);
+        results.remove(row, last - row + 1);
+        endRemoveRows();
+        row--;
+    }
+    foreach (int entryIndex, entryIndexes)
+        rowOfEntry[entryIndex] = -1;
+}
+
+void FileSearchResultsModel::reorderRowsLike(const QVector<int> &entryIndexes)
+{
+    for (int row = 0; row < results.count(); row++)
+        rowOfEntry[results.at(row)] = row;
+    QVector<int> reordered;
+    reordered.reserve(results.count());
+    foreach (int entryIndex, entryIndexes)
+    {
+        if (rowOfEntry.at(entryIndex) != -1)
+            reordered.append(entryIndex);
+    }
+
+    if (reordered != results)
+    {
+        emit layoutAboutToBeChanged();
+        QVector<int> newRowOfOldRow(results.count());
+        for (int row = 0; row < reordered.count(); row++)
+            newRowOfOldRow[rowOfEntry.at(reordered.at(row))] = row;
+        QModelIndexList from = persistentIndexList();
+        QModelIndexList to;
+        foreach (const QModelIndex &index, from)
+            to.append(this->index(newRowOfOldRow.at(index.row()), index.column()));
+        changePersistentIndexList(from, to);
+        results = reordered;
+        emit layoutChanged();
+    }
+
+    foreach (int entryIndex, results)
+        rowOfEntry[entryIndex] = -1;
+}
+
+void FileSearchResultsModel::insertRowsMissingFrom(const QVector<int> &entryIndexes)
+{
+    foreach (int entryIndex, results)
+        rowOfEntry[entryIndex] = 0;
+    // Going forward, rows before `row` already match entryIndexes:
+    int count = entryIndexes.count();
+    int row = 0;
+    while (row < count)
+    {
+        if (rowOfEntry.at(entryIndexes.at(row)) != -1)
+        {
+            row++;
+            continue;
+        }
+        int first = row;
+        while (row + 1 < count && rowOfEntry.at(entryIndexes.at(row + 1)) == -1)
+            row++;
+        beginInsertRows(QModelIndex(), first, row);
+        results.insert(first, row - first + 1, 0);
+        for (int i = first; i <= row; i++)
+            results[i] = entryIndexes.at(i);
+        endInsertRows();
+        row++;
+    }
+    foreach (int entryIndex, results)
+        rowOfEntry[entryIndex] = -1;
+}
+
+QString FileSearchResultsModel::pathAtRow(int row)
+{
+    if (row < 0 || results.count() <= row)
+        return QString();
+    return entries->at(results.at(row)).path;
+}
+
+int FileSearchResultsModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return results.count();
+}
+
+QVariant FileSearchResultsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || results.count() <= index.row())
+        return QVariant();
+    const FileSearchEntry &entry = entries->at(results.at(index.row()));
+    if (role == Qt::DisplayRole)
+        return entry.displayText;
+    if (role == PATH_ROLE)
+        return entry.path;
+    return QVariant();
+}
+
+
+static inline quint64 charMaskBit(QChar c)
+{
+    return ((quint64)1) << (c.unicode() & 63);
+}
+
+static bool isWordBoundary(const QString &path, int i)
+{
+    if (i == 0)
+        return true;
+    QChar previous = path.at(i - 1);
+    if (previous == '/' || previous == '\\' || previous == '-' || previous == '_'
+        || previous == ' ' || previous == '.')
+        return true;
+    // camelCase
+    return path.at(i).isUpper() && previous.isLower();
+}
+
+// Greedily match the query's characters in order, starting at `from`:
+static int subsequenceScore(const FileSearchEntry &entry, const QString &query, int from)
+{
+    const QChar *text = entry.lowerPath.constData();
+    int textLength = entry.lowerPath.length();
+    const QChar *q = query.constData();
+    int queryLength = query.length();
+
+    int queryPos = 0;
+    int score = 0;
+    int previousMatch = -2;
+    for (int i = from; i < textLength && queryPos < queryLength; i++)
+    {
+        if (text[i] != q[queryPos])
+            continue;
+        score++;
+        if (i == previousMatch + 1)
+            score += kConsecutiveBonus;
+        if (isWordBoundary(entry.path, i))
+            score += kWordBoundaryBonus;
+        if (entry.basenameStart <= i)
+            score += kBasenameCharBonus;
+        previousMatch = i;
+        queryPos++;
+    }
+    if (queryPos < queryLength)
+        return -1;
+    return score;
+}
+
+int FileSearchDialog::matchScore(const FileSearchEntry &entry, const QString &query)
+{
+    quint64 queryMask = 0;
+    for (int i = 0; i < query.length(); i++)
+        queryMask |= charMaskBit(query.at(i));
+    if ((entry.charMask & queryMask) != queryMask)
+        return -1;
+
+    // Matches entirely within the file name rank above everything else
+    int basenameScore = subsequenceScore(entry, query, entry.basenameStart);
+    if (basenameScore != -1)
+        return kBasenameMatchBonus + basenameScore
+               - (entry.lowerPath.length() - entry.basenameStart) / 8;
+    int score = subsequenceScore(entry, query, 0);
+    if (score == -1)
+        return -1;
+    return score - entry.lowerPath.length() / 16;
+}
+
+
 FileSearchDialog::FileSearchDialog(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::FileSearchDialog)
 {
     ui->setupUi(this);
+    existenceChecker = NULL;
     setupConnections();
     ui->lineEdit->installEventFilter(this);
     ui->listView->installEventFilter(this);
 
-    fileListModel = new QStandardItemModel();
+    fileListModel = new FileSearchResultsModel(&entries, this);
+    ui->listView->setUniformItemSizes(true);
     ui->listView->setModel(fileListModel);
 }
 
 FileSearchDialog::~FileSearchDialog()
 {
+    cancelExistenceCheck();
     delete ui;
 }
 
@@ -29,20 +279,77 @@ void FileSearchDialog::setupConnections()
             this, SLOT(inputTextEdited(QString)));
 }
 
-void FileSearchDialog::resetWithFilePaths(QStringList aFilePaths)
+void FileSearchDialog::resetWithFilePaths(QStringList filePaths)
 {
-    filePaths = aFilePaths;
+    cancelExistenceCheck();
+    // (The results are indexes into the entries about to be replaced)
+    fileListModel->setResults(QVector<int>());
+
+    // Everything that doesn't depend on the query is computed once here:
+    int count = filePaths.count();
+    entries.clear();
+    entries.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        FileSearchEntry entry;
+        entry.path = filePaths.at(i);
+        entry.lowerPath = entry.path.toLower();
+        QFileInfo fileInfo(entry.path);
+        QString basename = fileInfo.fileName();
+        entry.basenameStart = entry.path.length() - basename.length();
+        entry.displayText = tr("%1  —  %2").arg(basename).arg(fileInfo.path());
+        entry.charMask = 0;
+        const QChar *c = entry.lowerPath.constData();
+        for (int j = 0; j < entry.lowerPath.length(); j++)
+            entry.charMask |= charMaskBit(c[j]);
+        entry.exists = true;
+        entries.append(entry);
+    }
+
+    lastQuery = QString();
+    lastMatches.clear();
     ui->lineEdit->clear();
     ui->lineEdit->setFocus();
     updateSearchResults("");
+
+    // Missing files are dropped from the list once we know about them,
+    // instead of stat()ing every path on every keystroke:
+    existenceChecker = new FileExistenceCheckThread(filePaths, this);
+    connect(existenceChecker, SIGNAL(missingPathsFound(QVector<int>)),
+            this, SLOT(existenceCheckFoundMissingPaths(QVector<int>)));
+    existenceChecker->start();
 }
 
-void FileSearchDialog::clearFileList()
+void FileSearchDialog::cancelExistenceCheck()
 {
-    fileListModel->clear();
+    if (existenceChecker == NULL)
+        return;
+    existenceChecker->cancel();
+    // deleteLater() so that an already queued signal can be told apart
+    // from the checker of a later reset:
+    existenceChecker->deleteLater();
+    existenceChecker = NULL;
 }
 
-#define PATH_ROLE Qt::UserRole
+void FileSearchDialog::existenceCheckFoundMissingPaths(QVector<int> indexes)
+{
+    if (existenceChecker == NULL || sender() != existenceChecker)
+        return;
+    foreach (int i, indexes)
+        entries[i].exists = false;
+
+    // Recompute from scratch (missing paths may be among lastMatches)
+    QString query = ui->lineEdit->text();
+    lastQuery = QString();
+    updateSearchResults(query);
+}
+
+void FileSearchDialog::clearFileList()
+{
+    fileListModel->setResults(QVector<int>());
+    lastQuery = QString();
+    lastMatches.clear();
+}
 
 void FileSearchDialog::accept()
 {
@@ -50,52 +357,91 @@ void FileSearchDialog::accept()
     {
         QModelIndexList selectedRows = ui->listView->selectionModel()->selectedRows();
         int selectedRow = (0 < selectedRows.count()) ? selectedRows.at(0).row() : 0;
-        QStandardItem *selectedItem = fileListModel->item(selectedRow, 0);
-        QString selectedPath = selectedItem->data(PATH_ROLE).toString();
+        QString selectedPath = fileListModel->pathAtRow(selectedRow);
         Logger::debug(QString("path: %1").arg(selectedPath));
         emit selectedFilePath(selectedPath);
     }
     else
         Logger::debug("No selection");
 
+    cancelExistenceCheck();
     clearFileList();
     QDialog::accept();
 }
 
 void FileSearchDialog::reject()
 {
+    cancelExistenceCheck();
     clearFileList();
     QDialog::reject();
 }
 
 
-bool FileSearchDialog::queryMatchesPath(QString query, QString path)
+struct ScoredMatch
 {
-    if (query.length() == 0)
-        return false;
-    return (path.toLower().indexOf(query) != -1);
-}
+    int score;
+    int entryIndex;
+};
 
+static bool scoredMatchLessThan(const ScoredMatch &a, const ScoredMatch &b)
+{
+    if (a.score != b.score)
+        return b.score < a.score; // best first
+    return a.entryIndex < b.entryIndex; // keep the original order otherwise
+}
 
 void FileSearchDialog::updateSearchResults(QString searchQuery)
 {
-    if (filePaths.isEmpty())
+    QString query = searchQuery.trimmed().toLower();
+    int count = entries.count();
+
+    if (query.isEmpty())
+    {
+        QVector<int> all;
+        all.reserve(count);
+        for (int i = 0; i < count; i++)
+        {
+            if (entries.at(i).exists)
+                all.append(i);
+        }
+        lastQuery = QString();
+        lastMatches.clear();
+        fileListModel->setResults(all);
         return;
-    bool queryIsEmpty = searchQuery.trimmed().isEmpty();
-    fileListModel->clear();
-    int count = filePaths.count();
-    for (int i = 0; i < count; i++)
+    }
+
+    // Typing more characters can only narrow the matches down, so only
+    // the previous matches need to be looked at again:
+    bool narrowing = !lastQuery.isEmpty() && query.startsWith(lastQuery);
+
+    QVector<ScoredMatch> matches;
+    QVector<int> matchIndexes;
+    int candidateCount = narrowing ? lastMatches.count() : count;
+    for (int c = 0; c < candidateCount; c++)
     {
-        QString path = filePaths.at(i);
-        if (!QFile::exists(path) || (!queryIsEmpty && !queryMatchesPath(searchQuery, path)))
+        int i = narrowing ? lastMatches.at(c) : c;
+        const FileSearchEntry &entry = entries.at(i);
+        if (!entry.exists)
+            continue;
+        int score = matchScore(entry, query);
+        if (score == -1)
             continue;
-        QStandardItem *item = new QStandardItem();
-        QString basename = QFileInfo(path).fileName();
-        QString parentDirPath = QFileInfo(path).path();
-        item->setText(tr("%1  —  %2").arg(basename).arg(parentDirPath));
-        item->setData(path, PATH_ROLE);
-        fileListModel->appendRow(item);
+        ScoredMatch match;
+        match.score = score;
+        match.entryIndex = i;
+        matches.append(match);
+        matchIndexes.append(i);
     }
+    lastQuery = query;
+    lastMatches = matchIndexes;
+
+    int resultCount = qMin(matches.count(), kMaxResults);
+    std::partial_sort(matches.begin(), matches.begin() + resultCount, matches.end(),
+                      scoredMatchLessThan);
+    QVector<int> results(resultCount);
+    for (int i = 0; i < resultCount; i++)
+        results[i] = matches.at(i).entryIndex;
+    fileListModel->setResults(results);
 }
 
 
@@ -2,13 +2,82 @@
 #define FILESEARCHDIALOG_H
 
 #include <QtWidgets/QDialog>
-#include <QtGui/QStandardItemModel>
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
 #include <QtGui/QKeyEvent>
 
 namespace Ui {
     class FileSearchDialog;
 }
 
+/** @brief A searchable file path, with everything the matcher needs
+  * computed up front (once per reset, not once per keystroke).
+  */
+struct FileSearchEntry
+{
+    QString path;
+    QString lowerPath;
+    QString displayText;
+    int basenameStart;
+    // Bloom-style mask of the characters in lowerPath, for rejecting
+    // most non-matching paths without looking at them:
+    quint64 charMask;
+    bool exists;
+};
+
+/** @brief Checks which of a list of paths exist, on a background thread. */
+class FileExistenceCheckThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit FileExistenceCheckThread(QStringList paths, QObject *parent = 0);
+    ~FileExistenceCheckThread();
+    void cancel();
+
+signals:
+    /** @brief Indexes (into the given list) of the paths that don't exist. */
+    void missingPathsFound(QVector<int> indexes);
+
+protected:
+    void run();
+
+private:
+    QStringList paths;
+};
+
+/** @brief List model of search results: rows are just indexes into the
+  * entries owned by the dialog, so updating the results is cheap.
+  *
+  * New results are applied as row removals, a reordering of the rows
+  * that stay and row insertions (not as a reset), so that the view keeps
+  * its selection and scroll position and only redoes the rows that
+  * changed.
+  */
+class FileSearchResultsModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit FileSearchResultsModel(QVector<FileSearchEntry> *entries,
+                                    QObject *parent = 0);
+
+    void setResults(const QVector<int> &entryIndexes);
+    QString pathAtRow(int row);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+private:
+    QVector<FileSearchEntry> *entries;
+    QVector<int> results;
+    // Scratch space for setResults(), indexed by entry (-1 elsewhere):
+    QVector<int> rowOfEntry;
+
+    void removeRowsNotIn(const QVector<int> &entryIndexes);
+    void reorderRowsLike(const QVector<int> &entryIndexes);
+    void insertRowsMissingFrom(const QVector<int> &entryIndexes);
+};
+
 class FileSearchDialog : public QDialog
 {
     Q_OBJECT
@@ -20,17 +89,26 @@ public:
     void resetWithFilePaths(QStringList filePaths);
     bool eventFilter(QObject* obj, QEvent *event);
 
+    /** @brief Score how well query (lowercase) fuzzily matches entry,
+      * or return -1 if it doesn't match at all.
+      */
+    static int matchScore(const FileSearchEntry &entry, const QString &query);
+
 private:
     Ui::FileSearchDialog *ui;
-    QStringList filePaths;
-    QStandardItemModel *fileListModel;
+    QVector<FileSearchEntry> entries;
+    FileSearchResultsModel *fileListModel;
+    FileExistenceCheckThread *existenceChecker;
+    QString lastQuery;
+    QVector<int> lastMatches;
     void setupConnections();
     void clearFileList();
+    void cancelExistenceCheck();
     void updateSearchResults(QString searchQuery);
-    bool queryMatchesPath(QString query, QString path);
 
 private slots:
     void inputTextEdited(QString newText);
+    void existenceCheckFoundMissingPaths(QVector<int> indexes);
     void accept();
     void reject();
 
@@ -0,0 +1,196 @@
+#include "linediff.h"
+
+#include <QtCore/QVector>
+#include <QtCore/QPair>
+#include <QtGui/QTextDocument>
+#include <QtGui/QTextCursor>
+#include <QtGui/QTextBlock>
+
+static LineDiffHunk makeHunk(int oldStart, int oldCount, int newStart, int newCount)
+{
+    LineDiffHunk hunk;
+    hunk.oldStart = oldStart;
+    hunk.oldCount = oldCount;
+    hunk.newStart = newStart;
+    hunk.newCount = newCount;
+    return hunk;
+}
+
+QList<LineDiffHunk> LineDiff::diff(const QStringList &oldLines,
+                                   const QStringList &newLines,
+                                   int maxEditDistance)
+{
+    QList<LineDiffHunk> hunks;
+
+    // Skip the common prefix and suffix; typically only a small region
+    // in the middle remains:
+    int oldEnd = oldLines.count();
+    int newEnd = newLines.count();
+    int start = 0;
+    while (start < oldEnd && start < newEnd && oldLines.at(start) == newLines.at(start))
+        start++;
+    while (start < oldEnd && start < newEnd
+           && oldLines.at(oldEnd - 1) == newLines.at(newEnd - 1))
+    {
+        oldEnd--;
+        newEnd--;
+    }
+
+    int n = oldEnd - start;
+    int m = newEnd - start;
+    if (n == 0 && m == 0)
+        return hunks;
+    if (n == 0 || m == 0)
+    {
+        hunks.append(makeHunk(start, n, start, m));
+        return hunks;
+    }
+
+    // Myers: v[k] is the furthest x reached on diagonal k (= x - y). A
+    // copy of v is kept for each edit distance d for backtracking.
+    int limit = qMin(n + m, maxEditDistance);
+    int offset = limit + 1;
+    QVector<int> v(2 * limit + 3, 0);
+    QList<QVector<int> > trace;
+    int foundD = -1;
+    for (int d = 0; d <= limit && foundD == -1; d++)
+    {
+        trace.append(v);
+        for (int k = -d; k <= d; k += 2)
+        {
+            int x;
+            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                x = v[offset + k + 1]; // down: insertion
+            else
+                x = v[offset + k - 1] + 1; // right: deletion
+            int y = x - k;
+            while (x < n && y < m && oldLines.at(start + x) == newLines.at(start + y))
+            {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if (n <= x && m <= y)
+            {
+                foundD = d;
+                break;
+            }
+        }
+    }
+
+    if (foundD == -1)
+    {
+        // Too different to be worth it
+        hunks.append(makeHunk(start, n, start, m));
+        return hunks;
+    }
+
+    // Walk back through the trace, collecting the matching line pairs:
+    QList<QPair<int, int> > matches;
+    int x = n;
+    int y = m;
+    for (int d = foundD; 0 < d; d--)
+    {
+        const QVector<int> &pv = trace.at(d);
+        int k = x - y;
+        int prevK = (k == -d || (k != d && pv[offset + k - 1] < pv[offset + k + 1]))
+                    ? k + 1 : k - 1;
+        int prevX = pv[offset + prevK];
+        int prevY = prevX - prevK;
+        while (prevX < x && prevY < y)
+        {
+            matches.prepend(qMakePair(x - 1, y - 1));
+            x--;
+            y--;
+        }
+        x = prevX;
+        y = prevY;
+    }
+    while (0 < x && 0 < y)
+    {
+        matches.prepend(qMakePair(x - 1, y - 1));
+        x--;
+        y--;
+    }
+
+    // The gaps between matching lines are the hunks:
+    int oldPos = 0;
+    int newPos = 0;
+    matches.append(qMakePair(n, m)); // sentinel
+    for (int i = 0; i < matches.count(); i++)
+    {
+        int matchOld = matches.at(i).first;
+        int matchNew = matches.at(i).second;
+        if (oldPos < matchOld || newPos < matchNew)
+            hunks.append(makeHunk(start + oldPos, matchOld - oldPos,
+                                  start + newPos, matchNew - newPos));
+        oldPos = matchOld + 1;
+        newPos = matchNew + 1;
+    }
+
+    return hunks;
+}
+
+void LineDiff::applyToDocument(const QList<LineDiffHunk> &hunks,
+                               const QStringList &newLines,
+                               QTextDocument *document)
+{
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+
+    // Back to front, so that the line numbers of the hunks not yet
+    // applied stay valid:
+    for (int i = hunks.count() - 1; 0 <= i; i--)
+    {
+        const LineDiffHunk &hunk = hunks.at(i);
+        QString text = QStringList(newLines.mid(hunk.newStart, hunk.newCount)).join('\n');
+        int blockCount = document->blockCount();
+
+        if (0 < hunk.oldCount && 0 < hunk.newCount)
+        {
+            // Replace the lines' contents, keeping the surrounding separators
+            QTextBlock first = document->findBlockByNumber(hunk.oldStart);
+            QTextBlock last = document->findBlockByNumber(hunk.oldStart + hunk.oldCount - 1);
+            cursor.setPosition(first.position());
+            cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+            cursor.insertText(text);
+        }
+        else if (0 < hunk.oldCount)
+        {
+            // Remove the lines along with one line separator
+            int lastLine = hunk.oldStart + hunk.oldCount - 1;
+            if (lastLine + 1 < blockCount)
+            {
+                cursor.setPosition(document->findBlockByNumber(hunk.oldStart).position());
+                cursor.setPosition(document->findBlockByNumber(lastLine + 1).position(),
+                                   QTextCursor::KeepAnchor);
+            }
+            else
+            {
+                QTextBlock previous = document->findBlockByNumber(hunk.oldStart - 1);
+                QTextBlock last = document->findBlockByNumber(lastLine);
+                cursor.setPosition(previous.position() + previous.length() - 1);
+                cursor.setPosition(last.position() + last.length() - 1,
+                                   QTextCursor::KeepAnchor);
+            }
+            cursor.removeSelectedText();
+        }
+        else if (0 < hunk.newCount)
+        {
+            // Insert whole lines before line oldStart (or after the last one)
+            if (hunk.oldStart < blockCount)
+            {
+                cursor.setPosition(document->findBlockByNumber(hunk.oldStart).position());
+                cursor.insertText(text + "\n");
+            }
+            else
+            {
+                QTextBlock last = document->lastBlock();
+                cursor.setPosition(last.position() + last.length() - 1);
+                cursor.insertText("\n" + text);
+            }
+        }
+    }
+
+    cursor.endEditBlock();
+}
@@ -0,0 +1,46 @@
+#ifndef LINEDIFF_H
+#define LINEDIFF_H
+
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+/** @brief A run of lines [oldStart, oldStart + oldCount) in the old text
+  * replaced by the lines [newStart, newStart + newCount) of the new one.
+  */
+struct LineDiffHunk
+{
+    int oldStart;
+    int oldCount;
+    int newStart;
+    int newCount;
+};
+
+/** @brief Line-based diffing (Myers' O(ND) algorithm), for updating a
+  * document to match a new version of its text with minimal edits.
+  */
+class LineDiff
+{
+public:
+    /** @brief Compute the hunks that turn oldLines into newLines.
+      *
+      * Lines common to both ends are skipped right away. If the rest
+      * needs more than maxEditDistance line insertions + deletions, it's
+      * returned as a single hunk instead of searching further.
+      */
+    static QList<LineDiffHunk> diff(const QStringList &oldLines,
+                                    const QStringList &newLines,
+                                    int maxEditDistance);
+
+    /** @brief Apply hunks computed against the document's current lines
+      * (i.e. its blocks) as edits, in a single undo step.
+      */
+    static void applyToDocument(const QList<LineDiffHunk> &hunks,
+                                const QStringList &newLines,
+                                QTextDocument *document);
+};
+
+#endif // LINEDIFF_H
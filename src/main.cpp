@@ -3,14 +3,61 @@
 #include "mainwindow.h"
 #include "qarkdownapplication.h"
 #include "logger.h"
+#include "batchexporter.h"
+#include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 
 #ifdef QT_MAC_USE_COCOA
 #import "mac/cocoaappdelegate.h"
 #endif
 
+static int runBatchExport(int &argc, char *argv[])
+{
+    // Headless: no QApplication, so this works without a display
+    QCoreApplication app(argc, argv);
+    QarkdownApplication::setupApplicationInfo();
+
+    QStringList positionalArgs;
+    int numWorkers = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        QString arg = QString::fromLocal8Bit(argv[i]);
+        if (arg == "--export" || arg == "-d")
+            continue;
+        if (arg == "-j" && i + 1 < argc)
+            numWorkers = QString::fromLocal8Bit(argv[++i]).toInt();
+        else if (arg.startsWith("-j"))
+            numWorkers = arg.mid(2).toInt();
+        else
+            positionalArgs.append(arg);
+    }
+
+    if (positionalArgs.count() != 2)
+    {
+        fprintf(stderr, "usage: %s --export <input-dir> <output-dir> [-j N]\n", argv[0]);
+        return 2;
+    }
+
+    QSettings settings("org.hasseg", "QarkDown");
+    BatchExporter exporter(&settings);
+    if (0 < numWorkers)
+        exporter.setNumWorkers(numWorkers);
+    return exporter.exportDirectory(positionalArgs.at(0), positionalArgs.at(1));
+}
+
 int main(int argc, char *argv[])
 {
+    bool exportMode = false;
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp("-d", argv[i]) == 0)
+            Logger::setAllLevelsEnabled(true);
+        else if (strcmp("--export", argv[i]) == 0)
+            exportMode = true;
+    }
+    if (exportMode)
+        return runBatchExport(argc, argv);
+
 #ifdef QT_MAC_USE_COCOA
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     CocoaAppDelegate *cocoaAppDelegate = [[CocoaAppDelegate alloc] init];
@@ -24,12 +71,6 @@ int main(int argc, char *argv[])
     [cocoaAppDelegate registerForApplicationEvents];
 #endif
 
-    for (int i = 0; i < argc; i++)
-    {
-        if (strcmp("-d", argv[i]) == 0)
-            Logger::setAllLevelsEnabled(true);
-    }
-
     MainWindow window;
 
 #ifdef QT_MAC_USE_COCOA
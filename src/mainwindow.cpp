@@ -3,17 +3,22 @@
 #include <QtWidgets/QMenu>
 #include <QtWidgets/QMenuBar>
 #include <QtWidgets/QFileDialog>
-#include <QtWidgets/QInputDialog>
 #include <QtWidgets/QLineEdit>
+#include <QtWidgets/QInputDialog>
 #include <QtWidgets/QScrollBar>
+#include <QtWidgets/QStatusBar>
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QHBoxLayout>
 #include <QtCore/QTextStream>
 #include <QtCore/QCryptographicHash>
 #include <QStandardPaths>
+#include <algorithm>
 
 #include "mainwindow.h"
 #include "defines.h"
 #include "logger.h"
 #include "qarkdownapplication.h"
+#include "linediff.h"
 
 #ifdef Q_OS_MAC
 #include <Cocoa/Cocoa.h>
@@ -33,28 +38,134 @@ TODO:
 */
 
 #define kUntitledFileUIName "Untitled"
+#define kEditJournalDirName "journal"
+#define kNotesIndexFileName "notes-index.dat"
+#define kNotesTextIndexDirName "notes-text-index"
+// Writers often touch a file many times in quick succession:
+#define kOpenFileChangeDebounceMilliseconds 500
+// The caches (layout, highlighting, parse results) of background tabs
+// are dropped, least recently shown first, beyond this much in total:
+#define kBackgroundTabCachesBudgetBytes (64 * 1024 * 1024)
+
+// Each tab journals its edits into a numbered subdirectory of this:
+static QString editJournalsDirPath()
+{
+    return QarkdownApplication::applicationStoragePath() + "/" + kEditJournalDirName;
+}
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
 {
-    discardingChangesOnQuit = false;
+    fileSaver = NULL;
+    fileSaverSavingNewFile = false;
+    documentChangeCount = 0;
+    askingToReloadFile = false;
+    openFileHasher = NULL;
+    openFileKnownSize = -1;
+    openFileWatcher = new QFileSystemWatcher(this);
+    connect(openFileWatcher, SIGNAL(fileChanged(QString)),
+            this, SLOT(openFileWatcherNotification(QString)));
+    connect(openFileWatcher, SIGNAL(directoryChanged(QString)),
+            this, SLOT(openFileWatcherNotification(QString)));
+    openFileChangeTimer = new QTimer(this);
+    openFileChangeTimer->setSingleShot(true);
+    openFileChangeTimer->setInterval(kOpenFileChangeDebounceMilliseconds);
+    connect(openFileChangeTimer, SIGNAL(timeout()),
+            this, SLOT(openFileChangeTimerTimeout()));
+    loadProgressBar = NULL;
     settings = new QSettings("org.hasseg", "QarkDown");
     compiler = new MarkdownCompiler(settings);
+    compileProgressDialog = NULL;
+    compiling = false;
+    connect(compiler, SIGNAL(compilerStillRunning(qint64)),
+            this, SLOT(compilerStillRunning(qint64)));
+    connect(compiler, SIGNAL(compilationFinished()),
+            this, SLOT(compilationFinished()));
+    prepareCompiler();
 
     preferencesDialog = new PreferencesDialog(settings, compiler);
     fileSearchDialog = new FileSearchDialog(this);
     fileSearchDialog->setWindowModality(Qt::WindowModal);
+    notesIndexer = new NotesIndexer(QarkdownApplication::applicationStoragePath()
+                                    + "/" + kNotesIndexFileName,
+                                    this);
+    notesTextIndex = new NotesTextIndex(QarkdownApplication::applicationStoragePath()
+                                        + "/" + kNotesTextIndexDirName,
+                                        this);
+    notesSearchDialog = new NotesSearchDialog(notesTextIndex, this);
+    notesSearchDialog->setWindowModality(Qt::WindowModal);
+    applyNotesFolderPreferences();
 
     recentFilesMenuActions = new QList<QAction *>();
+    currentTabIndex = -1;
+    switchingTabs = false;
+    tabShowCounter = 0;
+    styleGeneration = 0;
+    parseScheduler = new ParseScheduler(this);
+    // Hidden while there is just the one document:
+    tabBar = new QTabBar;
+    tabBar->setDocumentMode(true);
+    tabBar->setTabsClosable(true);
+    tabBar->setExpanding(false);
+    tabBar->setAutoHide(true);
+    connect(tabBar, SIGNAL(currentChanged(int)),
+            this, SLOT(tabBarCurrentChanged(int)));
+    connect(tabBar, SIGNAL(tabCloseRequested(int)),
+            this, SLOT(tabBarCloseRequested(int)));
+
+    outlinePanel = new OutlinePanel(this);
+    outlinePanel->hide();
+    addDockWidget(Qt::LeftDockWidgetArea, outlinePanel);
+    connect(outlinePanel, SIGNAL(headingActivated(int)),
+            this, SLOT(outlineHeadingActivated(int)));
+    connect(outlinePanel, SIGNAL(visibilityChanged(bool)),
+            this, SLOT(updateOutline()));
 
     setupFileMenu();
     setupEditor();
-    setCentralWidget(editor);
+    connect(editor, SIGNAL(cursorPositionChanged()),
+            this, SLOT(selectCurrentOutlineHeading()));
+    connect(editor, SIGNAL(readOnlyChanged(bool)),
+            this, SLOT(editorReadOnlyChanged(bool)));
+    searchBar = new SearchBar(editor);
+    searchBar->hide();
+    QWidget *editorArea = new QWidget;
+    QVBoxLayout *editorAreaLayout = new QVBoxLayout(editorArea);
+    editorAreaLayout->setContentsMargins(0, 0, 0, 0);
+    editorAreaLayout->setSpacing(0);
+    editorAreaLayout->addWidget(tabBar);
+    QHBoxLayout *editorRowLayout = new QHBoxLayout;
+    editorRowLayout->setContentsMargins(0, 0, 0, 0);
+    editorRowLayout->setSpacing(0);
+    editorRowLayout->addWidget(editor);
+    editorRowLayout->addWidget(overviewMap);
+    editorAreaLayout->addLayout(editorRowLayout);
+    editorAreaLayout->addWidget(searchBar);
+    setCentralWidget(editorArea);
+
+    // Read the journals left behind by a crashed session before anything
+    // (like opening a file given on the command line) starts new ones:
+    QDir journalsDir(editJournalsDirPath());
+    foreach (QString dirName, journalsDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot,
+                                                    QDir::Name))
+    {
+        QString recoveredFilePath;
+        QString recoveredText;
+        if (EditJournal::recover(journalsDir.absoluteFilePath(dirName),
+                                 &recoveredFilePath, &recoveredText))
+        {
+            recoveredFilePaths.append(recoveredFilePath);
+            recoveredTexts.append(recoveredText);
+        }
+    }
 
     qApp->installEventFilter(this);
 }
 
 MainWindow::~MainWindow()
 {
+    // The tabs' documents must outlive the editor showing one of them:
+    delete centralWidget();
+    qDeleteAll(tabs);
     delete settings;
     delete preferencesDialog;
     delete compiler;
@@ -82,44 +193,153 @@ void MainWindow::show()
     QMainWindow::show();
 }
 
+bool MainWindow::mayAskToReloadFile()
+{
+    // Our own write in progress would look like a third-party change, and
+    // a file being loaded will get its known state once it's done:
+    if (fileSaver != NULL || currentTab()->isLoading())
+        return false;
+    if (askingToReloadFile)
+        return false;
+    if (compiling)
+    {
+        // Checked again once the compile is done:
+        openFileChangeTimer->start();
+        return false;
+    }
+    return settings->value(SETTING_ASK_RELOAD_MODIFIED_FILE, DEF_ASK_RELOAD_MODIFIED_FILE).toBool();
+}
+
 void MainWindow::checkIfFileModifiedByThirdParty()
 {
     // If we don't have a known modification date, we can't do anything:
     if (openFileKnownLastModified.isNull())
         return;
-    bool shouldAsk = settings->value(SETTING_ASK_RELOAD_MODIFIED_FILE, DEF_ASK_RELOAD_MODIFIED_FILE).toBool();
-    if (!shouldAsk)
+    if (!mayAskToReloadFile())
+        return;
+
+    QFileInfo fileInfo(openFilePath);
+    if (!fileInfo.exists()) // e.g. in the middle of an atomic replace
+        return;
+    QDateTime currentLastModified = fileInfo.lastModified();
+    if (currentLastModified == openFileKnownLastModified)
         return;
 
-    QDateTime currentLastModified = QFileInfo(openFilePath).lastModified();
-    if (openFileKnownLastModified < currentLastModified)
+    // A file of a different size has different contents; no need to
+    // hash it (e.g. a log that keeps growing):
+    if (fileInfo.size() != openFileKnownSize)
     {
+        cancelOpenFileHashing();
         openFileKnownLastModified = currentLastModified;
+        openFileKnownSize = fileInfo.size();
+        openFileKnownHash = QByteArray();
+        askToReloadModifiedFile();
+        return;
+    }
+
+    // Only the contents matter; a mere touch doesn't count. The file is
+    // hashed in the background (it may be large), and the known state is
+    // only updated once that's done:
+    if (openFileHasher != NULL)
+    {
+        if (openFileHashedLastModified == currentLastModified)
+            return;
+        cancelOpenFileHashing();
+    }
+    openFileHashedLastModified = currentLastModified;
+    openFileHasher = new FileHashThread(openFilePath, this);
+    connect(openFileHasher, SIGNAL(hashFinished()),
+            this, SLOT(openFileHashFinished()));
+    openFileHasher->start(QThread::LowPriority);
+}
+
+void MainWindow::cancelOpenFileHashing()
+{
+    if (openFileHasher == NULL)
+        return;
+    openFileHasher->cancel();
+    // deleteLater() so that a queued hashFinished() signal finds its
+    // sender stale rather than deleted:
+    openFileHasher->deleteLater();
+    openFileHasher = NULL;
+}
 
-        QMessageBox revertMessageBox(this);
-        revertMessageBox.setWindowModality(Qt::WindowModal);
-        revertMessageBox.setIcon(QMessageBox::Warning);
-        revertMessageBox.setText(
-                    tr("Do you want to reload the modified document “%1”?")
-                    .arg(QFileInfo(openFilePath).fileName()));
-        revertMessageBox.setInformativeText(
-                    tr("Another process seems to have modified this file. "
-                       "Would you like to reload it from disk?"));
-        revertMessageBox.setDefaultButton(revertMessageBox.addButton(tr("Reload"), QMessageBox::AcceptRole));
-        revertMessageBox.addButton(tr("Keep Current"), QMessageBox::RejectRole);
-        revertMessageBox.exec();
+void MainWindow::openFileHashFinished()
+{
+    if (openFileHasher == NULL || sender() != openFileHasher)
+        return;
+    QString filePath = openFileHasher->filePath();
+    QByteArray currentHash = openFileHasher->contentHash();
+    openFileHasher->deleteLater();
+    openFileHasher = NULL;
+
+    if (filePath != openFilePath || currentHash.isNull())
+        return;
+    // (Leaving the known state as it was, so that the file gets hashed
+    // again when this is retried)
+    if (!mayAskToReloadFile())
+        return;
+
+    openFileKnownLastModified = openFileHashedLastModified;
+    if (!openFileKnownHash.isNull() && currentHash == openFileKnownHash)
+        return;
+    openFileKnownHash = currentHash;
+    askToReloadModifiedFile();
+}
 
-        QMessageBox::ButtonRole selectedButtonRole = revertMessageBox.buttonRole(revertMessageBox.clickedButton());
-        if (selectedButtonRole == QMessageBox::AcceptRole)
-            revertToSaved();
+void MainWindow::askToReloadModifiedFile()
+{
+    askingToReloadFile = true;
+
+    QMessageBox revertMessageBox(this);
+    revertMessageBox.setWindowModality(Qt::WindowModal);
+    revertMessageBox.setIcon(QMessageBox::Warning);
+    revertMessageBox.setText(
+                tr("Do you want to reload the modified document “%1”?")
+                .arg(QFileInfo(openFilePath).fileName()));
+    revertMessageBox.setInformativeText(
+                tr("Another process seems to have modified this file. "
+                   "Would you like to reload it from disk?"));
+    revertMessageBox.setDefaultButton(revertMessageBox.addButton(tr("Reload"), QMessageBox::AcceptRole));
+    revertMessageBox.addButton(tr("Keep Current"), QMessageBox::RejectRole);
+    revertMessageBox.exec();
+
+    QMessageBox::ButtonRole selectedButtonRole = revertMessageBox.buttonRole(revertMessageBox.clickedButton());
+    askingToReloadFile = false;
+    if (selectedButtonRole == QMessageBox::AcceptRole)
+        revertToSaved();
+    else
+    {
+        // Journaled edits can't be replayed onto the changed file:
+        journal->checkpoint();
     }
 }
 
+void MainWindow::openFileWatcherNotification(QString path)
+{
+    Q_UNUSED(path);
+    openFileChangeTimer->start();
+}
+
+void MainWindow::openFileChangeTimerTimeout()
+{
+    if (openFilePath.isNull())
+        return;
+    // Writers that replace the file via a rename make the watcher lose
+    // track of it (that's why the directory is watched, too):
+    if (!openFileWatcher->files().contains(openFilePath) && QFile::exists(openFilePath))
+        openFileWatcher->addPath(openFilePath);
+    checkIfFileModifiedByThirdParty();
+}
+
 bool MainWindow::eventFilter(QObject *obj, QEvent *event)
 {
     if (obj != qApp)
         return QMainWindow::eventFilter(obj, event);
 
+    // Changes are normally noticed via openFileWatcher; this is a cheap
+    // fallback for file systems that cannot be watched (e.g. some
+    // network mounts):
     if (event->type() == QEvent::ApplicationActivate)
         checkIfFileModifiedByThirdParty();
 
@@ -135,27 +355,56 @@ QString standardizeFilePath(QString filePath)
     return std;
 }
 
-void MainWindow::setOpenFilePath(QString newValue)
+void MainWindow::setOpenFilePath(QString newValue, QByteArray contentHash)
 {
     openFilePath = newValue;
     revertToSavedMenuAction->setEnabled(!openFilePath.isNull());
     revealFileAction->setEnabled(!openFilePath.isNull());
+    QFileInfo openFileInfo(openFilePath);
     openFileKnownLastModified = openFilePath.isNull()
                                 ? QDateTime()
-                                : QFileInfo(openFilePath).lastModified();
+                                : openFileInfo.lastModified();
+    openFileKnownSize = openFilePath.isNull() ? -1 : openFileInfo.size();
+    openFileKnownHash = contentHash;
+    // A hash of what was there before must not be taken for a change:
+    cancelOpenFileHashing();
+
+    openFileChangeTimer->stop();
+    if (!openFileWatcher->files().isEmpty())
+        openFileWatcher->removePaths(openFileWatcher->files());
+    if (!openFileWatcher->directories().isEmpty())
+        openFileWatcher->removePaths(openFileWatcher->directories());
+    if (!openFilePath.isNull())
+    {
+        openFileWatcher->addPath(openFilePath);
+        openFileWatcher->addPath(QFileInfo(openFilePath).absolutePath());
+    }
+
+    if (0 <= currentTabIndex)
+        updateTabTitle(currentTabIndex);
 }
 
 void MainWindow::newFile()
 {
-    QMessageBox::ButtonRole selectedButtonRole = offerToSaveChangesIfNecessary();
-    if (selectedButtonRole == QMessageBox::RejectRole)
+    if (compiling)
         return;
+    if (!isCurrentTabUnused())
+    {
+        createTab();
+        activateTab(tabs.count() - 1);
+    }
+    resetCurrentDocument();
+}
 
+void MainWindow::resetCurrentDocument()
+{
+    journal->stopRecording();
     editor->clear();
     setOpenFilePath(QString());
     lastCompileTargetPath = QString();
     recompileAction->setEnabled(false);
     setDirty(false);
+    journal->startRecording(QString());
     updateRecentFilesMenu();
 }
 
@@ -181,20 +430,7 @@ QString MainWindow::getMarkdownFilesFilter()
 
 QStringList MainWindow::getMarkdownFilesFilterList()
 {
-    QStringList extensions = settings->value(SETTING_EXTENSIONS, DEF_EXTENSIONS)
-                             .toString().split(' ', Qt::SkipEmptyParts);
-    if (extensions.count() == 0)
-        return QStringList("*.*");
-
-    QStringList filterList;
-    foreach (QString ext, extensions)
-    {
-        QString cleanExt = ext.trimmed();
-        if (cleanExt.startsWith("."))
-            cleanExt = cleanExt.remove(0,1);
-        filterList.append("*." + cleanExt);
-    }
-    return filterList;
+    return QarkdownApplication::markdownFilesFilterList(settings);
 }
 
 QString MainWindow::getPathFromFileDialog(FileDialogKind dialogKind)
@@ -246,13 +482,14 @@ QString MainWindow::getPathFromFileDialog(FileDialogKind dialogKind)
     return retVal;
 }
 
+#define kBackgroundLoadThresholdBytes (4 * 1024 * 1024)
+// ..and files this large are not loaded as a whole at all:
+#define kLargeFileModeThresholdBytes (128 * 1024 * 1024)
+
 void MainWindow::openFile(const QString &path)
 {
-    saveCurrentFileViewPositions();
-    QMessageBox::ButtonRole selectedButtonRole = offerToSaveChangesIfNecessary();
-    if (selectedButtonRole == QMessageBox::RejectRole)
+    if (compiling)
         return;
-
     QString filePathToOpen = path;
 
     if (filePathToOpen.isNull())
@@ -263,26 +500,80 @@ void MainWindow::openFile(const QString &path)
 
     filePathToOpen = standardizeFilePath(filePathToOpen);
 
-    QFile file(filePathToOpen);
-    if (!file.open(QFile::ReadOnly | QFile::Text))
+    int existingIndex = backgroundTabIndexForFilePath(filePathToOpen);
+    if (existingIndex != -1)
+    {
+        // (An unused tab would only be in the way)
+        int leftIndex = currentTabIndex;
+        bool removeLeftTab = isCurrentTabUnused();
+        activateTab(existingIndex);
+        if (removeLeftTab)
+            removeBackgroundTab(leftIndex);
+        return;
+    }
+
+    // The current file is reloaded in place, and an unused tab is
+    // reused; any other file gets a tab of its own:
+    bool openInNewTab = !isCurrentTabUnused();
+    if (filePathToOpen == openFilePath)
+    {
+        saveCurrentFileViewPositions();
+        if (offerToSaveChangesIfNecessary() == QMessageBox::RejectRole)
+            return;
+        cancelBackgroundFileLoading();
+        openInNewTab = false;
+    }
+
+    qint64 fileSize = QFileInfo(filePathToOpen).size();
+    if (kLargeFileModeThresholdBytes <= fileSize
+        || kBackgroundLoadThresholdBytes <= fileSize)
+    {
+        if (openInNewTab)
+        {
+            createTab();
+            activateTab(tabs.count() - 1);
+        }
+        if (kLargeFileModeThresholdBytes <= fileSize)
+            loadLargeFile(filePathToOpen);
+        else
+            loadFileInBackground(filePathToOpen);
+        return;
+    }
+
+    DecodedTextFile openedFile;
+    if (!openedFile.open(filePathToOpen))
     {
         QMessageBox::warning(this, tr("Cannot Open File"),
                              tr("Cannot open: %1 (reason: %2)")
                              .arg(filePathToOpen)
-                             .arg(file.errorString()));
+                             .arg(openedFile.errorString()));
         return;
     }
 
-    QTextStream inStream(&file);
-    inStream.setEncoding(QStringConverter::Utf8);
-    editor->setPlainText(inStream.readAll());
-    file.close();
+    if (openInNewTab)
+    {
+        createTab();
+        activateTab(tabs.count() - 1);
+    }
+    journal->stopRecording();
+    editor->setPlainText(openedFile.text());
+    // Parse the file's bytes directly instead of having the highlighter
+    // convert the document we just decoded from them back to UTF-8:
+    if (openedFile.utf8MatchesText())
+        highlighter->parseUtf8(openedFile.utf8());
+
+    didOpenFile(filePathToOpen, openedFile.contentHash());
+    loadAndSetCurrentFileViewPositions();
+}
 
-    setOpenFilePath(filePathToOpen);
+void MainWindow::didOpenFile(QString filePath, QByteArray contentHash)
+{
+    setOpenFilePath(filePath, contentHash);
     recompileAction->setEnabled(false);
     lastCompileTargetPath = QString();
 
     setDirty(false);
+    journal->startRecording(filePath, openFileKnownHash);
     bool rememberLastFile = settings->value(SETTING_REMEMBER_LAST_FILE,
                                             QVariant(DEF_REMEMBER_LAST_FILE)).toBool();
     if (rememberLastFile) {
@@ -291,10 +582,259 @@ void MainWindow::openFile(const QString &path)
     }
     addToRecentFiles(openFilePath);
     updateRecentFilesMenu();
+}
 
+void MainWindow::loadFileInBackground(QString filePath)
+{
+    // Large files are appended to the document in chunks as they are
+    // decoded, so that the UI stays responsive. The editor is read-only
+    // and highlighting is deferred until the whole file is in.
+    highlighter->setSuspended(true);
+    journal->stopRecording();
+    editor->document()->setUndoRedoEnabled(false);
+    editor->clear();
+    editor->setReadOnly(true);
+    setOpenFilePath(filePath);
+    setDirty(false);
+    DocumentTab *tab = currentTab();
+    tab->loadProgress = 0;
+    showLoadProgress(filePath);
+
+    tab->fileLoader = new FileLoaderThread(filePath, this);
+    connect(tab->fileLoader, SIGNAL(chunkLoaded(QString,qint64,qint64)),
+            this, SLOT(fileLoaderChunkLoaded(QString,qint64,qint64)));
+    connect(tab->fileLoader, SIGNAL(loadFinished(QString)),
+            this, SLOT(fileLoaderFinished(QString)));
+    tab->fileLoader->start();
+}
+
+void MainWindow::showLoadProgress(QString filePath)
+{
+    if (loadProgressBar == NULL)
+    {
+        loadProgressBar = new QProgressBar();
+        loadProgressBar->setRange(0, 100);
+        loadProgressBar->setMaximumWidth(200);
+        statusBar()->addPermanentWidget(loadProgressBar);
+    }
+    loadProgressBar->setValue(currentTab()->loadProgress);
+    statusBar()->showMessage(tr("Loading %1…").arg(QFileInfo(filePath).fileName()));
+    statusBar()->show();
+}
+
+void MainWindow::hideLoadProgress()
+{
+    statusBar()->clearMessage();
+    statusBar()->hide();
+}
+
+void MainWindow::loadLargeFile(QString filePath)
+{
+    // Files this large are shown read-only, a window of lines at a time,
+    // straight from the file; all that's loaded up front is an
+    // index of where the lines start.
+    journal->stopRecording();
+    editor->clear();
+    editor->setReadOnly(true);
+    setOpenFilePath(filePath);
+    setDirty(false);
+    DocumentTab *tab = currentTab();
+    tab->loadProgress = 0;
+    showLoadProgress(filePath);
+
+    tab->largeFileIndexer = new LargeTextFileIndexThread(filePath, this);
+    connect(tab->largeFileIndexer, SIGNAL(indexProgress(qint64,qint64)),
+            this, SLOT(largeFileIndexProgress(qint64,qint64)));
+    connect(tab->largeFileIndexer, SIGNAL(indexFinished(QString)),
+            this, SLOT(largeFileIndexFinished(QString)));
+    tab->largeFileIndexer->start();
+}
+
+void MainWindow::largeFileIndexProgress(qint64 bytesIndexed, qint64 totalBytes)
+{
+    DocumentTab *tab = tabForLoader(sender());
+    if (tab == NULL)
+        return;
+    if (0 < totalBytes)
+        tab->loadProgress = (int)(bytesIndexed * 100 / totalBytes);
+    if (tab == currentTab())
+        loadProgressBar->setValue(tab->loadProgress);
+}
+
+void MainWindow::largeFileIndexFinished(QString errorString)
+{
+    DocumentTab *tab = tabForLoader(sender());
+    if (tab == NULL)
+        return;
+    if (tab != currentTab())
+    {
+        tab->loadFinishPending = true;
+        tab->loadFinishErrorString = errorString;
+        return;
+    }
+    finishLargeFileIndexing(errorString);
+}
+
+void MainWindow::finishLargeFileIndexing(QString errorString)
+{
+    DocumentTab *tab = currentTab();
+    QString filePath = tab->largeFileIndexer->filePath();
+    QSharedPointer<LargeTextFile> file = tab->largeFileIndexer->file();
+    QByteArray contentHash = tab->largeFileIndexer->contentHash();
+    tab->largeFileIndexer->deleteLater();
+    tab->largeFileIndexer = NULL;
+    tab->loadFinishPending = false;
+    hideLoadProgress();
+
+    if (!errorString.isNull())
+    {
+        editor->setReadOnly(false);
+        setOpenFilePath(QString());
+        setDirty(false);
+        journal->startRecording(QString());
+        QMessageBox::warning(this, tr("Cannot Open File"),
+                             tr("Cannot open: %1 (reason: %2)")
+                             .arg(filePath)
+                             .arg(errorString));
+        return;
+    }
+
+    tab->largeFile = file;
+    editor->setLargeFile(file);
+    didOpenFile(filePath, contentHash);
+    // The document is only ever a read-only part of the file, so there
+    // is nothing to journal:
+    journal->stopRecording();
     loadAndSetCurrentFileViewPositions();
 }
 
+void MainWindow::largeFileReadFailed(QString errorString)
+{
+    if (!editor->isInLargeFileMode() || openFilePath.isNull())
+        return;
+    // Typically a log that got truncated or rotated; its index no longer
+    // describes it, so it's indexed anew:
+    QString filePath = openFilePath;
+    Logger::warning(QString("Reopening large file %1 (reason: %2)")
+                    .arg(filePath).arg(errorString));
+    cancelBackgroundFileLoading();
+    openFile(filePath);
+}
+
+void MainWindow::editorReadOnlyChanged(bool readOnly)
+{
+    // A document that is still loading (or the window of a large file)
+    // must only change through the loader: e.g. each loaded chunk marks
+    // the document as unmodified, so edits would go unnoticed.
+    foreach (QAction *action, formattingMenu->actions())
+        action->setEnabled(!readOnly);
+}
+
+void MainWindow::cancelBackgroundFileLoading()
+{
+    DocumentTab *tab = currentTab();
+    bool wasLoadingFile = (tab->fileLoader != NULL);
+    bool wasIndexingLargeFile = (tab->largeFileIndexer != NULL);
+    tab->cancelLoading();
+
+    // Whatever is loaded next replaces a large file that is being shown:
+    if (wasIndexingLargeFile)
+    {
+        editor->setReadOnly(false);
+        hideLoadProgress();
+    }
+    if (editor->isInLargeFileMode())
+    {
+        tab->largeFile.clear();
+        editor->setLargeFile(QSharedPointer<LargeTextFile>());
+        // An empty document must not get saved over the file:
+        setOpenFilePath(QString());
+        setDirty(false);
+    }
+
+    if (!wasLoadingFile)
+        return;
+
+    editor->setReadOnly(false);
+    editor->document()->setUndoRedoEnabled(true);
+    highlighter->setSuspended(false);
+    hideLoadProgress();
+}
+
+void MainWindow::fileLoaderChunkLoaded(QString text, qint64 bytesRead, qint64 totalBytes)
+{
+    DocumentTab *tab = tabForLoader(sender());
+    if (tab == NULL)
+        return; // from a canceled load
+
+    // (The tab may be in the background by now)
+    QTextCursor cursor(tab->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(text);
+    // A partially loaded document must never look like user changes
+    // (and e.g. get saved on quit):
+    tab->document()->setModified(false);
+    tab->invalidateMemoryUsage();
+
+    if (0 < totalBytes)
+        tab->loadProgress = (int)(bytesRead * 100 / totalBytes);
+    if (tab == currentTab())
+        loadProgressBar->setValue(tab->loadProgress);
+    tab->fileLoader->chunkConsumed();
+}
+
+void MainWindow::fileLoaderFinished(QString errorString)
+{
+    DocumentTab *tab = tabForLoader(sender());
+    if (tab == NULL)
+        return;
+    if (tab != currentTab())
+    {
+        tab->loadFinishPending = true;
+        tab->loadFinishErrorString = errorString;
+        return;
+    }
+    finishFileLoading(errorString);
+}
+
+void MainWindow::finishFileLoading(QString errorString)
+{
+    DocumentTab *tab = currentTab();
+    QString filePath = tab->fileLoader->filePath();
+    QByteArray contentHash = tab->fileLoader->contentHash();
+    if (errorString.isNull() && tab->fileLoader->decodingFailed())
+        Logger::warning("File is not valid UTF-8 (invalid sequences replaced): " + filePath);
+    tab->fileLoader->deleteLater();
+    tab->fileLoader = NULL;
+    tab->loadFinishPending = false;
+
+    editor->setReadOnly(false);
+    editor->document()->setUndoRedoEnabled(true);
+    hideLoadProgress();
+
+    if (!errorString.isNull())
+    {
+        editor->clear();
+        highlighter->setSuspended(false);
+        setOpenFilePath(QString());
+        setDirty(false);
+        journal->startRecording(QString());
+        QMessageBox::warning(this, tr("Cannot Open File"),
+                             tr("Cannot open: %1 (reason: %2)")
+                             .arg(filePath)
+                             .arg(errorString));
+        return;
+    }
+
+    highlighter->setSuspended(false);
+    didOpenFile(filePath, contentHash);
+    loadAndSetCurrentFileViewPositions();
+
+    if (tab->pendingSelectionPosition != -1)
+        selectTextRange(tab->pendingSelectionPosition, tab->pendingSelectionLength);
+    tab->pendingSelectionPosition = -1;
+}
+
 void MainWindow::saveFile(QString targetPath)
 {
     bool savingNewFile = (targetPath.isNull());
@@ -306,24 +846,88 @@ void MainWindow::saveFile(QString targetPath)
     if (saveFilePath.isEmpty()) // canceled?
         return;
 
-    QFile file(saveFilePath);
-    if (!file.open(QFile::WriteOnly | QFile::Text))
+    if (currentTab()->isLoading())
+    {
+        QMessageBox::information(this, tr("Cannot Save File"),
+                                 tr("The file is still being loaded. Please "
+                                    "wait until loading has finished."));
+        return;
+    }
+    if (editor->isInLargeFileMode())
+    {
+        QMessageBox::information(this, tr("Cannot Save File"),
+                                 tr("Files this large are opened read-only, "
+                                    "and only a part of the file is loaded "
+                                    "at a time."));
+        return;
+    }
+
+    // Writes to disk must happen in the order they were requested:
+    waitForBackgroundSaving();
+
+    // The document is snapshotted here and encoded + written on a
+    // background thread, so editing can continue in the meantime:
+    fileSaver = new FileSaverThread(saveFilePath, editor->toPlainText(),
+                                    documentChangeCount, this);
+    fileSaverSavingNewFile = savingNewFile;
+    connect(fileSaver, SIGNAL(saveFinished(QString)),
+            this, SLOT(fileSaverFinished(QString)));
+    fileSaver->start();
+}
+
+void MainWindow::fileSaverFinished(QString errorString)
+{
+    Q_UNUSED(errorString);
+    // Ignore saves we have already finished by waiting for them
+    if (fileSaver == NULL || sender() != fileSaver)
+        return;
+    fileSaver->wait();
+    didFinishBackgroundSaving();
+}
+
+bool MainWindow::waitForBackgroundSaving()
+{
+    if (fileSaver == NULL)
+        return true;
+    fileSaver->wait();
+    return didFinishBackgroundSaving();
+}
+
+bool MainWindow::didFinishBackgroundSaving()
+{
+    FileSaverThread *saver = fileSaver;
+    fileSaver = NULL;
+    // The queued saveFinished() signal may still be on its way:
+    saver->deleteLater();
+
+    QString saveFilePath = saver->filePath();
+    if (!saver->errorString().isNull())
     {
         QMessageBox::warning(this, tr("Cannot Save File"),
                              tr("Cannot save: %1 (reason: %2)")
                              .arg(saveFilePath)
-                             .arg(file.errorString()));
-        return;
+                             .arg(saver->errorString()));
+        return false;
     }
-    QTextStream outStream(&file);
-    outStream.setEncoding(QStringConverter::Utf8);
-    outStream << editor->toPlainText();
-    file.close();
 
-    setOpenFilePath(saveFilePath);
-    setDirty(false);
+    setOpenFilePath(saveFilePath, saver->contentHash());
+    // "Save As" over a file that is open in another tab replaces that
+    // tab, unless it has unsaved changes of its own:
+    int otherIndex = backgroundTabIndexForFilePath(saveFilePath);
+    if (otherIndex != -1 && !tabs.at(otherIndex)->document()->isModified())
+        removeBackgroundTab(otherIndex);
+    // Edits made while the file was being written are still unsaved:
+    setDirty(saver->documentRevision() != documentChangeCount);
+    if (isDirty())
+    {
+        // The journal was based on what's now been overwritten:
+        journal->setBaseFilePath(saveFilePath);
+        journal->checkpoint();
+    }
+    else
+        journal->startRecording(saveFilePath, openFileKnownHash);
 
-    if (savingNewFile)
+    if (fileSaverSavingNewFile)
     {
         bool rememberLastFile = settings->value(SETTING_REMEMBER_LAST_FILE,
                                                 QVariant(DEF_REMEMBER_LAST_FILE)).toBool();
@@ -334,10 +938,13 @@ void MainWindow::saveFile(QString targetPath)
         addToRecentFiles(saveFilePath);
         updateRecentFilesMenu();
     }
+    return true;
 }
 
 void MainWindow::saveCurrentFile()
 {
+    // A pending "save as" may still change openFilePath:
+    waitForBackgroundSaving();
     saveFile(openFilePath);
 }
 
@@ -351,11 +958,53 @@ void MainWindow::saveAsMenuItemHandler()
     saveFile(QString());
 }
 
+// Beyond this many changed lines, reloading replaces the whole differing
+// region in one go instead of searching for a minimal diff:
+#define kMaxReloadEditDistance 2000
+
 void MainWindow::revertToSaved()
 {
-    if (openFilePath.isNull())
+    if (openFilePath.isNull() || compiling)
+        return;
+
+    // Large files are reloaded in the background like when opening them
+    if (currentTab()->fileLoader != NULL
+        || kBackgroundLoadThresholdBytes <= QFileInfo(openFilePath).size())
+    {
+        openFile(openFilePath);
+        return;
+    }
+
+    QMessageBox::ButtonRole selectedButtonRole = offerToSaveChangesIfNecessary();
+    if (selectedButtonRole == QMessageBox::RejectRole)
+        return;
+
+    DecodedTextFile openedFile;
+    if (!openedFile.open(openFilePath))
+    {
+        QMessageBox::warning(this, tr("Cannot Open File"),
+                             tr("Cannot open: %1 (reason: %2)")
+                             .arg(openFilePath)
+                             .arg(openedFile.errorString()));
         return;
-    openFile(openFilePath);
+    }
+
+    // Only the lines that differ from the file are replaced, as a single
+    // undoable edit, so the undo history, cursor and scroll position are
+    // kept and layout only has to redo the changed blocks:
+    QStringList newLines = openedFile.text().split('\n');
+    QList<LineDiffHunk> hunks = LineDiff::diff(editor->toPlainText().split('\n'),
+                                               newLines, kMaxReloadEditDistance);
+    if (!hunks.isEmpty())
+    {
+        LineDiff::applyToDocument(hunks, newLines, editor->document());
+        if (openedFile.utf8MatchesText())
+            highlighter->parseUtf8(openedFile.utf8());
+    }
+
+    setOpenFilePath(openFilePath, openedFile.contentHash());
+    setDirty(false);
+    journal->startRecording(openFilePath, openFileKnownHash);
 }
 
 void MainWindow::switchToPreviousFile()
@@ -406,49 +1055,52 @@ void MainWindow::addToRecentFiles(QString filePath)
     this->trimRecentFilesList(); // calls sync() on the settings
 }
 
-void MainWindow::saveViewPositions(QString filePath, int scrollPosition, int cursorPosition)
+void MainWindow::saveViewPositions(QString filePath, int firstVisibleLine,
+                                   int cursorLine, int cursorColumn)
 {
     QString stdFilePath = standardizeFilePath(filePath);
     QMap<QString, QVariant> positionsByFile = settings->value(SETTING_RECENT_FILE_VIEW_POSITIONS).toMap();
     QList<QVariant> thisPositions;
-    thisPositions << scrollPosition << cursorPosition;
+    thisPositions << firstVisibleLine << cursorLine << cursorColumn;
     positionsByFile.insert(stdFilePath, QVariant(thisPositions));
     settings->setValue(SETTING_RECENT_FILE_VIEW_POSITIONS, positionsByFile);
     settings->sync();
     qDebug() << "Saving position" << thisPositions;
 }
-QPair<int,int> MainWindow::getViewPositions(QString filePath)
+QList<int> MainWindow::getViewPositions(QString filePath)
 {
     QMap<QString, QVariant> positionsByFile = settings->value(SETTING_RECENT_FILE_VIEW_POSITIONS).toMap();
-    QList<QVariant> thisPositions = positionsByFile.value(standardizeFilePath(filePath)).toList();
-    if (thisPositions.size() < 2)
-        return QPair<int,int>(0,0);
-    return QPair<int,int>(thisPositions.at(0).toInt(), thisPositions.at(1).toInt());
+    QList<int> positions;
+    foreach (QVariant position, positionsByFile.value(standardizeFilePath(filePath)).toList())
+        positions << position.toInt();
+    return positions;
 }
 void MainWindow::saveCurrentFileViewPositions()
 {
-    if (openFilePath.isNull())
+    if (openFilePath.isNull() || currentTab()->isLoading())
         return;
-    saveViewPositions(openFilePath,
-                      editor->verticalScrollBar()->value(),
-                      editor->textCursor().position());
+    saveViewPositions(openFilePath, editor->firstVisibleLine(),
+                      editor->cursorLine(), editor->cursorColumn());
 }
 void MainWindow::loadAndSetCurrentFileViewPositions()
 {
     if (openFilePath.isNull())
         return;
-    QPair<int,int> scrollAndCursorPositions = getViewPositions(openFilePath);
-    qDebug() << "Loaded position" << scrollAndCursorPositions;
-
-    QTextCursor cursor = editor->textCursor();
-    int savedCursorPos = scrollAndCursorPositions.second;
-    int maxCursorPos = editor->document()->characterCount() - 1;
-    cursor.setPosition(std::max(0, std::min(savedCursorPos, maxCursorPos)));
-    editor->setTextCursor(cursor);
-
-    // Setting the text cursor might also affect the scroll position, so let's
-    // set the scroll position explicitly only after we've set the text cursor:
-    editor->verticalScrollBar()->setValue(scrollAndCursorPositions.first);
+    QList<int> positions = getViewPositions(openFilePath);
+    qDebug() << "Loaded position" << positions;
+
+    // Positions are saved in lines, so restoring one only involves the
+    // blocks around it (not everything before a character position):
+    if (positions.size() == 3)
+        editor->setViewPosition(positions.at(0), positions.at(1), positions.at(2));
+    else if (positions.size() == 2 && !editor->isInLargeFileMode())
+    {
+        // Saved by an older version: scroll bar value and cursor position
+        int maxCursorPos = editor->document()->characterCount() - 1;
+        QTextBlock block = editor->document()->findBlock(qBound(0, positions.at(1), maxCursorPos));
+        editor->setViewPosition(positions.at(0), block.blockNumber(),
+                                positions.at(1) - block.position());
+    }
 }
 
 
@@ -479,30 +1131,39 @@ void MainWindow::applyPersistedFontInfo()
 
 void MainWindow::selectTextToSearchFor()
 {
-    bool ok;
-    QString str = QInputDialog::getText(this, tr("Find Text"),
-                                        tr("Enter text to find:"),
-                                        QLineEdit::Normal, searchString, &ok);
-    if (!ok || str.isEmpty())
-        return;
-    searchString = str;
-    findNextMenuAction->setEnabled(true);
-    findPreviousMenuAction->setEnabled(true);
-    findNextSearchMatch();
+    searchBar->activate();
+}
+
+void MainWindow::showReplaceBar()
+{
+    searchBar->activateReplace();
+}
+
+void MainWindow::goToLine()
+{
+    bool ok = false;
+    int lineCount = editor->lineCount();
+    int line = QInputDialog::getInt(this, tr("Go to Line"),
+                                    tr("Line number (1 - %1):").arg(lineCount),
+                                    editor->cursorLine() + 1, 1, lineCount, 1, &ok);
+    if (ok)
+        editor->goToLine(line - 1);
 }
 
 void MainWindow::findNextSearchMatch()
 {
-    if (searchString.isEmpty())
-        return;
-    editor->find(searchString);
+    searchBar->findNext();
 }
 
 void MainWindow::findPreviousSearchMatch()
 {
-    if (searchString.isEmpty())
-        return;
-    editor->find(searchString, QTextDocument::FindBackward);
+    searchBar->findPrevious();
+}
+
+void MainWindow::searchStringChanged(QString searchString)
+{
+    findNextMenuAction->setEnabled(!searchString.isEmpty());
+    findPreviousMenuAction->setEnabled(!searchString.isEmpty());
 }
 
 void MainWindow::increaseFontSize()
@@ -513,6 +1174,7 @@ void MainWindow::increaseFontSize()
     persistFontInfo();
 
     // need to update relative font sizes:
+    styleGeneration++;
     applyStyleWithoutErrorReporting();
     highlighter->parseAndHighlightNow();
 }
@@ -525,10 +1187,24 @@ void MainWindow::decreaseFontSize()
     persistFontInfo();
 
     // need to update relative font sizes:
+    styleGeneration++;
     applyStyleWithoutErrorReporting();
     highlighter->parseAndHighlightNow();
 }
 
+void MainWindow::benchmarkScrolling()
+{
+    ScrollingBenchmarkResult result = editor->benchmarkScrolling();
+    QMessageBox::information(this, tr("Scrolling Benchmark"),
+                             tr("%1 frames\n%2 ms per frame on average\n%3 ms at most\n\n"
+                                "Painting per frame: editor %4 ms, line numbers %5 ms")
+                             .arg(result.frameCount)
+                             .arg(result.averageMilliseconds, 0, 'f', 2)
+                             .arg(result.maxMilliseconds, 0, 'f', 2)
+                             .arg(result.editorPaintMilliseconds, 0, 'f', 2)
+                             .arg(result.gutterPaintMilliseconds, 0, 'f', 2));
+}
+
 void MainWindow::about()
 {
     QString title = tr("About %1").arg(QCoreApplication::applicationName());
@@ -580,9 +1256,20 @@ void MainWindow::applyStyle(bool reportParsingErrorsToUser)
     highlighter->getStylesFromStylesheet(styleFilePath, editor);
     editor->setCurrentLineHighlightColor(highlighter->currentLineHighlightColor);
     editor->setLineNumberAreaColor(editor->palette().base().color().darker(140));
+
+    QColor textColor = editor->palette().text().color();
+    overviewMap->setBackgroundColor(editor->palette().base().color());
+    overviewMap->setKindColor(OverviewMap::PlainLine, textColor);
+    overviewMap->setKindColor(OverviewMap::HeadingLine, highlighter->styleColor(pmh_H1, textColor));
+    overviewMap->setKindColor(OverviewMap::CodeLine, highlighter->styleColor(pmh_VERBATIM, textColor));
+    overviewMap->setKindColor(OverviewMap::ListLine, highlighter->styleColor(pmh_LIST_BULLET, textColor));
+    overviewMap->setKindColor(OverviewMap::LinkLine, highlighter->styleColor(pmh_LINK, textColor));
+
+    if (0 <= currentTabIndex)
+        tabs.at(currentTabIndex)->styleGeneration = styleGeneration;
 }
 
-void MainWindow::applyHighlighterPreferences()
+void MainWindow::applyHighlighterPreferences(bool reportStyleParsingErrorsToUser)
 {
     double highlightInterval = settings->value(SETTING_HIGHLIGHT_INTERVAL,
                                                QVariant(DEF_HIGHLIGHT_INTERVAL)).toDouble();
@@ -592,7 +1279,7 @@ void MainWindow::applyHighlighterPreferences()
                                           QVariant(DEF_CLICKABLE_LINKS)).toBool();
     highlighter->setMakeLinksClickable(clickableLinks);
 
-    applyStyle();
+    applyStyle(reportStyleParsingErrorsToUser);
 }
 
 void MainWindow::applyEditorPreferences()
@@ -643,11 +1330,23 @@ void MainWindow::showPreferences()
     preferencesDialog->show();
 }
 
+void MainWindow::prepareCompiler()
+{
+    // Extract the built-in compiler now so that the first compile
+    // doesn't have to wait for it:
+    QString compilerPath = settings->value(SETTING_COMPILER,
+                                           QVariant(DEF_COMPILER)).toString();
+    compiler->prepareCompilerInBackground(compilerPath);
+}
+
 void MainWindow::preferencesUpdated()
 {
+    styleGeneration++;
     applyPersistedFontInfo();
     applyHighlighterPreferences();
     applyEditorPreferences();
+    applyNotesFolderPreferences();
+    prepareCompiler();
     highlighter->highlightNow();
 }
 
@@ -661,6 +1360,8 @@ void MainWindow::setDirty(bool value)
     editor->document()->setModified(value);
     setWindowFilePath(openFilePath);
     setWindowModified(value);
+    if (0 <= currentTabIndex)
+        updateTabTitle(currentTabIndex);
 }
 
 
@@ -668,7 +1369,13 @@ void MainWindow::setupEditor()
 {
     editor = new QarkdownTextEdit;
     editor->setAnchorClickKeyboardModifiers(Qt::ControlModifier);
-    highlighter = new HGMarkdownHighlighter(editor->document());
+    DocumentTab *tab = createTab();
+    editor->switchDocument(tab->document());
+    currentTabIndex = 0;
+    highlighter = tab->highlighter();
+    journal = tab->journal();
+    parseScheduler->setActiveHighlighter(highlighter);
+    overviewMap = new OverviewMap(editor);
 
     applyPersistedFontInfo();
     applyHighlighterPreferences();
@@ -696,7 +1403,15 @@ void MainWindow::showRecentFileSearchDialog()
     fileSearchDialog->show();
 }
 
-void MainWindow::showNotesFolderFileSearchDialog()
+void MainWindow::applyNotesFolderPreferences()
+{
+    QString notesFolderPath = settings->value(SETTING_NOTES_FOLDER).toString();
+    if (!notesFolderPath.isEmpty() && !QFile(notesFolderPath).exists())
+        notesFolderPath = QString();
+    notesIndexer->setNotesFolder(notesFolderPath, getMarkdownFilesFilterList());
+}
+
+QString MainWindow::checkedNotesFolderPath()
 {
     QVariant notesFolderSetting = settings->value(SETTING_NOTES_FOLDER);
     if (notesFolderSetting.isNull() || notesFolderSetting.toString().isEmpty())
@@ -706,7 +1421,7 @@ void MainWindow::showNotesFolderFileSearchDialog()
                                     "folder, you first need to set the path "
                                     "to your notes folder in the application "
                                     "preferences."));
-        return;
+        return QString();
     }
 
     QString notesFolderPath = notesFolderSetting.toString();
@@ -716,15 +1431,36 @@ void MainWindow::showNotesFolderFileSearchDialog()
                              tr("The notes folder cannot be found at the "
                                 "path %1. Please set the correct path in "
                                 "the application preferences.").arg(notesFolderPath));
-        return;
+        return QString();
     }
 
-    QStringList fileNames = QDir(notesFolderPath).entryList(getMarkdownFilesFilterList());
+    // The folder may have appeared after the preferences were applied:
+    applyNotesFolderPreferences();
+    return notesFolderPath;
+}
+
+void MainWindow::showNotesFolderFileSearchDialog()
+{
+    QString notesFolderPath = checkedNotesFolderPath();
+    if (notesFolderPath.isNull())
+        return;
 
     QStringList filePaths;
-    foreach (QString fileName, fileNames)
+    if (notesIndexer->isReady())
     {
-        filePaths.append(notesFolderPath + QDir::separator() + fileName);
+        filePaths = notesIndexer->filePaths();
+        // Keep the index fresh for the next time:
+        notesIndexer->rescanIfStale();
+    }
+    else
+    {
+        // The very first recursive scan is still in progress; make do
+        // with the top level for now:
+        QStringList fileNames = QDir(notesFolderPath).entryList(getMarkdownFilesFilterList());
+        foreach (QString fileName, fileNames)
+        {
+            filePaths.append(notesFolderPath + QDir::separator() + fileName);
+        }
     }
 
     fileSearchDialog->setWindowTitle(tr("Select File to Open in Notes Folder"));
@@ -737,6 +1473,52 @@ void MainWindow::fileSearchDialogSelectedFilePath(QString path)
     openFile(path);
 }
 
+void MainWindow::showNotesSearchDialog()
+{
+    if (checkedNotesFolderPath().isNull())
+        return;
+    notesIndexer->rescanIfStale();
+    notesSearchDialog->reset();
+    notesSearchDialog->show();
+}
+
+void MainWindow::notesSearchDialogSelectedHit(QString filePath, int position, int length)
+{
+    if (standardizeFilePath(filePath) != openFilePath)
+    {
+        openFile(filePath);
+        if (openFilePath != standardizeFilePath(filePath))
+            return; // canceled or failed
+    }
+    // (Positions in a large file don't map to the part of it on display)
+    DocumentTab *tab = currentTab();
+    if (tab->largeFileIndexer != NULL || editor->isInLargeFileMode())
+        return;
+    if (tab->fileLoader != NULL)
+    {
+        tab->pendingSelectionPosition = position;
+        tab->pendingSelectionLength = length;
+        return;
+    }
+    selectTextRange(position, length);
+}
+
+void MainWindow::notesIndexerUpdated()
+{
+    // The full-text index follows the list of files in the notes folder:
+    notesTextIndex->setFilePaths(notesIndexer->filePaths());
+}
+
+void MainWindow::selectTextRange(int position, int length)
+{
+    int maxPosition = editor->document()->characterCount() - 1;
+    QTextCursor cursor = editor->textCursor();
+    cursor.setPosition(qBound(0, position, maxPosition));
+    cursor.setPosition(qBound(0, position + length, maxPosition), QTextCursor::KeepAnchor);
+    editor->setTextCursor(cursor);
+    editor->centerCursor();
+}
+
 QString getTempHTMLFilePathForMarkdownFilePath(QString markdownFilePath)
 {
     QString tempDirPath = QDir::tempPath();
@@ -783,20 +1565,27 @@ bool MainWindow::compileToHTMLFile(QString targetPath)
 {
     QString compilerPath = settings->value(SETTING_COMPILER,
                                            QVariant(DEF_COMPILER)).toString();
+    if (compiling)
+        return false;
     if (!QFile::exists(compilerPath)) {
         QMessageBox::warning(this, tr("Cannot compile"),
                              tr("The Markdown to HTML compiler cannot "
                                 "be found at:\n'%1'").arg(compilerPath));
         return false;
     }
+    compiling = true;
     bool success = compiler->compileToHTMLFile(compilerPath, editor->toPlainText(),
                                                targetPath);
+    compiling = false;
     recompileAction->setEnabled(true);
+    CompilationStats stats = compiler->lastCompilationStats();
+    Logger::debug(QString("Compiled in %1 ms, peak memory %2 kB")
+                  .arg(stats.elapsedMilliseconds).arg(stats.peakMemoryKilobytes));
     if (success)
     {
         lastCompileTargetPath = targetPath;
     }
-    else
+    else if (!stats.canceled)
     {
         QString cleanCompilerPath = compiler->getUserReadableCompilerName(compilerPath);
         QString message = tr("Compiling failed with compiler:\n%1").arg(cleanCompilerPath);
@@ -807,6 +1596,43 @@ bool MainWindow::compileToHTMLFile(QString targetPath)
     return success;
 }
 
+#define kCompileProgressDelayMilliseconds 500
+
+void MainWindow::compilerStillRunning(qint64 elapsedMilliseconds)
+{
+    // Only bother the user with a progress dialog if the compiler is slow
+    if (compileProgressDialog == NULL)
+    {
+        if (elapsedMilliseconds < kCompileProgressDelayMilliseconds)
+            return;
+        compileProgressDialog = new QProgressDialog(this);
+        compileProgressDialog->setWindowModality(Qt::WindowModal);
+        compileProgressDialog->setRange(0, 0);
+        compileProgressDialog->setCancelButtonText(tr("Cancel"));
+        connect(compileProgressDialog, SIGNAL(canceled()), compiler, SLOT(cancel()));
+        compileProgressDialog->show();
+    }
+    compileProgressDialog->setLabelText(tr("Compiling… (%1 s)").arg(elapsedMilliseconds / 1000));
+
+    // We're inside the compiler's wait loop on the GUI thread; keep the
+    // UI responsive. Until the (window modal) progress dialog is up, user
+    // input would reach the main window, so it waits; once it is, input
+    // only reaches the dialog's cancel button. Anything else that would
+    // swap the document (e.g. the reload prompt) checks `compiling`.
+    QCoreApplication::processEvents(compileProgressDialog->isVisible()
+                                    ? QEventLoop::AllEvents
+                                    : QEventLoop::ExcludeUserInputEvents);
+}
+
+void MainWindow::compilationFinished()
+{
+    if (compileProgressDialog == NULL)
+        return;
+    compileProgressDialog->hide();
+    compileProgressDialog->deleteLater();
+    compileProgressDialog = NULL;
+}
+
 
 void MainWindow::formatSelectionEmphasized()
 {
@@ -821,8 +1647,357 @@ void MainWindow::formatSelectionCode()
     editor->toggleFormattingForCurrentSelection(QarkdownTextEdit::Code);
 }
 
+void MainWindow::toggleFold()
+{
+    editor->toggleFoldAtCursor();
+}
+void MainWindow::foldAll()
+{
+    editor->foldAll();
+}
+void MainWindow::unfoldAll()
+{
+    editor->unfoldAll();
+}
+
+void MainWindow::highlighterStructureUpdated()
+{
+    if (sender() != highlighter)
+    {
+        // A background tab's parse finished:
+        for (int i = 0; i < tabs.count(); i++)
+        {
+            if (tabs.at(i)->highlighter() == sender())
+                tabs.at(i)->invalidateMemoryUsage();
+        }
+        return;
+    }
+    editor->setFoldableStructure(highlighter->structure());
+    overviewMap->setStructure(highlighter->structure());
+    updateOutline();
+}
+
+void MainWindow::toggleOutlinePanel()
+{
+    outlinePanel->setVisible(!outlinePanel->isVisible());
+}
+
+void MainWindow::toggleOverviewMap()
+{
+    overviewMap->setVisible(!overviewMap->isVisible());
+}
+
+void MainWindow::updateOutline()
+{
+    // A hidden outline is brought up to date when it is shown:
+    if (!outlinePanel->isVisible())
+        return;
+    outlinePanel->model()->update(editor->document(), highlighter->structure());
+    selectCurrentOutlineHeading();
+}
+
+void MainWindow::selectCurrentOutlineHeading()
+{
+    if (outlinePanel->isVisible())
+        outlinePanel->selectHeadingAt(editor->textCursor().position());
+}
+
+void MainWindow::outlineHeadingActivated(int position)
+{
+    QTextBlock block = editor->document()->findBlock(position);
+    if (!block.isValid())
+        return;
+    editor->goToLine(editor->largeFileWindowStart() + block.blockNumber());
+    editor->setFocus();
+}
 
 
+DocumentTab *MainWindow::createTab()
+{
+    // Each tab journals into a numbered directory of its own (the lowest
+    // number that no other tab has):
+    QStringList journalDirNames;
+    foreach (DocumentTab *otherTab, tabs)
+        journalDirNames.append(QFileInfo(otherTab->journalDirPath()).fileName());
+    int journalNumber = 0;
+    while (journalDirNames.contains(QString::number(journalNumber)))
+        journalNumber++;
+
+    DocumentTab *tab = new DocumentTab(parseScheduler, editJournalsDirPath()
+                                       + "/" + QString::number(journalNumber));
+    connect(tab->highlighter(), SIGNAL(structureUpdated()),
+            this, SLOT(highlighterStructureUpdated()));
+    tabs.append(tab);
+    switchingTabs = true;
+    tabBar->addTab(kUntitledFileUIName);
+    switchingTabs = false;
+    return tab;
+}
+
+DocumentTab *MainWindow::currentTab()
+{
+    return tabs.at(currentTabIndex);
+}
+
+DocumentTab *MainWindow::tabForLoader(QObject *loader)
+{
+    if (loader == NULL)
+        return NULL;
+    foreach (DocumentTab *tab, tabs)
+    {
+        if (tab->fileLoader == loader || tab->largeFileIndexer == loader)
+            return tab;
+    }
+    return NULL; // canceled
+}
+
+bool MainWindow::isCurrentTabUnused()
+{
+    // A new, empty document, which a file can be opened in instead of in
+    // a tab of its own:
+    return openFilePath.isNull() && !isDirty() && !currentTab()->isLoading();
+}
+
+void MainWindow::activateTab(int index)
+{
+    if (index == currentTabIndex || index < 0 || tabs.count() <= index)
+        return;
+    // A save in progress belongs to the document being left:
+    waitForBackgroundSaving();
+
+    if (0 <= currentTabIndex && currentTabIndex < tabs.count())
+    {
+        DocumentTab *previousTab = tabs.at(currentTabIndex);
+        saveCurrentFileViewPositions();
+        previousTab->filePath = openFilePath;
+        previousTab->knownLastModified = openFileKnownLastModified;
+        previousTab->knownSize = openFileKnownSize;
+        previousTab->knownHash = openFileKnownHash;
+        previousTab->lastCompileTargetPath = lastCompileTargetPath;
+        previousTab->lastShown = ++tabShowCounter;
+        previousTab->invalidateMemoryUsage();
+        disconnect(previousTab->document(), SIGNAL(contentsChange(int,int,int)),
+                   this, SLOT(handleContentsChange(int,int,int)));
+        // Only the lines on display of a large file are in the document;
+        // they are read again when the tab is shown:
+        if (editor->isInLargeFileMode())
+        {
+            editor->setLargeFile(QSharedPointer<LargeTextFile>());
+            previousTab->document()->setModified(false);
+        }
+    }
+
+    DocumentTab *tab = tabs.at(index);
+    currentTabIndex = index;
+    editor->switchDocument(tab->document());
+    highlighter = tab->highlighter();
+    // (The tab's journal carries on from where it was left)
+    journal = tab->journal();
+    parseScheduler->setActiveHighlighter(highlighter);
+    connect(editor->document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(handleContentsChange(int,int,int)), Qt::UniqueConnection);
+    switchingTabs = true;
+    tabBar->setCurrentIndex(index);
+    switchingTabs = false;
+
+    bool restyled = (tab->styleGeneration != styleGeneration);
+    if (restyled)
+        applyHighlighterPreferences(false);
+    tab->prepareForShowing(restyled);
+
+    setOpenFilePath(tab->filePath, tab->knownHash);
+    if (!tab->filePath.isNull())
+    {
+        openFileKnownLastModified = tab->knownLastModified;
+        openFileKnownSize = tab->knownSize;
+    }
+    lastCompileTargetPath = tab->lastCompileTargetPath;
+    recompileAction->setEnabled(!lastCompileTargetPath.isNull());
+    setDirty(editor->document()->isModified());
+
+    editor->setReadOnly(tab->isLoading());
+    if (!tab->largeFile.isNull())
+        editor->setLargeFile(tab->largeFile);
+    if (tab->isLoading())
+        showLoadProgress(tab->filePath);
+    else
+        hideLoadProgress();
+
+    editor->setFoldableStructure(highlighter->structure());
+    overviewMap->setStructure(highlighter->structure());
+    updateOutline();
+    if (tab->loadFinishPending)
+    {
+        // (Also restores the view positions)
+        if (tab->fileLoader != NULL)
+            finishFileLoading(tab->loadFinishErrorString);
+        else
+            finishLargeFileIndexing(tab->loadFinishErrorString);
+    }
+    else if (!tab->isLoading())
+        loadAndSetCurrentFileViewPositions();
+    updateRecentFilesMenu();
+    // (The file may have changed while the tab was in the background)
+    checkIfFileModifiedByThirdParty();
+    enforceTabMemoryBudget();
+}
+
+void MainWindow::removeBackgroundTab(int index)
+{
+    if (index == currentTabIndex || index < 0 || tabs.count() <= index)
+        return;
+    DocumentTab *tab = tabs.takeAt(index);
+    // Closed for good, so there is nothing to recover:
+    tab->journal()->discard();
+    delete tab;
+    if (index < currentTabIndex)
+        currentTabIndex--;
+    switchingTabs = true;
+    tabBar->removeTab(index);
+    switchingTabs = false;
+}
+
+int MainWindow::backgroundTabIndexForFilePath(QString filePath)
+{
+    for (int i = 0; i < tabs.count(); i++)
+    {
+        if (i != currentTabIndex && tabs.at(i)->filePath == filePath)
+            return i;
+    }
+    return -1;
+}
+
+void MainWindow::updateTabTitle(int index)
+{
+    QString filePath = (index == currentTabIndex) ? openFilePath : tabs.at(index)->filePath;
+    QString title = filePath.isNull()
+                    ? QString(kUntitledFileUIName)
+                    : QFileInfo(filePath).fileName();
+    // Background tabs may have unsaved changes, too:
+    if (tabs.at(index)->document()->isModified())
+        title += "*";
+    // (Called for every edit; setting the text relayouts the tab bar)
+    if (tabBar->tabText(index) != title)
+        tabBar->setTabText(index, title);
+    tabBar->setTabToolTip(index, filePath);
+}
+
+static bool tabShownMoreRecently(DocumentTab *a, DocumentTab *b)
+{
+    return b->lastShown < a->lastShown;
+}
+
+void MainWindow::enforceTabMemoryBudget()
+{
+    // (Tabs that are still loading have nothing to give up yet)
+    QList<DocumentTab *> backgroundTabs;
+    for (int i = 0; i < tabs.count(); i++)
+    {
+        if (i != currentTabIndex && !tabs.at(i)->isLoading())
+            backgroundTabs.append(tabs.at(i));
+    }
+    // Most recently shown first:
+    std::sort(backgroundTabs.begin(), backgroundTabs.end(), tabShownMoreRecently);
+
+    // The most recently shown tabs keep all of their caches, up until
+    // the budget runs out; the rest give up their layouts and, if that
+    // is not enough, their parse results:
+    qint64 usedBytes = 0;
+    foreach (DocumentTab *tab, backgroundTabs)
+    {
+        DocumentTabMemoryUsage usage = tab->memoryUsage();
+        if (kBackgroundTabCachesBudgetBytes < usedBytes + usage.layoutBytes + usage.parseBytes)
+        {
+            tab->releaseLayout();
+            usage = tab->memoryUsage();
+            if (kBackgroundTabCachesBudgetBytes < usedBytes + usage.parseBytes)
+            {
+                tab->releaseParseResults();
+                usage = tab->memoryUsage();
+            }
+        }
+        usedBytes += usage.layoutBytes + usage.parseBytes;
+    }
+
+    for (int i = 0; i < tabs.count(); i++)
+    {
+        if (i == currentTabIndex)
+            continue;
+        DocumentTabMemoryUsage usage = tabs.at(i)->memoryUsage();
+        qint64 totalBytes = usage.textBytes + usage.layoutBytes + usage.parseBytes;
+        tabBar->setTabToolTip(i, tr("%1\n~%2 MB in memory")
+                                 .arg(tabs.at(i)->filePath)
+                                 .arg(qMax(totalBytes / (1024 * 1024), (qint64)1)));
+    }
+}
+
+void MainWindow::tabBarCurrentChanged(int index)
+{
+    if (switchingTabs || index == currentTabIndex)
+        return;
+    if (compiling)
+    {
+        switchingTabs = true;
+        tabBar->setCurrentIndex(currentTabIndex);
+        switchingTabs = false;
+        return;
+    }
+    // The tab being left stays open as it is, unsaved changes and all:
+    activateTab(index);
+}
+
+void MainWindow::tabBarCloseRequested(int index)
+{
+    if (compiling)
+        return;
+    if (index != currentTabIndex)
+    {
+        if (!tabs.at(index)->document()->isModified())
+        {
+            removeBackgroundTab(index);
+            return;
+        }
+        // Shown, so that the user can see what they are asked to save:
+        activateTab(index);
+    }
+    closeCurrentTab();
+}
+
+void MainWindow::closeCurrentTab()
+{
+    if (compiling)
+        return;
+    saveCurrentFileViewPositions();
+    QMessageBox::ButtonRole selectedButtonRole = offerToSaveChangesIfNecessary();
+    if (selectedButtonRole == QMessageBox::RejectRole)
+        return;
+
+    cancelBackgroundFileLoading();
+    if (tabs.count() == 1)
+    {
+        resetCurrentDocument();
+        return;
+    }
+    int closedIndex = currentTabIndex;
+    activateTab(closedIndex == tabs.count() - 1 ? closedIndex - 1 : closedIndex + 1);
+    removeBackgroundTab(closedIndex);
+}
+
+void MainWindow::removeUnusedJournalDirs()
+{
+    // What's left in the other directories was either recovered or
+    // declined at startup:
+    QStringList journalDirNames;
+    foreach (DocumentTab *tab, tabs)
+        journalDirNames.append(QFileInfo(tab->journalDirPath()).fileName());
+    QDir journalsDir(editJournalsDirPath());
+    foreach (QString dirName, journalsDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+    {
+        if (!journalDirNames.contains(dirName))
+            QDir(journalsDir.absoluteFilePath(dirName)).removeRecursively();
+    }
+}
+
 void MainWindow::updateRecentFilesMenu()
 {
     for (int i = 0; i < recentFilesMenuActions->count(); i++)
@@ -870,12 +2045,17 @@ void MainWindow::setupFileMenu()
     fileMenu->addAction(tr("Switch to File in Notes Folder"),
                         QKeySequence("Ctrl+Shift+N"),
                         this, SLOT(showNotesFolderFileSearchDialog()));
+    fileMenu->addAction(tr("Search in Notes Folder..."),
+                        QKeySequence("Ctrl+Shift+F"),
+                        this, SLOT(showNotesSearchDialog()));
     fileMenu->addSeparator();
     fileMenu->addAction(tr("&Save"), QKeySequence::Save, this, SLOT(saveMenuItemHandler()));
     fileMenu->addAction(tr("Save As..."), QKeySequence::SaveAs, this, SLOT(saveAsMenuItemHandler()));
     revertToSavedMenuAction = fileMenu->addAction(tr("&Revert to Saved"), this,
                                                   SLOT(revertToSaved()));
     revertToSavedMenuAction->setEnabled(false);
+    fileMenu->addAction(tr("&Close Tab"), QKeySequence::Close,
+                        this, SLOT(closeCurrentTab()));
     fileMenu->addSeparator();
     revealFileAction = fileMenu->addAction(
             #ifdef Q_OS_MAC
@@ -898,8 +2078,15 @@ void MainWindow::setupFileMenu()
                                                  this, SLOT(findPreviousSearchMatch()));
     findNextMenuAction->setEnabled(false);
     findPreviousMenuAction->setEnabled(false);
-
-    QMenu *formattingMenu = new QMenu(tr("F&ormatting"), this);
+    editMenu->addAction(tr("&Replace..."), QKeySequence::Replace, this, SLOT(showReplaceBar()));
+    editMenu->addSeparator();
+    editMenu->addAction(tr("&Go to Line..."), QKeySequence("Ctrl+L"), this, SLOT(goToLine()));
+    editMenu->addSeparator();
+    editMenu->addAction(tr("Fold/Unfold"), QKeySequence("Ctrl+Shift+["), this, SLOT(toggleFold()));
+    editMenu->addAction(tr("Fold All"), QKeySequence("Ctrl+Alt+["), this, SLOT(foldAll()));
+    editMenu->addAction(tr("Unfold All"), QKeySequence("Ctrl+Alt+]"), this, SLOT(unfoldAll()));
+
+    formattingMenu = new QMenu(tr("F&ormatting"), this);
     menuBar()->addMenu(formattingMenu);
     formattingMenu->addAction(tr("Emphasized"), QKeySequence("Ctrl+I"), this, SLOT(formatSelectionEmphasized()));
     formattingMenu->addAction(tr("Strong"), QKeySequence("Ctrl+B"), this, SLOT(formatSelectionStrong()));
@@ -909,7 +2096,13 @@ void MainWindow::setupFileMenu()
     menuBar()->addMenu(toolsMenu);
     toolsMenu->addAction(tr("Increase Font Size"), QKeySequence("Ctrl++"), this, SLOT(increaseFontSize()));
     toolsMenu->addAction(tr("Decrease Font Size"), QKeySequence("Ctrl+-"), this, SLOT(decreaseFontSize()));
+    toolsMenu->addAction(tr("Show/Hide &Outline"), QKeySequence("Ctrl+Alt+O"),
+                         this, SLOT(toggleOutlinePanel()));
+    toolsMenu->addAction(tr("Show/Hide Overview &Map"), this, SLOT(toggleOverviewMap()));
     toolsMenu->addAction(tr("&Preferences..."), QKeySequence::Preferences, this, SLOT(showPreferences()));
+#ifdef BUILD_DEBUG
+    toolsMenu->addAction(tr("Benchmark Scrolling"), this, SLOT(benchmarkScrolling()));
+#endif
 
     QMenu *compilingMenu = new QMenu(tr("&Compiling"), this);
     menuBar()->addMenu(compilingMenu);
@@ -936,8 +2129,12 @@ void MainWindow::performStartupTasks()
 {
     bool rememberLastFile = settings->value(SETTING_REMEMBER_LAST_FILE,
                                             QVariant(DEF_REMEMBER_LAST_FILE)).toBool();
-    if (rememberLastFile && settings->contains(SETTING_LAST_FILE) && openFilePath.isNull())
+    if (!offerToRecoverUnsavedChanges()
+        && rememberLastFile && settings->contains(SETTING_LAST_FILE) && openFilePath.isNull())
         openFile(settings->value(SETTING_LAST_FILE).toString());
+    if (!journal->isRecording())
+        journal->startRecording(openFilePath, openFileKnownHash);
+    removeUnusedJournalDirs();
 
     connect(qApp, SIGNAL(commitDataRequest(QSessionManager&)),
             this, SLOT(commitDataHandler(QSessionManager&)), Qt::DirectConnection);
@@ -945,9 +2142,12 @@ void MainWindow::performStartupTasks()
             this, SLOT(aboutToQuitHandler()), Qt::DirectConnection);
 
     connect(editor->document(), SIGNAL(contentsChange(int,int,int)),
-            this, SLOT(handleContentsChange(int,int,int)));
+            this, SLOT(handleContentsChange(int,int,int)), Qt::UniqueConnection);
     connect(editor, SIGNAL(anchorClicked(QUrl)),
             this, SLOT(anchorClicked(QUrl)));
+    // Queued, as the editor is in the middle of moving its window:
+    connect(editor, SIGNAL(largeFileReadFailed(QString)),
+            this, SLOT(largeFileReadFailed(QString)), Qt::QueuedConnection);
     editor->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(editor, SIGNAL(customContextMenuRequested(QPoint)),
             this, SLOT(handleCustomContextMenuRequest(QPoint)));
@@ -955,6 +2155,56 @@ void MainWindow::performStartupTasks()
             this, SLOT(preferencesUpdated()));
     connect(fileSearchDialog, SIGNAL(selectedFilePath(QString)),
             this, SLOT(fileSearchDialogSelectedFilePath(QString)));
+    connect(notesSearchDialog, SIGNAL(selectedHit(QString,int,int)),
+            this, SLOT(notesSearchDialogSelectedHit(QString,int,int)));
+    connect(notesIndexer, SIGNAL(indexUpdated()), this, SLOT(notesIndexerUpdated()));
+    connect(searchBar, SIGNAL(searchStringChanged(QString)),
+            this, SLOT(searchStringChanged(QString)));
+}
+
+bool MainWindow::offerToRecoverUnsavedChanges()
+{
+    bool recoveredAny = false;
+    for (int i = 0; i < recoveredTexts.count(); i++)
+    {
+        QString recoveredFilePath = recoveredFilePaths.at(i);
+        QString fileBaseName = recoveredFilePath.isNull()
+                               ? QString(kUntitledFileUIName)
+                               : QFileInfo(recoveredFilePath).fileName();
+
+        QMessageBox recoverMessageBox(this);
+        recoverMessageBox.setWindowModality(Qt::WindowModal);
+        recoverMessageBox.setIcon(QMessageBox::Warning);
+        recoverMessageBox.setText(tr("Do you want to recover the unsaved changes to the document “%1”?").arg(fileBaseName));
+        recoverMessageBox.setInformativeText(tr("QarkDown did not quit properly the last time it was used."));
+        recoverMessageBox.setDefaultButton(recoverMessageBox.addButton(tr("Recover"), QMessageBox::AcceptRole));
+        recoverMessageBox.addButton(tr("Discard Changes"), QMessageBox::DestructiveRole);
+        recoverMessageBox.exec();
+
+        QMessageBox::ButtonRole selectedButtonRole = recoverMessageBox.buttonRole(recoverMessageBox.clickedButton());
+        if (selectedButtonRole != QMessageBox::AcceptRole)
+            continue; // (the journal is removed once all have been offered)
+
+        // The recovered text becomes an unsaved version of the file, in a
+        // tab of its own; the user can still revert to what's on disk.
+        if (!isCurrentTabUnused())
+        {
+            createTab();
+            activateTab(tabs.count() - 1);
+        }
+        journal->stopRecording();
+        editor->setPlainText(recoveredTexts.at(i));
+        setOpenFilePath(recoveredFilePath);
+        lastCompileTargetPath = QString();
+        recompileAction->setEnabled(false);
+        journal->startRecording(recoveredFilePath);
+        journal->checkpoint();
+        setDirty(true);
+        recoveredAny = true;
+    }
+    recoveredFilePaths.clear();
+    recoveredTexts.clear();
+    return recoveredAny;
 }
 
 void MainWindow::reportStyleParsingErrors(QList<QPair<int, QString> > *list)
@@ -1022,6 +2272,10 @@ void MainWindow::lookupInDictionary()
 
 QMessageBox::ButtonRole MainWindow::offerToSaveChangesIfNecessary()
 {
+    // A save in progress decides whether there are unsaved changes:
+    if (!waitForBackgroundSaving())
+        return QMessageBox::RejectRole;
+
     if (!isDirty())
         return QMessageBox::InvalidRole;
 
@@ -1045,32 +2299,49 @@ QMessageBox::ButtonRole MainWindow::offerToSaveChangesIfNecessary()
 
     QMessageBox::ButtonRole selectedButtonRole = saveConfirmMessageBox.buttonRole(saveConfirmMessageBox.clickedButton());
     if (selectedButtonRole == QMessageBox::AcceptRole)
+    {
+        // The caller is about to discard the document, so the save must
+        // have made it to disk first:
         saveCurrentFile();
+        if (!waitForBackgroundSaving() || isDirty())
+            return QMessageBox::RejectRole;
+    }
 
     return selectedButtonRole;
 }
 
 bool MainWindow::confirmQuit(bool interactionAllowed)
 {
-    if (!isDirty())
-        return true;
+    waitForBackgroundSaving();
+    foreach (DocumentTab *tab, tabs)
+        tab->discardingChangesOnQuit = false;
 
-    discardingChangesOnQuit = false;
+    if (interactionAllowed)
+        Logger::debug("allows interaction.");
+    else
+        Logger::debug("interaction not allowed -- saving.");
 
-    if (!interactionAllowed)
+    // Each document with unsaved changes is shown in turn, and either
+    // saved or asked about:
+    for (int i = 0; i < tabs.count(); i++)
     {
-        Logger::debug("interaction not allowed -- saving.");
-        saveCurrentFile();
-        return true;
-    }
+        if (!tabs.at(i)->document()->isModified())
+            continue;
+        activateTab(i);
 
-    Logger::debug("allows interaction.");
+        if (!interactionAllowed)
+        {
+            saveCurrentFile();
+            waitForBackgroundSaving();
+            continue;
+        }
 
-    QMessageBox::ButtonRole selectedButtonRole = offerToSaveChangesIfNecessary();
-    if (selectedButtonRole == QMessageBox::RejectRole)
-        return false;
-    else if (selectedButtonRole == QMessageBox::DestructiveRole)
-        discardingChangesOnQuit = true;
+        QMessageBox::ButtonRole selectedButtonRole = offerToSaveChangesIfNecessary();
+        if (selectedButtonRole == QMessageBox::RejectRole)
+            return false;
+        else if (selectedButtonRole == QMessageBox::DestructiveRole)
+            currentTab()->discardingChangesOnQuit = true;
+    }
 
     return true;
 }
@@ -1089,6 +2360,12 @@ void MainWindow::commitDataHandler(QSessionManager &manager)
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
+    // (The compile can be canceled from its progress dialog)
+    if (compiling)
+    {
+        event->ignore();
+        return;
+    }
     bool okToQuit = confirmQuit(true);
     if (okToQuit)
         event->accept();
@@ -1134,14 +2411,39 @@ void MainWindow::aboutToQuitHandler()
     }
     settings->sync();
 
-    // If we still have uncommitted changes at this point, and the user
-    // has now chosen to discard them, just play it safe and save them:
-    if (isDirty() && !discardingChangesOnQuit)
-        saveCurrentFile();
+    waitForBackgroundSaving();
+    for (int i = 0; i < tabs.count(); i++)
+    {
+        DocumentTab *tab = tabs.at(i);
+        // If we still have uncommitted changes at this point, and the user
+        // has now chosen to discard them, just play it safe and save them:
+        if (tab->document()->isModified() && !tab->discardingChangesOnQuit)
+        {
+            activateTab(i);
+            saveCurrentFile();
+            waitForBackgroundSaving();
+        }
+
+        // Keep the journal only if there's something that could not be saved:
+        if (!tab->document()->isModified() || tab->discardingChangesOnQuit)
+            tab->journal()->discard();
+        else
+        {
+            tab->journal()->checkpoint();
+            tab->journal()->flush();
+        }
+    }
 }
 
 void MainWindow::handleContentsChange(int position, int charsRemoved, int charsAdded)
 {
-    Q_UNUSED(position); Q_UNUSED(charsRemoved); Q_UNUSED(charsAdded);
+    if (charsRemoved != 0 || charsAdded != 0)
+        documentChangeCount++;
+    // So that jumping to a heading before the next parse lands on it:
+    outlinePanel->model()->adjustPositions(position, charsRemoved, charsAdded);
+    if (currentTab()->fileLoader != NULL)
+        return; // chunks of a file being loaded
+    if (editor->isInLargeFileMode())
+        return; // lines of a large file being swapped in and out
     setDirty(true);
 }
@@ -4,15 +4,30 @@
 #include <QtCore/QSettings>
 #include <QtCore/QStringList>
 #include <QtCore/QDateTime>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QTimer>
 #include <QtWidgets/QMainWindow>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QProgressDialog>
+#include <QtWidgets/QProgressBar>
+#include <QtWidgets/QTabBar>
 #include <QtGui/QSessionManager>
 
 #include "peg-markdown-highlight/highlighter.h"
 #include "preferencesdialog.h"
 #include "filesearchdialog.h"
 #include "editor/qarkdowntextedit.h"
+#include "editor/overviewmap.h"
 #include "markdowncompiler.h"
+#include "fileloader.h"
+#include "filesaver.h"
+#include "editjournal.h"
+#include "notesindexer.h"
+#include "notestextindex.h"
+#include "notessearchdialog.h"
+#include "searchbar.h"
+#include "outlinepanel.h"
+#include "documenttab.h"
 
 QT_BEGIN_NAMESPACE
 class QTextEdit;
@@ -41,25 +56,44 @@ public slots:
     void increaseFontSize();
     void decreaseFontSize();
     void showPreferences();
+    void benchmarkScrolling();
     void about();
 
     void selectTextToSearchFor();
+    void showReplaceBar();
+    void goToLine();
     void findNextSearchMatch();
     void findPreviousSearchMatch();
+    void searchStringChanged(QString searchString);
 
     void formatSelectionEmphasized();
     void formatSelectionStrong();
     void formatSelectionCode();
 
+    void toggleFold();
+    void foldAll();
+    void unfoldAll();
+    void highlighterStructureUpdated();
+    void toggleOutlinePanel();
+    void toggleOverviewMap();
+    void updateOutline();
+    void selectCurrentOutlineHeading();
+    void outlineHeadingActivated(int position);
+
     void preferencesUpdated();
 
     void openRecentFile();
     void showRecentFileSearchDialog();
     void showNotesFolderFileSearchDialog();
     void fileSearchDialogSelectedFilePath(QString path);
+    void showNotesSearchDialog();
+    void notesSearchDialogSelectedHit(QString filePath, int position, int length);
+    void notesIndexerUpdated();
     void compileToTempHTML();
     void compileToHTMLAs();
     void recompileToHTML();
+    void compilerStillRunning(qint64 elapsedMilliseconds);
+    void compilationFinished();
 
     void anchorClicked(const QUrl &link);
     void handleCustomContextMenuRequest(QPoint);
@@ -77,8 +111,22 @@ public slots:
     void quitActionHandler();
 
     void handleContentsChange(int position, int charsRemoved, int charsAdded);
+    void fileLoaderChunkLoaded(QString text, qint64 bytesRead, qint64 totalBytes);
+    void fileLoaderFinished(QString errorString);
+    void largeFileIndexProgress(qint64 bytesIndexed, qint64 totalBytes);
+    void largeFileIndexFinished(QString errorString);
+    void largeFileReadFailed(QString errorString);
+    void editorReadOnlyChanged(bool readOnly);
+    void fileSaverFinished(QString errorString);
+    void openFileWatcherNotification(QString path);
+    void openFileChangeTimerTimeout();
+    void openFileHashFinished();
     void reportStyleParsingErrors(QList<QPair<int, QString> > *list);
 
+    void tabBarCurrentChanged(int index);
+    void tabBarCloseRequested(int index);
+    void closeCurrentTab();
+
 protected:
     void closeEvent(QCloseEvent *event);
     bool eventFilter(QObject *obj,  QEvent *event);
@@ -92,43 +140,109 @@ private:
     };
 
     QString getPathFromFileDialog(FileDialogKind dialogKind);
-    void setOpenFilePath(QString newValue);
+    void setOpenFilePath(QString newValue, QByteArray contentHash = QByteArray());
+    void didOpenFile(QString filePath, QByteArray contentHash);
+    void loadFileInBackground(QString filePath);
+    void finishFileLoading(QString errorString);
+    void cancelBackgroundFileLoading();
+    void loadLargeFile(QString filePath);
+    void finishLargeFileIndexing(QString errorString);
+    void showLoadProgress(QString filePath);
+    void hideLoadProgress();
+    bool waitForBackgroundSaving();
+    bool didFinishBackgroundSaving();
     QString getMarkdownFilesFilter();
     QStringList getMarkdownFilesFilterList();
     void setupEditor();
+    DocumentTab *createTab();
+    DocumentTab *currentTab();
+    DocumentTab *tabForLoader(QObject *loader);
+    bool isCurrentTabUnused();
+    void activateTab(int index);
+    void removeBackgroundTab(int index);
+    int backgroundTabIndexForFilePath(QString filePath);
+    void updateTabTitle(int index);
+    void enforceTabMemoryBudget();
+    void removeUnusedJournalDirs();
+    void resetCurrentDocument();
     void setupFileMenu();
     void updateRecentFilesMenu();
     void performStartupTasks();
+    bool offerToRecoverUnsavedChanges();
     void trimRecentFilesList();
     void addToRecentFiles(QString filePath);
-    void saveViewPositions(QString filePath, int scrollPosition, int cursorPosition);
-    QPair<int, int> getViewPositions(QString filePath);
+    void saveViewPositions(QString filePath, int firstVisibleLine,
+                           int cursorLine, int cursorColumn);
+    QList<int> getViewPositions(QString filePath);
     void saveCurrentFileViewPositions();
     void loadAndSetCurrentFileViewPositions();
     void persistFontInfo();
     void applyPersistedFontInfo();
     void applyStyleWithoutErrorReporting();
     void applyStyle(bool reportParsingErrorsToUser = true);
-    void applyHighlighterPreferences();
+    void applyHighlighterPreferences(bool reportStyleParsingErrorsToUser = true);
     void applyEditorPreferences();
+    void applyNotesFolderPreferences();
+    QString checkedNotesFolderPath();
+    void selectTextRange(int position, int length);
     bool isDirty();
     void setDirty(bool value);
+    void prepareCompiler();
     bool compileToHTMLFile(QString targetPath);
     void checkIfFileModifiedByThirdParty();
+    bool mayAskToReloadFile();
+    void askToReloadModifiedFile();
+    void cancelOpenFileHashing();
 
     MarkdownCompiler *compiler;
     QString lastCompileTargetPath;
+    QProgressDialog *compileProgressDialog;
+    // Set while compileToHTMLFile() waits for the compiler (with events
+    // being processed), during which the document must not be swapped:
+    bool compiling;
 
     PreferencesDialog *preferencesDialog;
     FileSearchDialog *fileSearchDialog;
+    NotesIndexer *notesIndexer;
+    NotesTextIndex *notesTextIndex;
+    NotesSearchDialog *notesSearchDialog;
     QSettings *settings;
     QarkdownTextEdit *editor;
+    SearchBar *searchBar;
+    OutlinePanel *outlinePanel;
+    OverviewMap *overviewMap;
+    // The current tab's:
     HGMarkdownHighlighter *highlighter;
+    EditJournal *journal;
+    QTabBar *tabBar;
+    QList<DocumentTab *> tabs;
+    int currentTabIndex;
+    bool switchingTabs;
+    qint64 tabShowCounter;
+    // Bumped whenever the highlighter settings change (the highlighters
+    // of background tabs are brought up to date when shown):
+    int styleGeneration;
+    ParseScheduler *parseScheduler;
     QString openFilePath;
     QDateTime openFileKnownLastModified;
-    QString searchString;
+    qint64 openFileKnownSize;
+    QByteArray openFileKnownHash;
+    QFileSystemWatcher *openFileWatcher;
+    QTimer *openFileChangeTimer;
+    bool askingToReloadFile;
+    // Hashes the open file after its modification date changes:
+    FileHashThread *openFileHasher;
+    QDateTime openFileHashedLastModified;
+    FileSaverThread *fileSaver;
+    bool fileSaverSavingNewFile;
+    int documentChangeCount;
+    // Read from the journals of a crashed session, one per document:
+    QStringList recoveredFilePaths;
+    QStringList recoveredTexts;
+    QProgressBar *loadProgressBar;
 
     QMenu *recentFilesMenu;
+    QMenu *formattingMenu;
     QList<QAction *> *recentFilesMenuActions;
 
     QAction *findNextMenuAction;
@@ -137,8 +251,6 @@ private:
     QAction *recompileAction;
     QAction *revealFileAction;
     QAction *switchToPreviousFileAction;
-
-    bool discardingChangesOnQuit;
 };
 
 #endif
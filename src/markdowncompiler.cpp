@@ -7,15 +7,44 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QTextStream>
 #include <QtCore/QRegularExpression>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QMutexLocker>
+
+#ifdef Q_OS_LINUX
+#include <sys/resource.h>
+#endif
+
+CompilerExtractionThread::CompilerExtractionThread(MarkdownCompiler *aCompiler,
+                                                   QString aCompilerPath)
+{
+    compiler = aCompiler;
+    compilerPath = aCompilerPath;
+}
+
+void CompilerExtractionThread::run()
+{
+    compiler->getExecutablePathForCompiler(compilerPath);
+}
+
 
 MarkdownCompiler::MarkdownCompiler(QSettings *appSettings, QObject *parent) :
     QObject(parent)
 {
     settings = appSettings;
     compilerProcess = NULL;
+    extractionThread = NULL;
+    _lastCompilationStats.elapsedMilliseconds = 0;
+    _lastCompilationStats.peakMemoryKilobytes = -1;
+    _lastCompilationStats.timedOut = false;
+    _lastCompilationStats.canceled = false;
 }
 MarkdownCompiler::~MarkdownCompiler()
 {
+    if (extractionThread != NULL)
+    {
+        extractionThread->wait();
+        delete extractionThread;
+    }
     if (compilerProcess != NULL)
         delete compilerProcess;
 }
@@ -39,7 +68,11 @@ QString MarkdownCompiler::getHTMLTemplate()
 
 QString MarkdownCompiler::wrapHTMLContentInTemplate(QString htmlContent)
 {
-    QString templateStr = getHTMLTemplate();
+    return wrapHTMLContentInTemplate(htmlContent, getHTMLTemplate());
+}
+
+QString MarkdownCompiler::wrapHTMLContentInTemplate(QString htmlContent, QString templateStr)
+{
     static const QRegularExpression contentCommentRE("\\<\\!--\\s*[Cc]ontent\\s*-->");
     QStringList parts = templateStr.split(contentCommentRE, Qt::SkipEmptyParts);
     if (parts.count() == 2)
@@ -55,6 +88,53 @@ QString MarkdownCompiler::wrapHTMLContentInTemplate(QString htmlContent)
     }
 }
 
+static QByteArray sha1OfFile(QString path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(&file);
+    return hash.result();
+}
+
+static bool extractedFileMatchesResource(QString resourcePath, QString filePath)
+{
+    QFileInfo fileInfo(filePath);
+    if (!fileInfo.exists() || fileInfo.size() != QFileInfo(resourcePath).size())
+        return false;
+    QByteArray fileHash = sha1OfFile(filePath);
+    return (!fileHash.isNull() && fileHash == sha1OfFile(resourcePath));
+}
+
+#define kExtractedFilePermissions (QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner \
+                                   | QFile::ReadUser | QFile::WriteUser | QFile::ExeUser)
+
+bool MarkdownCompiler::extractResourceIfNeeded(QString resourcePath, QString targetFilePath)
+{
+    // A previous session (or another user of the temp dir) may have left
+    // behind a truncated or otherwise different file, so we don't trust
+    // mere existence:
+    if (extractedFileMatchesResource(resourcePath, targetFilePath))
+    {
+        // ..nor that it is still executable (a previous setPermissions()
+        // may have failed, or something may have reset them):
+        if (QFileInfo(targetFilePath).isExecutable())
+            return true;
+        Logger::info("Restoring permissions of extracted compiler resource: " + targetFilePath);
+        if (QFile(targetFilePath).setPermissions(kExtractedFilePermissions)
+            && QFileInfo(targetFilePath).isExecutable())
+            return true;
+        // Otherwise extract a fresh copy that we own:
+    }
+
+    Logger::info("Extracting compiler resource: " + resourcePath);
+    if (!QarkdownApplication::copyResourceToFile(resourcePath, targetFilePath))
+        return false;
+    // The copy inherits the read-only permissions of the resource:
+    return QFile(targetFilePath).setPermissions(kExtractedFilePermissions);
+}
+
 QString MarkdownCompiler::getFilesystemPathForResourcePath(QString resourcePath)
 {
     QString fileName = QFileInfo(resourcePath).fileName();
@@ -62,37 +142,83 @@ QString MarkdownCompiler::getFilesystemPathForResourcePath(QString resourcePath)
     QString targetFileDir = QDir::tempPath();
     QString targetFilePath = targetFileDir + QDir::separator() + fileName;
 
-    if (!QFile::exists(targetFilePath)) {
-        if (!((QarkdownApplication*)qApp)->copyResourceToFile(resourcePath,
-                                                              targetFilePath))
-            return QString();
-    }
-
-    if (!QFileInfo(targetFilePath).isExecutable()) {
-        if (!QFile(targetFilePath).setPermissions(QFile::ExeUser))
-            return QString();
-    }
+    if (!extractResourceIfNeeded(resourcePath, targetFilePath))
+        return QString();
 
-    if (QFile::exists(resourcePath + ".dependencies"))
+    QString depsDirPath = resourcePath + ".dependencies";
+    if (QFile::exists(depsDirPath))
     {
-        QString depsDirPath = resourcePath + ".dependencies";
         QStringList depFiles = QDir(depsDirPath).entryList();
         foreach(QString depFileName, depFiles)
         {
             Logger::info("Compiler dependency: " + depFileName);
-            QString depTargetPath = targetFileDir + QDir::separator() + depFileName;
-            if (!QFile::exists(depTargetPath)) {
-                if (!((QarkdownApplication*)qApp)->copyResourceToFile(
-                            depsDirPath + QDir::separator() + depFileName,
-                            depTargetPath))
-                    return QString();
-            }
+            if (!extractResourceIfNeeded(depsDirPath + QDir::separator() + depFileName,
+                                         targetFileDir + QDir::separator() + depFileName))
+                return QString();
         }
     }
 
     return targetFilePath;
 }
 
+QString MarkdownCompiler::getExecutablePathForCompiler(QString compilerPath)
+{
+    if (!compilerPath.startsWith(":/"))
+        return compilerPath;
+
+    // Resolving a built-in compiler means extracting and verifying it,
+    // which we only want to do once per session. The lock also makes a
+    // compile wait for a still-running background extraction instead of
+    // racing it.
+    QMutexLocker locker(&resolvedPathsMutex);
+    if (resolvedPaths.contains(compilerPath))
+        return resolvedPaths.value(compilerPath);
+
+    QString path = getFilesystemPathForResourcePath(compilerPath);
+    if (!path.isEmpty())
+        resolvedPaths.insert(compilerPath, path);
+    return path;
+}
+
+void MarkdownCompiler::forgetResolvedPath(QString compilerPath)
+{
+    QMutexLocker locker(&resolvedPathsMutex);
+    resolvedPaths.remove(compilerPath);
+}
+
+void MarkdownCompiler::prepareCompilerInBackground(QString compilerPath)
+{
+    if (!compilerPath.startsWith(":/"))
+        return;
+    if (extractionThread != NULL)
+    {
+        if (extractionThread->isRunning())
+        {
+            // E.g. another compiler was chosen during the extraction at
+            // startup; it is extracted next, so that its first compile
+            // doesn't have to:
+            queuedExtractionPath = compilerPath;
+            return;
+        }
+        delete extractionThread;
+    }
+    extractionThread = new CompilerExtractionThread(this, compilerPath);
+    connect(extractionThread, SIGNAL(finished()),
+            this, SLOT(extractionThreadFinished()));
+    extractionThread->start(QThread::LowPriority);
+}
+
+void MarkdownCompiler::extractionThreadFinished()
+{
+    if (sender() != extractionThread || queuedExtractionPath.isNull())
+        return;
+    // finished() is emitted just before the thread actually ends:
+    extractionThread->wait();
+    QString compilerPath = queuedExtractionPath;
+    queuedExtractionPath = QString();
+    prepareCompilerInBackground(compilerPath);
+}
+
 QString MarkdownCompiler::errorString()
 {
     return _errorString;
@@ -138,22 +264,155 @@ QString MarkdownCompiler::getUserReadableCompilerName(QString compilerPath)
 }
 
 #define kCompileEmptyRetVal QPair<QString, QString>(QString(), QString())
+#define kCompilerPollIntervalMilliseconds 50
+
+int MarkdownCompiler::getSavedTimeoutForCompiler(QString compilerPath)
+{
+    QMap<QString, QVariant> timeoutsMap = settings->value(SETTING_COMPILER_TIMEOUTS).toMap();
+    if (!timeoutsMap.contains(compilerPath))
+        return DEF_COMPILER_TIMEOUT;
+    return timeoutsMap.value(compilerPath).toInt();
+}
+
+CompilerLimits MarkdownCompiler::getLimitsForCompiler(QString compilerPath)
+{
+    CompilerLimits limits;
+    limits.timeoutSeconds = getSavedTimeoutForCompiler(compilerPath);
+    limits.cpuTimeSeconds = settings->value(SETTING_COMPILER_CPU_LIMIT,
+                                            QVariant(DEF_COMPILER_CPU_LIMIT)).toInt();
+    limits.memoryMegabytes = settings->value(SETTING_COMPILER_MEMORY_LIMIT,
+                                             QVariant(DEF_COMPILER_MEMORY_LIMIT)).toInt();
+    return limits;
+}
+
+CompilationStats MarkdownCompiler::lastCompilationStats()
+{
+    return _lastCompilationStats;
+}
+
+void MarkdownCompiler::cancel()
+{
+    cancelRequested.storeRelaxed(1);
+}
+
+void MarkdownCompiler::samplePeakMemory(QProcess *process)
+{
+#ifdef Q_OS_LINUX
+    // VmHWM is the peak resident set size of the process so far. We can
+    // only read it while the process is alive, so this is a sample.
+    QFile statusFile(QString("/proc/%1/status").arg(process->processId()));
+    if (!statusFile.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+    QByteArray line;
+    while (!(line = statusFile.readLine()).isEmpty())
+    {
+        if (!line.startsWith("VmHWM:"))
+            continue;
+        qint64 kilobytes = line.mid(6).trimmed().split(' ').first().toLongLong();
+        _lastCompilationStats.peakMemoryKilobytes = qMax(_lastCompilationStats.peakMemoryKilobytes,
+                                                         kilobytes);
+        break;
+    }
+#else
+    Q_UNUSED(process);
+#endif
+}
+
+bool MarkdownCompiler::waitForCompilerToFinish(QProcess *process, CompilerLimits limits,
+                                               QElapsedTimer *timer)
+{
+    qint64 timeoutMilliseconds = (qint64)limits.timeoutSeconds * 1000;
+
+    // Wait in short slices instead of one long blocking wait so that we
+    // can honor cancellation and keep listeners informed:
+    while (process->state() != QProcess::NotRunning
+           && !process->waitForFinished(kCompilerPollIntervalMilliseconds))
+    {
+        if (process->state() == QProcess::NotRunning)
+            break;
+        samplePeakMemory(process);
+
+        bool canceled = (cancelRequested.loadRelaxed() != 0);
+        bool timedOut = (0 < timeoutMilliseconds && timeoutMilliseconds <= timer->elapsed());
+        if (canceled || timedOut)
+        {
+            process->kill();
+            process->waitForFinished();
+            _lastCompilationStats.canceled = canceled;
+            _lastCompilationStats.timedOut = timedOut && !canceled;
+            _errorString = canceled
+                           ? tr("Compiling was canceled.")
+                           : tr("The compiler did not finish within %1 seconds.").arg(limits.timeoutSeconds);
+            return false;
+        }
+
+        emit compilerStillRunning(timer->elapsed());
+    }
+    return true;
+}
 
 QPair<QString, QString> MarkdownCompiler::executeCompiler(QString compilerPath, QString input, QStringList compilerArgsList)
+{
+    return executeCompiler(compilerPath, input, compilerArgsList,
+                           getLimitsForCompiler(compilerPath));
+}
+
+QPair<QString, QString> MarkdownCompiler::executeCompiler(QString compilerPath, QString input, QStringList compilerArgsList,
+                                                          CompilerLimits limits)
 {
     //Logger::info("Compiling with compiler: " + compilerPath);
     _errorString = QString();
+    _lastCompilationStats.elapsedMilliseconds = 0;
+    _lastCompilationStats.peakMemoryKilobytes = -1;
+    _lastCompilationStats.timedOut = false;
+    _lastCompilationStats.canceled = false;
+    cancelRequested.storeRelaxed(0);
+
+    QElapsedTimer timer;
+    timer.start();
+    QPair<QString, QString> ret = runCompilerProcess(compilerPath, input, compilerArgsList,
+                                                     limits, &timer);
+    _lastCompilationStats.elapsedMilliseconds = timer.elapsed();
+
+    emit compilationFinished();
+    return ret;
+}
 
-    QString actualCompilerPath(compilerPath);
-    bool isResourcePath = compilerPath.startsWith(":/");
-    if (isResourcePath) {
-        actualCompilerPath = getFilesystemPathForResourcePath(compilerPath);
-        //Logger::info("Adjusted path to: '"+actualCompilerPath+"'");
-    }
+QPair<QString, QString> MarkdownCompiler::runCompilerProcess(QString compilerPath, QString input,
+                                                             QStringList compilerArgsList,
+                                                             CompilerLimits limits,
+                                                             QElapsedTimer *timer)
+{
+    QString actualCompilerPath = getExecutablePathForCompiler(compilerPath);
+    //Logger::info("Adjusted path to: '"+actualCompilerPath+"'");
 
     QProcess syncCompilerProcess;
     //Logger::debug("Compiler args: "+compilerArgsList.join(", "));
 
+#ifdef Q_OS_LINUX
+    if (0 < limits.cpuTimeSeconds || 0 < limits.memoryMegabytes)
+    {
+        int cpuTimeSeconds = limits.cpuTimeSeconds;
+        int memoryMegabytes = limits.memoryMegabytes;
+        syncCompilerProcess.setChildProcessModifier([cpuTimeSeconds, memoryMegabytes]() {
+            // Runs in the child between fork() and exec(), so only
+            // async-signal-safe calls are allowed here.
+            struct rlimit limit;
+            if (0 < cpuTimeSeconds)
+            {
+                limit.rlim_cur = (rlim_t)cpuTimeSeconds;
+                limit.rlim_max = (rlim_t)cpuTimeSeconds + 1;
+                setrlimit(RLIMIT_CPU, &limit);
+            }
+            if (0 < memoryMegabytes)
+            {
+                limit.rlim_cur = limit.rlim_max = (rlim_t)memoryMegabytes * 1024 * 1024;
+                setrlimit(RLIMIT_AS, &limit);
+            }
+        });
+    }
+#endif
+
     // We need to supply an empty QStringList as the arguments (even if we
     // don't wish to supply arguments) so that QProcess understands that the
     // first argument is the executable path, and escapes spaces in the path
@@ -165,8 +424,12 @@ QPair<QString, QString> MarkdownCompiler::executeCompiler(QString compilerPath,
     if (!syncCompilerProcess.waitForStarted()) {
         Logger::warning("Cannot start process: " + actualCompilerPath);
         _errorString = syncCompilerProcess.errorString();
+        // The extracted copy may have been removed from the temp dir
+        // since we resolved it; re-extract on the next attempt:
+        forgetResolvedPath(compilerPath);
         return kCompileEmptyRetVal;
     }
+    samplePeakMemory(&syncCompilerProcess);
 
     if (!input.isNull())
     {
@@ -174,15 +437,19 @@ QPair<QString, QString> MarkdownCompiler::executeCompiler(QString compilerPath,
         syncCompilerProcess.closeWriteChannel();
     }
 
-    if (!syncCompilerProcess.waitForFinished()) {
-        Logger::warning("Error while waiting process to finish: " + actualCompilerPath);
-        _errorString = syncCompilerProcess.errorString();
+    if (!waitForCompilerToFinish(&syncCompilerProcess, limits, timer)) {
+        Logger::warning("Error while waiting process to finish: " + actualCompilerPath
+                        + " -- " + _errorString);
         return kCompileEmptyRetVal;
     }
 
     if (syncCompilerProcess.exitStatus() != QProcess::NormalExit) {
         Logger::warning("Process returned non-normal exit status: " + actualCompilerPath);
         _errorString = syncCompilerProcess.errorString();
+#ifdef Q_OS_LINUX
+        if (0 < limits.cpuTimeSeconds || 0 < limits.memoryMegabytes)
+            _errorString += "\n" + tr("The compiler may have exceeded its CPU time or memory limit.");
+#endif
         return kCompileEmptyRetVal;
     }
 
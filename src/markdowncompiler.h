@@ -4,6 +4,45 @@
 #include <QtCore/QObject>
 #include <QtCore/QProcess>
 #include <QtCore/QSettings>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QHash>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+
+class MarkdownCompiler;
+
+/** @brief Limits applied to a single compiler invocation.
+  *
+  * A value of 0 means "no limit". The CPU time and memory limits are
+  * only enforced on Linux (via setrlimit() in the child process).
+  */
+struct CompilerLimits
+{
+    int timeoutSeconds;
+    int cpuTimeSeconds;
+    int memoryMegabytes;
+};
+
+/** @brief Measurements from the most recent compiler invocation. */
+struct CompilationStats
+{
+    qint64 elapsedMilliseconds;
+    qint64 peakMemoryKilobytes; // -1 if it could not be measured
+    bool timedOut;
+    bool canceled;
+};
+
+class CompilerExtractionThread : public QThread
+{
+public:
+    CompilerExtractionThread(MarkdownCompiler *compiler, QString compilerPath);
+    void run();
+
+private:
+    MarkdownCompiler *compiler;
+    QString compilerPath;
+};
 
 class MarkdownCompiler : public QObject
 {
@@ -13,24 +52,61 @@ public:
     ~MarkdownCompiler();
 
     QPair<QString, QString> executeCompiler(QString compilerPath, QString input, QStringList compilerArgsList);
+    QPair<QString, QString> executeCompiler(QString compilerPath, QString input, QStringList compilerArgsList,
+                                            CompilerLimits limits);
     QPair<QString, QString> compileSynchronously(QString input, QString compilerPath, bool useDefaultArguments = false);
     bool compileToHTMLFile(QString compilerPath, QString input, QString targetPath);
     QString getUserReadableCompilerName(QString compilerPath);
+    QString getExecutablePathForCompiler(QString compilerPath);
+    void prepareCompilerInBackground(QString compilerPath);
     QString errorString();
     QString getHTMLTemplate();
     QString wrapHTMLContentInTemplate(QString htmlContent);
+    QString wrapHTMLContentInTemplate(QString htmlContent, QString templateStr);
     QString getSavedArgsForCompiler(QString compilerPath);
     QStringList getArgsListForCompiler(QString compilerPath, bool useDefaultArguments = false);
+    int getSavedTimeoutForCompiler(QString compilerPath);
+    CompilerLimits getLimitsForCompiler(QString compilerPath);
+    CompilationStats lastCompilationStats();
 
 private:
     QSettings *settings;
     QProcess *compilerProcess;
     QString _errorString;
+    CompilationStats _lastCompilationStats;
+    QAtomicInt cancelRequested;
+    CompilerExtractionThread *extractionThread;
+    // Extracted once the running extraction is done (the most recently
+    // requested one only):
+    QString queuedExtractionPath;
+    QMutex resolvedPathsMutex;
+    QHash<QString, QString> resolvedPaths;
     QString getFilesystemPathForResourcePath(QString resourcePath);
+    bool extractResourceIfNeeded(QString resourcePath, QString targetFilePath);
+    void forgetResolvedPath(QString compilerPath);
+    QPair<QString, QString> runCompilerProcess(QString compilerPath, QString input,
+                                               QStringList compilerArgsList,
+                                               CompilerLimits limits,
+                                               QElapsedTimer *timer);
+    bool waitForCompilerToFinish(QProcess *process, CompilerLimits limits,
+                                 QElapsedTimer *timer);
+    void samplePeakMemory(QProcess *process);
 
 signals:
+    /** @brief Emitted periodically while waiting for the compiler process.
+      *
+      * Receivers on the same thread may process events in response to
+      * this in order to keep a UI (and a cancel button) responsive.
+      */
+    void compilerStillRunning(qint64 elapsedMilliseconds);
+    void compilationFinished();
 
 public slots:
+    /** @brief Kill the compiler process that is currently running, if any. */
+    void cancel();
+
+private slots:
+    void extractionThreadFinished();
 
 };
 
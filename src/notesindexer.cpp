@@ -0,0 +1,298 @@
+#include "notesindexer.h"
+#include "logger.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDateTime>
+#include <QtCore/QDataStream>
+#include <QtCore/QSaveFile>
+
+#define kIndexFileMagic 0x514b4e31 // "QKN1"
+#define kDataStreamVersion QDataStream::Qt_6_0
+
+#define kRescanIntervalMilliseconds (5 * 60 * 1000)
+// Opening the file search dialog doesn't rescan more often than this:
+#define kStaleIndexMilliseconds (30 * 1000)
+
+
+NotesIndexScanThread::NotesIndexScanThread(QString anIndexFilePath, QString aRootPath,
+                                           QStringList someNameFilters,
+                                           NotesIndexDirCache previousCache,
+                                           bool shouldLoadIndexFileFirst)
+{
+    indexFilePath = anIndexFilePath;
+    rootPath = aRootPath;
+    nameFilters = someNameFilters;
+    cache = previousCache;
+    loadIndexFileFirst = shouldLoadIndexFileFirst;
+    _succeeded = false;
+}
+
+bool NotesIndexScanThread::succeeded()
+{
+    return _succeeded;
+}
+QStringList NotesIndexScanThread::filePaths()
+{
+    return _filePaths;
+}
+NotesIndexDirCache NotesIndexScanThread::dirCache()
+{
+    return cache;
+}
+
+bool NotesIndexScanThread::readIndexFile(QString indexFilePath, QString rootPath,
+                                         QStringList nameFilters, NotesIndexDirCache *cache)
+{
+    QFile file(indexFilePath);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(kDataStreamVersion);
+    quint32 magic = 0;
+    QString fileRootPath;
+    QStringList fileNameFilters;
+    qint32 count = 0;
+    stream >> magic >> fileRootPath >> fileNameFilters >> count;
+    // An index of some other folder (or other file types) is of no use:
+    if (stream.status() != QDataStream::Ok || magic != kIndexFileMagic
+        || fileRootPath != rootPath || fileNameFilters != nameFilters)
+        return false;
+
+    cache->clear();
+    cache->reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        QString dirPath;
+        NotesIndexDirEntry entry;
+        stream >> dirPath >> entry.lastModified >> entry.fileNames >> entry.subdirNames;
+        if (stream.status() != QDataStream::Ok)
+        {
+            cache->clear();
+            return false;
+        }
+        cache->insert(dirPath, entry);
+    }
+    return true;
+}
+
+bool NotesIndexScanThread::writeIndexFile(QString indexFilePath, QString rootPath,
+                                          QStringList nameFilters,
+                                          const NotesIndexDirCache &cache)
+{
+    QSaveFile file(indexFilePath);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(kDataStreamVersion);
+    stream << (quint32)kIndexFileMagic << rootPath << nameFilters << (qint32)cache.count();
+    NotesIndexDirCache::const_iterator i;
+    for (i = cache.constBegin(); i != cache.constEnd(); ++i)
+        stream << i.key() << i.value().lastModified << i.value().fileNames << i.value().subdirNames;
+    return file.commit();
+}
+
+void NotesIndexScanThread::run()
+{
+    if (loadIndexFileFirst)
+    {
+        NotesIndexDirCache loadedCache;
+        if (readIndexFile(indexFilePath, rootPath, nameFilters, &loadedCache))
+        {
+            cache = loadedCache;
+            QStringList loadedFilePaths;
+            NotesIndexDirCache::const_iterator i;
+            for (i = cache.constBegin(); i != cache.constEnd(); ++i)
+            {
+                foreach (QString fileName, i.value().fileNames)
+                    loadedFilePaths.append(i.key() + "/" + fileName);
+            }
+            loadedFilePaths.sort(Qt::CaseInsensitive);
+            emit indexFileLoaded(loadedFilePaths);
+        }
+    }
+
+    NotesIndexDirCache newCache;
+    newCache.reserve(cache.count());
+    bool changed = false;
+
+    QStringList pendingDirs;
+    pendingDirs.append(QDir(rootPath).absolutePath());
+    while (!pendingDirs.isEmpty())
+    {
+        if (isInterruptionRequested())
+            return;
+
+        QString dirPath = pendingDirs.takeLast();
+        QFileInfo dirInfo(dirPath);
+        if (!dirInfo.isDir())
+            continue;
+        qint64 lastModified = dirInfo.lastModified().toMSecsSinceEpoch();
+
+        NotesIndexDirEntry entry;
+        NotesIndexDirCache::const_iterator cached = cache.constFind(dirPath);
+        if (cached != cache.constEnd() && cached.value().lastModified == lastModified)
+            entry = cached.value();
+        else
+        {
+            QDir dir(dirPath);
+            entry.lastModified = lastModified;
+            entry.fileNames = dir.entryList(nameFilters, QDir::Files);
+            // Hidden directories (.git etc.) and symlinks (possible
+            // cycles) are skipped:
+            entry.subdirNames = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot
+                                              | QDir::NoSymLinks);
+            changed = true;
+        }
+        newCache.insert(dirPath, entry);
+
+        foreach (QString fileName, entry.fileNames)
+            _filePaths.append(dirPath + "/" + fileName);
+        foreach (QString subdirName, entry.subdirNames)
+            pendingDirs.append(dirPath + "/" + subdirName);
+    }
+
+    // Directories that have disappeared count as a change, too:
+    if (newCache.count() != cache.count())
+        changed = true;
+    cache = newCache;
+
+    if (changed && !writeIndexFile(indexFilePath, rootPath, nameFilters, cache))
+        Logger::warning("Cannot write notes folder index: " + indexFilePath);
+
+    _filePaths.sort(Qt::CaseInsensitive);
+    _succeeded = true;
+}
+
+
+NotesIndexer::NotesIndexer(QString anIndexFilePath, QObject *parent) :
+    QObject(parent)
+{
+    indexFilePath = anIndexFilePath;
+    ready = false;
+    rescanPending = false;
+    scanThread = NULL;
+
+    rescanTimer = new QTimer(this);
+    rescanTimer->setInterval(kRescanIntervalMilliseconds);
+    connect(rescanTimer, SIGNAL(timeout()), this, SLOT(rescan()));
+}
+
+NotesIndexer::~NotesIndexer()
+{
+    cancelScan();
+}
+
+QString NotesIndexer::notesFolder()
+{
+    return rootPath;
+}
+
+bool NotesIndexer::isReady()
+{
+    return ready;
+}
+
+QStringList NotesIndexer::filePaths()
+{
+    return _filePaths;
+}
+
+void NotesIndexer::setNotesFolder(QString path, QStringList someNameFilters)
+{
+    if (path == rootPath && someNameFilters == nameFilters)
+        return;
+
+    cancelScan();
+    rootPath = path;
+    nameFilters = someNameFilters;
+    dirCache.clear();
+    _filePaths.clear();
+    ready = false;
+
+    if (rootPath.isEmpty())
+    {
+        rescanTimer->stop();
+        emit indexUpdated();
+        return;
+    }
+
+    // The index from the previous run (if it's for this same folder) is
+    // loaded first, and then brought up to date:
+    startScan(true);
+    rescanTimer->start();
+}
+
+void NotesIndexer::rescan()
+{
+    if (rootPath.isEmpty())
+        return;
+    if (scanThread != NULL)
+    {
+        rescanPending = true;
+        return;
+    }
+    startScan(false);
+}
+
+void NotesIndexer::rescanIfStale()
+{
+    if (!sinceLastScan.isValid() || kStaleIndexMilliseconds < sinceLastScan.elapsed())
+        rescan();
+}
+
+void NotesIndexer::startScan(bool loadIndexFileFirst)
+{
+    rescanPending = false;
+    scanThread = new NotesIndexScanThread(indexFilePath, rootPath, nameFilters,
+                                          dirCache, loadIndexFileFirst);
+    connect(scanThread, SIGNAL(indexFileLoaded(QStringList)),
+            this, SLOT(scanThreadLoadedIndexFile(QStringList)));
+    connect(scanThread, SIGNAL(finished()), this, SLOT(scanThreadFinished()));
+    scanThread->start();
+}
+
+void NotesIndexer::cancelScan()
+{
+    if (scanThread == NULL)
+        return;
+    scanThread->requestInterruption();
+    scanThread->wait();
+    // deleteLater() so that the queued finished() signal can be told
+    // apart from that of a later scan:
+    scanThread->deleteLater();
+    scanThread = NULL;
+}
+
+void NotesIndexer::scanThreadLoadedIndexFile(QStringList filePaths)
+{
+    if (scanThread == NULL || sender() != scanThread || ready)
+        return;
+    _filePaths = filePaths;
+    ready = true;
+    emit indexUpdated();
+}
+
+void NotesIndexer::scanThreadFinished()
+{
+    if (scanThread == NULL || sender() != scanThread)
+        return;
+
+    NotesIndexScanThread *thread = scanThread;
+    scanThread = NULL;
+    thread->deleteLater();
+
+    if (thread->succeeded())
+    {
+        dirCache = thread->dirCache();
+        _filePaths = thread->filePaths();
+        ready = true;
+        sinceLastScan.start();
+        emit indexUpdated();
+    }
+
+    if (rescanPending)
+        startScan(false);
+}
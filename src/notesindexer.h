@@ -0,0 +1,117 @@
+#ifndef NOTESINDEXER_H
+#define NOTESINDEXER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QHash>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+#include <QtCore/QElapsedTimer>
+
+/** @brief What was found in one directory of the notes folder tree. */
+struct NotesIndexDirEntry
+{
+    qint64 lastModified; // msecs since epoch
+    QStringList fileNames;
+    QStringList subdirNames;
+};
+
+typedef QHash<QString, NotesIndexDirEntry> NotesIndexDirCache;
+
+/** @brief Recursively lists the files in the notes folder.
+  *
+  * Directories whose modification time hasn't changed since the previous
+  * scan are not listed again (adding, removing or renaming an entry
+  * changes the directory's mtime), so a rescan mostly costs one stat()
+  * per directory. The result is also written to the index file.
+  */
+class NotesIndexScanThread : public QThread
+{
+    Q_OBJECT
+public:
+    NotesIndexScanThread(QString indexFilePath, QString rootPath,
+                         QStringList nameFilters, NotesIndexDirCache previousCache,
+                         bool loadIndexFileFirst);
+
+    bool succeeded();
+    QStringList filePaths();
+    NotesIndexDirCache dirCache();
+
+    static bool readIndexFile(QString indexFilePath, QString rootPath,
+                              QStringList nameFilters, NotesIndexDirCache *cache);
+    static bool writeIndexFile(QString indexFilePath, QString rootPath,
+                               QStringList nameFilters, const NotesIndexDirCache &cache);
+
+signals:
+    /** @brief Emitted with the contents of the persisted index (if any)
+      * before rescanning, so that it can be used right away. */
+    void indexFileLoaded(QStringList filePaths);
+
+protected:
+    void run();
+
+private:
+    QString indexFilePath;
+    QString rootPath;
+    QStringList nameFilters;
+    NotesIndexDirCache cache;
+    bool loadIndexFileFirst;
+    bool _succeeded;
+    QStringList _filePaths;
+};
+
+/** @brief Keeps an up-to-date list of all the Markdown files under the
+  * notes folder (including subfolders), so that it can be queried
+  * instantly.
+  *
+  * Scanning happens on a background thread: at startup the index
+  * persisted by the previous run is used, and the tree is rescanned
+  * periodically and when asked to.
+  */
+class NotesIndexer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NotesIndexer(QString indexFilePath, QObject *parent = 0);
+    ~NotesIndexer();
+
+    /** @brief Set what to index; does nothing if unchanged. */
+    void setNotesFolder(QString path, QStringList nameFilters);
+    QString notesFolder();
+
+    /** @brief Whether filePaths() is available (i.e. has been loaded or
+      * scanned at least once for the current notes folder). */
+    bool isReady();
+    QStringList filePaths();
+
+    /** @brief Rescan unless the index has been updated very recently. */
+    void rescanIfStale();
+
+public slots:
+    /** @brief Rescan in the background, unless already doing so. */
+    void rescan();
+
+signals:
+    void indexUpdated();
+
+private slots:
+    void scanThreadLoadedIndexFile(QStringList filePaths);
+    void scanThreadFinished();
+
+private:
+    QString indexFilePath;
+    QString rootPath;
+    QStringList nameFilters;
+    NotesIndexDirCache dirCache;
+    QStringList _filePaths;
+    bool ready;
+    bool rescanPending;
+    NotesIndexScanThread *scanThread;
+    QTimer *rescanTimer;
+    QElapsedTimer sinceLastScan;
+
+    void startScan(bool loadIndexFileFirst);
+    void cancelScan();
+};
+
+#endif // NOTESINDEXER_H
@@ -0,0 +1,274 @@
+#include "notessearchdialog.h"
+
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QDialogButtonBox>
+#include <QtCore/QFileInfo>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QCoreApplication>
+
+#define kMaxResults 200
+// Snippets of earlier searches are forgotten beyond this many:
+#define kMaxCachedSnippets 2000
+
+
+NotesSnippetThread::NotesSnippetThread(QList<NotesTextSearchHit> someHits, QObject *parent) :
+    QThread(parent)
+{
+    hits = someHits;
+    notified = false;
+}
+
+NotesSnippetThread::~NotesSnippetThread()
+{
+    cancel();
+}
+
+void NotesSnippetThread::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+QHash<QString, QString> NotesSnippetThread::takeSnippets()
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, QString> snippets;
+    snippets.swap(pendingSnippets);
+    notified = false;
+    return snippets;
+}
+
+QString NotesSnippetThread::snippetKey(const NotesTextSearchHit &hit)
+{
+    return QString("%1:%2:%3").arg(hit.byteOffset).arg(hit.length).arg(hit.filePath);
+}
+
+void NotesSnippetThread::run()
+{
+    foreach (const NotesTextSearchHit &hit, hits)
+    {
+        if (isInterruptionRequested())
+            return;
+        QString snippet = NotesTextIndex::snippet(hit);
+
+        QMutexLocker locker(&mutex);
+        pendingSnippets.insert(snippetKey(hit), snippet);
+        if (notified)
+            continue;
+        notified = true;
+        locker.unlock();
+        emit snippetsAvailable();
+    }
+}
+
+
+NotesSearchResultsModel::NotesSearchResultsModel(QObject *parent) :
+    QAbstractListModel(parent)
+{
+    snippetThread = NULL;
+}
+
+NotesSearchResultsModel::~NotesSearchResultsModel()
+{
+    cancelSnippetThread();
+}
+
+void NotesSearchResultsModel::setHits(QList<NotesTextSearchHit> someHits)
+{
+    cancelSnippetThread();
+    beginResetModel();
+    hits = someHits;
+    endResetModel();
+
+    if (kMaxCachedSnippets < snippets.count())
+        snippets.clear();
+    QList<NotesTextSearchHit> missingSnippets;
+    foreach (const NotesTextSearchHit &hit, hits)
+    {
+        if (!snippets.contains(NotesSnippetThread::snippetKey(hit)))
+            missingSnippets.append(hit);
+    }
+    if (missingSnippets.isEmpty())
+        return;
+    snippetThread = new NotesSnippetThread(missingSnippets, this);
+    connect(snippetThread, SIGNAL(snippetsAvailable()),
+            this, SLOT(snippetThreadSnippetsAvailable()));
+    snippetThread->start();
+}
+
+void NotesSearchResultsModel::clearSnippets()
+{
+    snippets.clear();
+}
+
+void NotesSearchResultsModel::cancelSnippetThread()
+{
+    if (snippetThread == NULL)
+        return;
+    snippetThread->cancel();
+    // deleteLater() so that an already queued signal can be told apart
+    // from the thread of a later search:
+    snippetThread->deleteLater();
+    snippetThread = NULL;
+}
+
+void NotesSearchResultsModel::snippetThreadSnippetsAvailable()
+{
+    if (snippetThread == NULL || sender() != snippetThread)
+        return;
+    snippets.insert(snippetThread->takeSnippets());
+    if (!hits.isEmpty())
+        emit dataChanged(index(0), index(hits.count() - 1));
+}
+
+NotesTextSearchHit NotesSearchResultsModel::hitAtRow(int row)
+{
+    if (row < 0 || hits.count() <= row)
+    {
+        NotesTextSearchHit none;
+        none.position = none.length = none.matchCount = 0;
+        none.byteOffset = 0;
+        none.score = 0;
+        return none;
+    }
+    return hits.at(row);
+}
+
+int NotesSearchResultsModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return hits.count();
+}
+
+QVariant NotesSearchResultsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || hits.count() <= index.row())
+        return QVariant();
+    const NotesTextSearchHit &hit = hits.at(index.row());
+    if (role == Qt::ToolTipRole)
+        return hit.filePath;
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    // (An empty second line until the snippet has been read, so that
+    // the rows don't change height)
+    QFileInfo fileInfo(hit.filePath);
+    return tr("%1  —  %2 (%n matches)", "", hit.matchCount)
+           .arg(fileInfo.fileName()).arg(fileInfo.path())
+           + "\n" + snippets.value(NotesSnippetThread::snippetKey(hit));
+}
+
+
+NotesSearchDialog::NotesSearchDialog(NotesTextIndex *anIndex, QWidget *parent) :
+    QDialog(parent)
+{
+    index = anIndex;
+    setWindowTitle(tr("Search in Notes Folder"));
+    resize(700, 450);
+
+    lineEdit = new QLineEdit(this);
+    lineEdit->setPlaceholderText(tr("Words to search for"));
+    listView = new QListView(this);
+    listView->setUniformItemSizes(true);
+    listView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    statusLabel = new QLabel(this);
+    QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Open
+                                                       | QDialogButtonBox::Cancel, this);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(lineEdit);
+    layout->addWidget(listView);
+    layout->addWidget(statusLabel);
+    layout->addWidget(buttonBox);
+
+    resultsModel = new NotesSearchResultsModel(this);
+    listView->setModel(resultsModel);
+
+    connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
+    connect(buttonBox, SIGNAL(rejected()), this, SLOT(reject()));
+    connect(lineEdit, SIGNAL(textChanged(QString)), this, SLOT(inputTextEdited(QString)));
+    connect(listView, SIGNAL(activated(QModelIndex)), this, SLOT(accept()));
+    connect(index, SIGNAL(indexUpdated()), this, SLOT(indexUpdated()));
+    lineEdit->installEventFilter(this);
+}
+
+void NotesSearchDialog::reset()
+{
+    lineEdit->selectAll();
+    lineEdit->setFocus();
+    updateSearchResults();
+}
+
+void NotesSearchDialog::updateSearchResults()
+{
+    QString query = lineEdit->text();
+    QElapsedTimer timer;
+    timer.start();
+    QList<NotesTextSearchHit> hits = index->search(query, kMaxResults);
+    qint64 elapsed = timer.elapsed();
+    resultsModel->setHits(hits);
+    if (!hits.isEmpty())
+        listView->setCurrentIndex(resultsModel->index(0, 0));
+
+    if (!index->isReady())
+        statusLabel->setText(tr("Indexing the notes folder…"));
+    else if (query.trimmed().isEmpty())
+        statusLabel->setText(index->isUpdating() ? tr("Updating the index…") : QString());
+    else
+    {
+        QString status = (hits.count() < kMaxResults)
+                         ? tr("%n matching files", "", hits.count())
+                         : tr("Best %n matching files", "", hits.count());
+        status += tr(" (%1 ms)").arg(elapsed);
+        if (index->isUpdating())
+            status += tr(" — updating the index…");
+        statusLabel->setText(status);
+    }
+}
+
+void NotesSearchDialog::inputTextEdited(QString newText)
+{
+    Q_UNUSED(newText);
+    updateSearchResults();
+}
+
+void NotesSearchDialog::indexUpdated()
+{
+    // Files may have changed, or the hits moved:
+    resultsModel->clearSnippets();
+    if (isVisible())
+        updateSearchResults();
+}
+
+void NotesSearchDialog::accept()
+{
+    if (0 < resultsModel->rowCount())
+    {
+        QModelIndex current = listView->currentIndex();
+        NotesTextSearchHit hit = resultsModel->hitAtRow(current.isValid() ? current.row() : 0);
+        emit selectedHit(hit.filePath, hit.position, hit.length);
+    }
+    QDialog::accept();
+}
+
+bool NotesSearchDialog::eventFilter(QObject* obj, QEvent *event)
+{
+    if (obj != lineEdit || event->type() != QEvent::KeyPress)
+        return QDialog::eventFilter(obj, event);
+
+    // Let the arrow keys move in the results while typing:
+    QKeyEvent* keyEvent = static_cast<QKeyEvent*>(event);
+    if (keyEvent->key() == Qt::Key_Down || keyEvent->key() == Qt::Key_Up
+        || keyEvent->key() == Qt::Key_PageDown || keyEvent->key() == Qt::Key_PageUp)
+    {
+        QCoreApplication::sendEvent(listView, event);
+        return true;
+    }
+    if (keyEvent->key() == Qt::Key_Return || keyEvent->key() == Qt::Key_Enter)
+    {
+        accept();
+        return true;
+    }
+    return false;
+}
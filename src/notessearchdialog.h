@@ -0,0 +1,106 @@
+#ifndef NOTESSEARCHDIALOG_H
+#define NOTESSEARCHDIALOG_H
+
+#include <QtWidgets/QDialog>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QListView>
+#include <QtWidgets/QLabel>
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtGui/QKeyEvent>
+#include "notestextindex.h"
+
+/** @brief Reads the snippets of search hits on a background thread,
+  * delivering them in batches as it goes.
+  */
+class NotesSnippetThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit NotesSnippetThread(QList<NotesTextSearchHit> hits, QObject *parent = 0);
+    ~NotesSnippetThread();
+    void cancel();
+
+    /** @brief The snippets read since the previous call, by
+      * snippetKey(). */
+    QHash<QString, QString> takeSnippets();
+
+    /** @brief Identifies the snippet of a hit (the same file and
+      * position tend to come up again while the query is typed). */
+    static QString snippetKey(const NotesTextSearchHit &hit);
+
+signals:
+    /** @brief Emitted when snippets are waiting to be taken (but not
+      * again until they have been). */
+    void snippetsAvailable();
+
+protected:
+    void run();
+
+private:
+    QList<NotesTextSearchHit> hits;
+    QMutex mutex;
+    QHash<QString, QString> pendingSnippets;
+    bool notified;
+};
+
+/** @brief List model of full-text search hits. The snippets are read
+  * on a background thread and shown as they come in; they are kept
+  * from one search to the next until the index changes.
+  */
+class NotesSearchResultsModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit NotesSearchResultsModel(QObject *parent = 0);
+    ~NotesSearchResultsModel();
+
+    void setHits(QList<NotesTextSearchHit> hits);
+    NotesTextSearchHit hitAtRow(int row);
+    /** @brief Forget the snippets read so far (e.g. as the files may
+      * have changed). */
+    void clearSnippets();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+private slots:
+    void snippetThreadSnippetsAvailable();
+
+private:
+    QList<NotesTextSearchHit> hits;
+    QHash<QString, QString> snippets;
+    NotesSnippetThread *snippetThread;
+    void cancelSnippetThread();
+};
+
+class NotesSearchDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit NotesSearchDialog(NotesTextIndex *index, QWidget *parent = 0);
+
+    void reset();
+    bool eventFilter(QObject* obj, QEvent *event);
+
+private:
+    NotesTextIndex *index;
+    QLineEdit *lineEdit;
+    QListView *listView;
+    QLabel *statusLabel;
+    NotesSearchResultsModel *resultsModel;
+    void updateSearchResults();
+
+private slots:
+    void inputTextEdited(QString newText);
+    void indexUpdated();
+    void accept();
+
+signals:
+    void selectedHit(QString filePath, int position, int length);
+
+};
+
+#endif // NOTESSEARCHDIALOG_H
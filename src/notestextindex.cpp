@@ -0,0 +1,902 @@
+#include "notestextindex.h"
+#include "fileloader.h"
+#include "logger.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDateTime>
+#include <QtCore/QDataStream>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QStringDecoder>
+
+#include <algorithm>
+#include <cmath>
+
+#define kIndexFileMagic 0x514b5433 // "QKT3"
+#define kDataStreamVersion QDataStream::Qt_6_0
+#define kIndexFilePrefix "index-"
+#define kIndexFileSuffix ".dat"
+
+// Shorter words aren't worth indexing, and longer ones are most likely
+// not words at all (base64 data etc.):
+#define kMinWordLength 2
+#define kMaxWordLength 64
+
+// BM25 ranking parameters
+#define kTermFrequencySaturation 1.2
+#define kLengthNormalization 0.75
+
+#define kSnippetContextChars 60
+// The most bytes a character can take in UTF-8 (as a UTF-16 code unit):
+#define kMaxUtf8BytesPerChar 3
+
+
+static inline bool readVarint(const uchar *&p, const uchar *end, quint32 *value)
+{
+    quint32 result = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (end <= p)
+            return false;
+        uchar byte = *p++;
+        result |= ((quint32)(byte & 0x7f)) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+NotesTextPostingsIterator::NotesTextPostingsIterator(const QByteArray &postings)
+{
+    data = postings;
+    p = (const uchar *)data.constData();
+    end = p + data.size();
+    positions = NULL;
+    positionsLength = 0;
+    _fileIndex = -1;
+    _count = 0;
+    _firstByteOffset = 0;
+}
+
+bool NotesTextPostingsIterator::next()
+{
+    quint32 fileIndex = 0;
+    quint32 count = 0;
+    quint32 firstByteOffset = 0;
+    quint32 length = 0;
+    if (!readVarint(p, end, &fileIndex)
+        || !readVarint(p, end, &count)
+        || !readVarint(p, end, &firstByteOffset)
+        || !readVarint(p, end, &length)
+        || (quint32)(end - p) < length)
+    {
+        p = end;
+        return false;
+    }
+    positions = p;
+    positionsLength = length;
+    p += length;
+    _fileIndex = fileIndex;
+    _count = count;
+    _firstByteOffset = firstByteOffset;
+    return true;
+}
+
+int NotesTextPostingsIterator::fileIndex()
+{
+    return _fileIndex;
+}
+int NotesTextPostingsIterator::count()
+{
+    return _count;
+}
+
+int NotesTextPostingsIterator::firstPosition()
+{
+    const uchar *q = positions;
+    quint32 position = 0;
+    readVarint(q, positions + positionsLength, &position);
+    return position;
+}
+
+quint32 NotesTextPostingsIterator::firstByteOffset()
+{
+    return _firstByteOffset;
+}
+
+QByteArray NotesTextPostingsIterator::encodedPositions()
+{
+    return QByteArray((const char *)positions, positionsLength);
+}
+
+void NotesTextPostingsIterator::appendVarint(QByteArray *bytes, quint32 value)
+{
+    while (0x80 <= value)
+    {
+        bytes->append((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    bytes->append((char)value);
+}
+
+void NotesTextPostingsIterator::appendEntry(QByteArray *postings, int fileIndex, int count,
+                                            quint32 firstByteOffset,
+                                            const QByteArray &encodedPositions)
+{
+    appendVarint(postings, fileIndex);
+    appendVarint(postings, count);
+    appendVarint(postings, firstByteOffset);
+    appendVarint(postings, encodedPositions.size());
+    postings->append(encodedPositions);
+}
+
+
+NotesTextIndexReader::NotesTextIndexReader()
+{
+    _generation = 0;
+    postingsData = NULL;
+    postingsSize = 0;
+    _averageWordCount = 0;
+    removeFile = false;
+}
+
+NotesTextIndexReader::~NotesTextIndexReader()
+{
+    if (postingsData != NULL)
+        file.unmap((uchar *)postingsData);
+    file.close();
+    if (removeFile)
+        file.remove();
+}
+
+bool NotesTextIndexReader::open(QString indexFilePath)
+{
+    file.setFileName(indexFilePath);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(kDataStreamVersion);
+    quint32 magic = 0;
+    qint32 fileCount = 0;
+    stream >> magic >> fileCount;
+    if (stream.status() != QDataStream::Ok || magic != kIndexFileMagic || fileCount < 0)
+        return false;
+
+    qint64 totalWordCount = 0;
+    _files.resize(fileCount);
+    for (int i = 0; i < fileCount; i++)
+    {
+        NotesTextIndexFile &indexFile = _files[i];
+        stream >> indexFile.path >> indexFile.lastModified >> indexFile.size >> indexFile.wordCount;
+        totalWordCount += indexFile.wordCount;
+    }
+
+    // The postings are followed by the dictionary:
+    qint64 dictionaryOffset = 0;
+    stream >> dictionaryOffset;
+    qint64 postingsStart = file.pos();
+    if (stream.status() != QDataStream::Ok || dictionaryOffset < postingsStart
+        || file.size() < dictionaryOffset || !file.seek(dictionaryOffset))
+        return false;
+
+    qint32 termCount = 0;
+    stream >> termCount;
+    if (stream.status() != QDataStream::Ok || termCount < 0)
+        return false;
+    _terms.reserve(termCount);
+    for (int i = 0; i < termCount; i++)
+    {
+        QByteArray word;
+        NotesTextIndexTerm term;
+        stream >> word >> term.offset >> term.length >> term.fileCount;
+        _terms.insert(word, term);
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    postingsSize = dictionaryOffset - postingsStart;
+    if (0 < postingsSize)
+    {
+        postingsData = file.map(postingsStart, postingsSize);
+        if (postingsData == NULL)
+            return false;
+    }
+
+    _generation = generationOfIndexFile(indexFilePath);
+    _averageWordCount = (0 < fileCount) ? (double)totalWordCount / fileCount : 0;
+    return true;
+}
+
+QString NotesTextIndexReader::indexFilePath() const
+{
+    return file.fileName();
+}
+int NotesTextIndexReader::generation() const
+{
+    return _generation;
+}
+const QVector<NotesTextIndexFile> &NotesTextIndexReader::files() const
+{
+    return _files;
+}
+const QHash<QByteArray, NotesTextIndexTerm> &NotesTextIndexReader::terms() const
+{
+    return _terms;
+}
+double NotesTextIndexReader::averageWordCount() const
+{
+    return _averageWordCount;
+}
+
+QByteArray NotesTextIndexReader::postings(const NotesTextIndexTerm &term) const
+{
+    if (postingsData == NULL || postingsSize < (qint64)(term.offset + term.length))
+        return QByteArray();
+    return QByteArray::fromRawData((const char *)postingsData + term.offset, term.length);
+}
+
+void NotesTextIndexReader::removeFileWhenClosed()
+{
+    removeFile = true;
+}
+
+int NotesTextIndexReader::generationOfIndexFile(QString indexFilePath)
+{
+    QString baseName = QFileInfo(indexFilePath).completeBaseName();
+    return baseName.mid(QString(kIndexFilePrefix).length()).toInt();
+}
+
+
+NotesTextIndexBuildThread::NotesTextIndexBuildThread(QString anIndexDirPath,
+                                                     NotesTextIndexReaderPointer aPreviousIndex,
+                                                     QStringList someFilePaths,
+                                                     bool update)
+{
+    indexDirPath = anIndexDirPath;
+    previousIndex = aPreviousIndex;
+    filePaths = someFilePaths;
+    shouldUpdate = update;
+}
+
+NotesTextIndexReaderPointer NotesTextIndexBuildThread::loadedIndex()
+{
+    return _loadedIndex;
+}
+NotesTextIndexReaderPointer NotesTextIndexBuildThread::index()
+{
+    return _index;
+}
+
+static bool generationGreaterThan(const QString &a, const QString &b)
+{
+    return NotesTextIndexReader::generationOfIndexFile(b)
+           < NotesTextIndexReader::generationOfIndexFile(a);
+}
+
+NotesTextIndexReaderPointer NotesTextIndexBuildThread::loadNewestIndexFile()
+{
+    QDir dir(indexDirPath);
+    QStringList fileNames = dir.entryList(QStringList(kIndexFilePrefix "*" kIndexFileSuffix),
+                                          QDir::Files);
+    std::sort(fileNames.begin(), fileNames.end(), generationGreaterThan);
+
+    // Older generations (left behind e.g. by a crash) and unreadable
+    // files are removed:
+    NotesTextIndexReaderPointer newest;
+    foreach (QString fileName, fileNames)
+    {
+        QString path = dir.absoluteFilePath(fileName);
+        NotesTextIndexReaderPointer reader(new NotesTextIndexReader());
+        if (newest.isNull() && reader->open(path))
+        {
+            newest = reader;
+            continue;
+        }
+        reader.clear();
+        Logger::debug("Removing stale notes full-text index: " + path);
+        QFile::remove(path);
+    }
+    return newest;
+}
+
+static bool termLessThan(const QByteArray &a, const QByteArray &b)
+{
+    return a < b;
+}
+
+bool NotesTextIndexBuildThread::writeIndexFile(QString path,
+                                               const QVector<NotesTextIndexFile> &files,
+                                               const QVector<int> &newFileIndexes,
+                                               const QHash<QByteArray, NotesTextTermPostings> &changedPostings)
+{
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(kDataStreamVersion);
+    stream << (quint32)kIndexFileMagic << (qint32)files.count();
+    foreach (const NotesTextIndexFile &indexFile, files)
+        stream << indexFile.path << indexFile.lastModified << indexFile.size << indexFile.wordCount;
+
+    // The length of a word's postings is only known once they have been
+    // merged, so the postings go first and the dictionary after them
+    // (where it starts is filled in at the end):
+    qint64 dictionaryOffsetPosition = file.pos();
+    stream << (qint64)0;
+    qint64 postingsStart = file.pos();
+
+    // The words of both sides in sorted order, merged one by one, so
+    // that only a single word's postings are in memory at a time (the
+    // previous index's ones are mapped). None of the previous words
+    // are needed if none of the files are kept:
+    QList<QByteArray> previousWords;
+    if (newFileIndexes.count(-1) < newFileIndexes.count())
+        previousWords = previousIndex->terms().keys();
+    QList<QByteArray> changedWords = changedPostings.keys();
+    std::sort(previousWords.begin(), previousWords.end(), termLessThan);
+    std::sort(changedWords.begin(), changedWords.end(), termLessThan);
+
+    QVector<QPair<QByteArray, NotesTextIndexTerm> > dictionary;
+    dictionary.reserve(qMax(previousWords.count(), changedWords.count()));
+    QByteArray termPostings;
+    quint64 offset = 0;
+    int p = 0;
+    int c = 0;
+    while (p < previousWords.count() || c < changedWords.count())
+    {
+        if (isInterruptionRequested())
+            return false;
+
+        QByteArray word;
+        bool inPrevious = false;
+        bool inChanged = false;
+        if (c == changedWords.count()
+            || (p < previousWords.count() && !(changedWords.at(c) < previousWords.at(p))))
+        {
+            word = previousWords.at(p++);
+            inPrevious = true;
+        }
+        if (c < changedWords.count() && (!inPrevious || changedWords.at(c) == word))
+        {
+            word = changedWords.at(c++);
+            inChanged = true;
+        }
+
+        // Unchanged files keep their relative order and go first, so
+        // their entries come first and stay sorted by file index:
+        termPostings.clear();
+        quint32 fileCount = 0;
+        if (inPrevious)
+        {
+            NotesTextPostingsIterator entries(previousIndex->postings(previousIndex->terms().value(word)));
+            while (entries.next())
+            {
+                int newFileIndex = newFileIndexes.value(entries.fileIndex(), -1);
+                if (newFileIndex == -1)
+                    continue;
+                NotesTextPostingsIterator::appendEntry(&termPostings, newFileIndex,
+                                                       entries.count(),
+                                                       entries.firstByteOffset(),
+                                                       entries.encodedPositions());
+                fileCount++;
+            }
+        }
+        if (inChanged)
+        {
+            const NotesTextTermPostings &changed = changedPostings[word];
+            termPostings.append(changed.postings);
+            fileCount += changed.fileCount;
+        }
+        if (fileCount == 0)
+            continue;
+
+        NotesTextIndexTerm term;
+        term.offset = offset;
+        term.length = termPostings.size();
+        term.fileCount = fileCount;
+        dictionary.append(qMakePair(word, term));
+        stream.writeRawData(termPostings.constData(), termPostings.size());
+        offset += termPostings.size();
+    }
+
+    qint64 dictionaryOffset = postingsStart + offset;
+    stream << (qint32)dictionary.count();
+    for (int i = 0; i < dictionary.count(); i++)
+    {
+        const NotesTextIndexTerm &term = dictionary.at(i).second;
+        stream << dictionary.at(i).first << term.offset << term.length << term.fileCount;
+    }
+    if (stream.status() != QDataStream::Ok || !file.seek(dictionaryOffsetPosition))
+        return false;
+    stream << dictionaryOffset;
+
+    return stream.status() == QDataStream::Ok && file.commit();
+}
+
+struct WordOccurrences
+{
+    WordOccurrences() : count(0), lastPosition(0), firstByteOffset(0) {}
+    int count;
+    int lastPosition;
+    quint32 firstByteOffset;
+    QByteArray encodedPositions;
+};
+
+// Finds the byte offsets in a file of positions in its
+// DecodedTextFile::text(), which must be asked for in ascending order.
+// (Exact unless the file contains invalid UTF-8; a snippet is all that
+// is read from there anyway.)
+class Utf8OffsetWalker
+{
+public:
+    Utf8OffsetWalker(const QString &aText, const QByteArray &aUtf8) :
+        text(aText), utf8(aUtf8), position(0), byteOffset(0) {}
+
+    quint32 byteOffsetOf(int targetPosition)
+    {
+        const QChar *chars = text.constData();
+        int length = text.length();
+        while (position < targetPosition && position < length)
+        {
+            ushort c = chars[position].unicode();
+            // (DecodedTextFile turns CRLFs into LFs)
+            if (c == '\n' && byteOffset < utf8.size() && utf8.at(byteOffset) == '\r')
+                byteOffset += 2;
+            else if (c < 0x80)
+                byteOffset += 1;
+            else if (c < 0x800)
+                byteOffset += 2;
+            else if (QChar::isHighSurrogate(c))
+            {
+                byteOffset += 4;
+                position++;
+            }
+            else
+                byteOffset += 3;
+            position++;
+        }
+        return byteOffset;
+    }
+
+private:
+    const QString &text;
+    const QByteArray &utf8;
+    int position;
+    int byteOffset;
+};
+
+void NotesTextIndexBuildThread::run()
+{
+    if (previousIndex.isNull())
+    {
+        previousIndex = loadNewestIndexFile();
+        if (!previousIndex.isNull())
+        {
+            _loadedIndex = previousIndex;
+            emit indexFileLoaded();
+        }
+    }
+    if (!shouldUpdate)
+        return;
+
+    QHash<QString, int> previousFileIndexes;
+    int previousFileCount = 0;
+    if (!previousIndex.isNull())
+    {
+        previousFileCount = previousIndex->files().count();
+        previousFileIndexes.reserve(previousFileCount);
+        for (int i = 0; i < previousFileCount; i++)
+            previousFileIndexes.insert(previousIndex->files().at(i).path, i);
+    }
+
+    // Only files that have been added or modified are read:
+    QVector<bool> unchanged(previousFileCount, false);
+    int unchangedCount = 0;
+    QVector<NotesTextIndexFile> changedFiles;
+    foreach (QString path, filePaths)
+    {
+        if (isInterruptionRequested())
+            return;
+        QFileInfo fileInfo(path);
+        if (!fileInfo.isFile())
+            continue;
+        NotesTextIndexFile indexFile;
+        indexFile.path = path;
+        indexFile.lastModified = fileInfo.lastModified().toMSecsSinceEpoch();
+        indexFile.size = fileInfo.size();
+        indexFile.wordCount = 0;
+
+        int previous = previousFileIndexes.value(path, -1);
+        if (previous != -1
+            && previousIndex->files().at(previous).lastModified == indexFile.lastModified
+            && previousIndex->files().at(previous).size == indexFile.size)
+        {
+            if (!unchanged.at(previous))
+                unchangedCount++;
+            unchanged[previous] = true;
+        }
+        else
+            changedFiles.append(indexFile);
+    }
+
+    if (!previousIndex.isNull() && changedFiles.isEmpty() && unchangedCount == previousFileCount)
+        return; // already up to date
+
+    // Unchanged files keep their relative order (and thus the postings
+    // remain sorted by file index) and go first, followed by the
+    // changed ones:
+    QVector<NotesTextIndexFile> files;
+    QVector<int> newFileIndexes(previousFileCount, -1);
+    for (int i = 0; i < previousFileCount; i++)
+    {
+        if (!unchanged.at(i))
+            continue;
+        newFileIndexes[i] = files.count();
+        files.append(previousIndex->files().at(i));
+    }
+
+    QHash<QByteArray, NotesTextTermPostings> changedPostings;
+    foreach (NotesTextIndexFile indexFile, changedFiles)
+    {
+        if (isInterruptionRequested())
+            return;
+        DecodedTextFile textFile;
+        if (!textFile.open(indexFile.path))
+        {
+            Logger::debug("Cannot index " + indexFile.path + ": " + textFile.errorString());
+            continue;
+        }
+
+        QString text = textFile.text();
+        QByteArray utf8 = textFile.utf8();
+        Utf8OffsetWalker offsetWalker(text, utf8);
+        QList<NotesTextToken> tokens = NotesTextIndex::tokenize(text);
+        QHash<QString, WordOccurrences> words;
+        foreach (const NotesTextToken &token, tokens)
+        {
+            WordOccurrences &occurrences = words[token.word];
+            if (occurrences.count == 0)
+                occurrences.firstByteOffset = offsetWalker.byteOffsetOf(token.position);
+            NotesTextPostingsIterator::appendVarint(&occurrences.encodedPositions,
+                                                    token.position - occurrences.lastPosition);
+            occurrences.lastPosition = token.position;
+            occurrences.count++;
+        }
+
+        int fileIndex = files.count();
+        QHash<QString, WordOccurrences>::const_iterator i;
+        for (i = words.constBegin(); i != words.constEnd(); ++i)
+        {
+            NotesTextTermPostings &termPostings = changedPostings[i.key().toUtf8()];
+            NotesTextPostingsIterator::appendEntry(&termPostings.postings, fileIndex,
+                                                   i.value().count,
+                                                   i.value().firstByteOffset,
+                                                   i.value().encodedPositions);
+            termPostings.fileCount++;
+        }
+        indexFile.wordCount = tokens.count();
+        files.append(indexFile);
+    }
+
+    int generation = previousIndex.isNull() ? 1 : previousIndex->generation() + 1;
+    QString path = QDir(indexDirPath).absoluteFilePath(
+        QString(kIndexFilePrefix "%1" kIndexFileSuffix).arg(generation));
+    if (!writeIndexFile(path, files, newFileIndexes, changedPostings))
+    {
+        if (!isInterruptionRequested())
+            Logger::warning("Cannot write notes full-text index: " + path);
+        return;
+    }
+
+    NotesTextIndexReaderPointer newIndex(new NotesTextIndexReader());
+    if (!newIndex->open(path))
+    {
+        Logger::warning("Cannot read back notes full-text index: " + path);
+        return;
+    }
+    _index = newIndex;
+}
+
+
+NotesTextIndex::NotesTextIndex(QString anIndexDirPath, QObject *parent) :
+    QObject(parent)
+{
+    indexDirPath = anIndexDirPath;
+    buildThread = NULL;
+    updatePending = false;
+    QDir().mkpath(indexDirPath);
+
+    // The index from the previous run is usable while the file list is
+    // still being figured out:
+    startBuild(QStringList(), false);
+}
+
+NotesTextIndex::~NotesTextIndex()
+{
+    if (buildThread == NULL)
+        return;
+    buildThread->requestInterruption();
+    buildThread->wait();
+    delete buildThread;
+}
+
+bool NotesTextIndex::isReady()
+{
+    return !reader.isNull();
+}
+
+bool NotesTextIndex::isUpdating()
+{
+    return buildThread != NULL;
+}
+
+void NotesTextIndex::setFilePaths(QStringList filePaths)
+{
+    if (buildThread != NULL)
+    {
+        updatePending = true;
+        pendingFilePaths = filePaths;
+        return;
+    }
+    startBuild(filePaths, true);
+}
+
+void NotesTextIndex::startBuild(QStringList filePaths, bool shouldUpdate)
+{
+    updatePending = false;
+    pendingFilePaths.clear();
+    buildThread = new NotesTextIndexBuildThread(indexDirPath, reader, filePaths, shouldUpdate);
+    connect(buildThread, SIGNAL(indexFileLoaded()), this, SLOT(buildThreadLoadedIndexFile()));
+    connect(buildThread, SIGNAL(finished()), this, SLOT(buildThreadFinished()));
+    buildThread->start(QThread::LowPriority);
+}
+
+void NotesTextIndex::setReader(NotesTextIndexReaderPointer newReader)
+{
+    // The previous generation is deleted once the last search or build
+    // that uses it is done with it:
+    if (!reader.isNull() && reader != newReader)
+        reader->removeFileWhenClosed();
+    reader = newReader;
+}
+
+void NotesTextIndex::buildThreadLoadedIndexFile()
+{
+    if (buildThread == NULL || sender() != buildThread || !reader.isNull())
+        return;
+    setReader(buildThread->loadedIndex());
+    emit indexUpdated();
+}
+
+void NotesTextIndex::buildThreadFinished()
+{
+    if (buildThread == NULL || sender() != buildThread)
+        return;
+
+    NotesTextIndexBuildThread *thread = buildThread;
+    buildThread = NULL;
+    thread->deleteLater();
+
+    if (!thread->index().isNull())
+        setReader(thread->index());
+    emit indexUpdated();
+
+    if (updatePending)
+        startBuild(pendingFilePaths, true);
+}
+
+
+static inline bool isWordChar(QChar c)
+{
+    return c.isLetterOrNumber();
+}
+
+QList<NotesTextToken> NotesTextIndex::tokenize(const QString &text)
+{
+    QList<NotesTextToken> tokens;
+    const QChar *chars = text.constData();
+    int length = text.length();
+    int i = 0;
+    while (i < length)
+    {
+        if (!isWordChar(chars[i]))
+        {
+            i++;
+            continue;
+        }
+        int start = i;
+        while (i < length && isWordChar(chars[i]))
+            i++;
+        int wordLength = i - start;
+        if (wordLength < kMinWordLength || kMaxWordLength < wordLength)
+            continue;
+        NotesTextToken token;
+        token.word = text.mid(start, wordLength).toLower();
+        token.position = start;
+        token.length = wordLength;
+        tokens.append(token);
+    }
+    return tokens;
+}
+
+struct QueryTerm
+{
+    NotesTextIndexTerm term;
+    int length;
+};
+
+static bool queryTermLessThan(const QueryTerm &a, const QueryTerm &b)
+{
+    return a.term.fileCount < b.term.fileCount;
+}
+
+struct SearchCandidate
+{
+    int fileIndex;
+    int position;
+    quint32 byteOffset;
+    int length;
+    int matchCount;
+    double score;
+};
+
+static bool searchCandidateLessThan(const SearchCandidate &a, const SearchCandidate &b)
+{
+    if (a.score != b.score)
+        return b.score < a.score; // best first
+    return a.fileIndex < b.fileIndex;
+}
+
+QList<NotesTextSearchHit> NotesTextIndex::search(QString query, int maxResults)
+{
+    QList<NotesTextSearchHit> hits;
+    if (reader.isNull())
+        return hits;
+
+    QList<QueryTerm> terms;
+    QSet<QString> seenWords;
+    foreach (const NotesTextToken &token, tokenize(query))
+    {
+        if (seenWords.contains(token.word))
+            continue;
+        seenWords.insert(token.word);
+        QHash<QByteArray, NotesTextIndexTerm>::const_iterator found =
+            reader->terms().constFind(token.word.toUtf8());
+        if (found == reader->terms().constEnd())
+            return hits; // all of the words must be found
+        QueryTerm term;
+        term.term = found.value();
+        term.length = token.length;
+        terms.append(term);
+    }
+    if (terms.isEmpty())
+        return hits;
+
+    // Starting from the rarest word keeps the candidate set small, and
+    // its first occurrence is the most telling one to show:
+    std::sort(terms.begin(), terms.end(), queryTermLessThan);
+
+    const QVector<NotesTextIndexFile> &files = reader->files();
+    double fileCount = files.count();
+    double averageWordCount = qMax(1.0, reader->averageWordCount());
+
+    QVector<SearchCandidate> candidates;
+    for (int t = 0; t < terms.count(); t++)
+    {
+        const QueryTerm &term = terms.at(t);
+        double idf = std::log(1 + (fileCount - term.term.fileCount + 0.5)
+                                  / (term.term.fileCount + 0.5));
+
+        // Both lists are sorted by file index, so this is a merge:
+        QVector<SearchCandidate> remaining;
+        int c = 0;
+        NotesTextPostingsIterator entries(reader->postings(term.term));
+        while (entries.next())
+        {
+            int fileIndex = entries.fileIndex();
+            if (files.count() <= fileIndex)
+                break;
+
+            SearchCandidate candidate;
+            if (t == 0)
+            {
+                candidate.fileIndex = fileIndex;
+                candidate.position = entries.firstPosition();
+                candidate.byteOffset = entries.firstByteOffset();
+                candidate.length = term.length;
+                candidate.matchCount = 0;
+                candidate.score = 0;
+            }
+            else
+            {
+                while (c < candidates.count() && candidates.at(c).fileIndex < fileIndex)
+                    c++;
+                if (c == candidates.count())
+                    break;
+                if (candidates.at(c).fileIndex != fileIndex)
+                    continue;
+                candidate = candidates.at(c);
+            }
+
+            double frequency = entries.count();
+            double lengthNorm = kTermFrequencySaturation
+                                * (1 - kLengthNormalization
+                                   + kLengthNormalization * files.at(fileIndex).wordCount
+                                     / averageWordCount);
+            candidate.score += idf * frequency * (kTermFrequencySaturation + 1)
+                               / (frequency + lengthNorm);
+            candidate.matchCount += entries.count();
+            remaining.append(candidate);
+        }
+        candidates = remaining;
+        if (candidates.isEmpty())
+            return hits;
+    }
+
+    int resultCount = qMin(candidates.count(), maxResults);
+    std::partial_sort(candidates.begin(), candidates.begin() + resultCount, candidates.end(),
+                      searchCandidateLessThan);
+    for (int i = 0; i < resultCount; i++)
+    {
+        const SearchCandidate &candidate = candidates.at(i);
+        NotesTextSearchHit hit;
+        hit.filePath = files.at(candidate.fileIndex).path;
+        hit.position = candidate.position;
+        hit.byteOffset = candidate.byteOffset;
+        hit.length = candidate.length;
+        hit.matchCount = candidate.matchCount;
+        hit.score = candidate.score;
+        hits.append(hit);
+    }
+    return hits;
+}
+
+QString NotesTextIndex::snippet(const NotesTextSearchHit &hit)
+{
+    // Just the bytes that the context can come from are read:
+    QFile file(hit.filePath);
+    if (!file.open(QFile::ReadOnly))
+        return QString();
+    qint64 maxContextBytes = kSnippetContextChars * kMaxUtf8BytesPerChar;
+    qint64 start = qMax((qint64)0, hit.byteOffset - maxContextBytes);
+    qint64 end = hit.byteOffset + hit.length * kMaxUtf8BytesPerChar + maxContextBytes;
+    if (file.size() < hit.byteOffset + hit.length || !file.seek(start))
+        return QString(); // changed after it was indexed
+    QByteArray bytes = file.read(end - start);
+    int hitStart = hit.byteOffset - start;
+    if (bytes.size() < hitStart + hit.length)
+        return QString();
+
+    // Not starting in the middle of a UTF-8 sequence, and dropping one
+    // that is cut off at the end (which the stateful decoder holds back):
+    int first = 0;
+    while (first < hitStart && ((uchar)bytes.at(first) & 0xC0) == 0x80)
+        first++;
+    QString before = QString::fromUtf8(bytes.constData() + first, hitStart - first);
+    QStringDecoder decoder(QStringConverter::Utf8);
+    QString after = decoder.decode(QByteArrayView(bytes.constData() + hitStart,
+                                                  bytes.size() - hitStart));
+
+    // Don't cut words in half:
+    int beforeStart = qMax(0, before.length() - kSnippetContextChars);
+    while (0 < beforeStart && beforeStart < before.length()
+           && !before.at(beforeStart - 1).isSpace())
+        beforeStart++;
+    int afterEnd = qMin(after.length(), hit.length + kSnippetContextChars);
+    while (afterEnd < after.length() && hit.length < afterEnd && !after.at(afterEnd).isSpace())
+        afterEnd--;
+
+    QString snippet = (before.mid(beforeStart) + after.left(afterEnd)).simplified();
+    if (0 < start + first + beforeStart)
+        snippet.prepend(QString::fromUtf8("…"));
+    if (afterEnd < after.length() || start + bytes.size() < file.size())
+        snippet.append(QString::fromUtf8("…"));
+    return snippet;
+}
@@ -0,0 +1,225 @@
+#ifndef NOTESTEXTINDEX_H
+#define NOTESTEXTINDEX_H
+
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtCore/QStringList>
+#include <QtCore/QSharedPointer>
+
+/** @brief A file included in the full-text index. */
+struct NotesTextIndexFile
+{
+    QString path;
+    qint64 lastModified; // msecs since epoch
+    qint64 size;
+    quint32 wordCount;
+};
+
+/** @brief Where the postings of one word are in the index file. */
+struct NotesTextIndexTerm
+{
+    quint64 offset;
+    quint32 length;
+    quint32 fileCount; // in how many files the word occurs
+};
+
+/** @brief A word found by NotesTextIndex::tokenize(). */
+struct NotesTextToken
+{
+    QString word; // lowercase
+    int position;
+    int length;
+};
+
+struct NotesTextSearchHit
+{
+    QString filePath;
+    // The first occurrence of the rarest of the query words (in the
+    // file's text, and where it starts in the file's bytes):
+    int position;
+    qint64 byteOffset;
+    int length;
+    int matchCount;
+    double score;
+};
+
+/** @brief Walks through the postings of one word: the files that
+  * contain it (in ascending file index order) and the positions of the
+  * occurrences within each.
+  *
+  * Postings are varint-encoded: file index, occurrence count, byte
+  * offset of the first occurrence in the file (for reading snippets
+  * without decoding the whole file), byte length of the positions, and
+  * then the delta-encoded positions themselves -- so files that are of
+  * no interest can be skipped without decoding their positions.
+  */
+class NotesTextPostingsIterator
+{
+public:
+    explicit NotesTextPostingsIterator(const QByteArray &postings);
+
+    /** @brief Advance to the next file; false at the end. */
+    bool next();
+    int fileIndex();
+    int count();
+    int firstPosition();
+    quint32 firstByteOffset();
+    QByteArray encodedPositions();
+
+    static void appendVarint(QByteArray *bytes, quint32 value);
+    static void appendEntry(QByteArray *postings, int fileIndex, int count,
+                            quint32 firstByteOffset, const QByteArray &encodedPositions);
+
+private:
+    QByteArray data;
+    const uchar *p;
+    const uchar *end;
+    const uchar *positions;
+    quint32 positionsLength;
+    int _fileIndex;
+    int _count;
+    quint32 _firstByteOffset;
+};
+
+/** @brief Read-only access to one index file.
+  *
+  * The file consists of the file table, the postings and the word
+  * dictionary, in that order. The file table and the dictionary are read
+  * into memory and the postings are memory-mapped, so looking up a word
+  * costs one hash lookup. Can be used from several threads at once once
+  * opened.
+  */
+class NotesTextIndexReader
+{
+public:
+    NotesTextIndexReader();
+    ~NotesTextIndexReader();
+
+    bool open(QString indexFilePath);
+    QString indexFilePath() const;
+    int generation() const;
+    const QVector<NotesTextIndexFile> &files() const;
+    const QHash<QByteArray, NotesTextIndexTerm> &terms() const;
+    QByteArray postings(const NotesTextIndexTerm &term) const;
+    double averageWordCount() const;
+
+    /** @brief Delete the index file once this reader is destroyed (i.e.
+      * once nobody is using it anymore). */
+    void removeFileWhenClosed();
+
+    static int generationOfIndexFile(QString indexFilePath);
+
+private:
+    QFile file;
+    int _generation;
+    QVector<NotesTextIndexFile> _files;
+    QHash<QByteArray, NotesTextIndexTerm> _terms;
+    const uchar *postingsData;
+    qint64 postingsSize;
+    double _averageWordCount;
+    bool removeFile;
+};
+
+typedef QSharedPointer<NotesTextIndexReader> NotesTextIndexReaderPointer;
+
+/** @brief The postings of one word in the files that are being (re)indexed. */
+struct NotesTextTermPostings
+{
+    NotesTextTermPostings() : fileCount(0) {}
+    QByteArray postings;
+    quint32 fileCount;
+};
+
+/** @brief Brings the full-text index up to date with a list of files,
+  * re-reading only the files that have changed since the previous index
+  * was built, and writes it out as a new generation of the index file.
+  *
+  * Only the postings of the changed files are held in memory. They are
+  * merged word by word (in sorted order) with the previous index's
+  * mapped postings as the new file is written.
+  */
+class NotesTextIndexBuildThread : public QThread
+{
+    Q_OBJECT
+public:
+    /** @brief If previousIndex is null, the newest index file in
+      * indexDirPath is loaded first. Nothing is rebuilt unless
+      * shouldUpdate is true. */
+    NotesTextIndexBuildThread(QString indexDirPath,
+                              NotesTextIndexReaderPointer previousIndex,
+                              QStringList filePaths, bool shouldUpdate);
+
+    NotesTextIndexReaderPointer loadedIndex();
+    /** @brief The rebuilt index, or null if nothing had changed (or if
+      * it could not be written). */
+    NotesTextIndexReaderPointer index();
+
+signals:
+    void indexFileLoaded();
+
+protected:
+    void run();
+
+private:
+    QString indexDirPath;
+    NotesTextIndexReaderPointer previousIndex;
+    QStringList filePaths;
+    bool shouldUpdate;
+    NotesTextIndexReaderPointer _loadedIndex;
+    NotesTextIndexReaderPointer _index;
+
+    NotesTextIndexReaderPointer loadNewestIndexFile();
+    bool writeIndexFile(QString path, const QVector<NotesTextIndexFile> &files,
+                        const QVector<int> &newFileIndexes,
+                        const QHash<QByteArray, NotesTextTermPostings> &changedPostings);
+};
+
+/** @brief Full-text index of the Markdown files in the notes folder.
+  *
+  * An inverted index (word -> files and positions), kept on disk so
+  * that it is available right away at startup, and updated on a
+  * background thread whenever the list of files changes.
+  */
+class NotesTextIndex : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NotesTextIndex(QString indexDirPath, QObject *parent = 0);
+    ~NotesTextIndex();
+
+    /** @brief Update the index to cover exactly these files. */
+    void setFilePaths(QStringList filePaths);
+
+    bool isReady();
+    bool isUpdating();
+
+    /** @brief Files containing all of the words in query, best first. */
+    QList<NotesTextSearchHit> search(QString query, int maxResults);
+
+    static QList<NotesTextToken> tokenize(const QString &text);
+    /** @brief The text around a hit, on one line. Only a few hundred
+      * bytes around hit.byteOffset are read from the file. */
+    static QString snippet(const NotesTextSearchHit &hit);
+
+signals:
+    void indexUpdated();
+
+private slots:
+    void buildThreadLoadedIndexFile();
+    void buildThreadFinished();
+
+private:
+    QString indexDirPath;
+    NotesTextIndexReaderPointer reader;
+    NotesTextIndexBuildThread *buildThread;
+    bool updatePending;
+    QStringList pendingFilePaths;
+
+    void startBuild(QStringList filePaths, bool shouldUpdate);
+    void setReader(NotesTextIndexReaderPointer newReader);
+};
+
+#endif // NOTESTEXTINDEX_H
@@ -0,0 +1,220 @@
+#include "outlinepanel.h"
+
+#include <QtGui/QTextBlock>
+#include <QtGui/QFont>
+
+#include <algorithm>
+
+// How many spaces to indent each heading level by:
+#define kIndentPerLevel 3
+
+
+OutlineModel::OutlineModel(QObject *parent) :
+    QAbstractListModel(parent)
+{
+}
+
+QString OutlineModel::headingText(QString line)
+{
+    QString text = line.trimmed();
+    int start = 0;
+    while (start < text.length() && text.at(start) == '#')
+        start++;
+    int end = text.length();
+    if (0 < start)
+    {
+        // ATX headings may have closing #s too, but only after a space
+        // or tab (as in "# C#", the # is part of the text):
+        int closingStart = end;
+        while (start < closingStart && text.at(closingStart - 1) == '#')
+            closingStart--;
+        if (closingStart == start || text.at(closingStart - 1) == ' '
+            || text.at(closingStart - 1) == '\t')
+            end = closingStart;
+    }
+    return text.mid(start, end - start).trimmed();
+}
+
+static bool sameHeading(const OutlineHeading &heading, const OutlineHeading &other)
+{
+    return heading.level == other.level && heading.text == other.text;
+}
+
+void OutlineModel::update(QTextDocument *document,
+                          const QVector<MarkdownStructureElement> &structure)
+{
+    QVector<OutlineHeading> newHeadings;
+    for (int i = 0; i < structure.size(); i++)
+    {
+        const MarkdownStructureElement &element = structure.at(i);
+        if (element.kind != MarkdownStructureElement::Heading)
+            continue;
+        OutlineHeading heading;
+        heading.level = element.headingLevel;
+        heading.position = element.position;
+        // (The first line of a setext heading is the text itself.)
+        heading.text = headingText(document->findBlock(element.position).text());
+        newHeadings.append(heading);
+    }
+
+    int oldCount = headings.size();
+    int newCount = newHeadings.size();
+    int prefix = 0;
+    while (prefix < oldCount && prefix < newCount
+           && sameHeading(headings.at(prefix), newHeadings.at(prefix)))
+    {
+        headings[prefix].position = newHeadings.at(prefix).position;
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < oldCount - prefix && suffix < newCount - prefix
+           && sameHeading(headings.at(oldCount - 1 - suffix), newHeadings.at(newCount - 1 - suffix)))
+    {
+        headings[oldCount - 1 - suffix].position = newHeadings.at(newCount - 1 - suffix).position;
+        suffix++;
+    }
+
+    // The rows in between: replaced where there are both old and new
+    // ones, and then inserted or removed:
+    int oldChanged = oldCount - prefix - suffix;
+    int newChanged = newCount - prefix - suffix;
+    int replaced = qMin(oldChanged, newChanged);
+    for (int i = 0; i < replaced; i++)
+        headings[prefix + i] = newHeadings.at(prefix + i);
+    if (0 < replaced)
+        emit dataChanged(index(prefix), index(prefix + replaced - 1));
+
+    if (oldChanged < newChanged)
+    {
+        int first = prefix + replaced;
+        beginInsertRows(QModelIndex(), first, prefix + newChanged - 1);
+        headings.insert(first, newChanged - oldChanged, OutlineHeading());
+        for (int i = first; i < prefix + newChanged; i++)
+            headings[i] = newHeadings.at(i);
+        endInsertRows();
+    }
+    else if (newChanged < oldChanged)
+    {
+        int first = prefix + replaced;
+        beginRemoveRows(QModelIndex(), first, prefix + oldChanged - 1);
+        headings.remove(first, oldChanged - newChanged);
+        endRemoveRows();
+    }
+}
+
+OutlineHeading OutlineModel::headingAtRow(int row)
+{
+    if (row < 0 || headings.size() <= row)
+    {
+        OutlineHeading none;
+        none.level = 0;
+        none.position = -1;
+        return none;
+    }
+    return headings.at(row);
+}
+
+static bool positionBeforeHeading(int position, const OutlineHeading &heading)
+{
+    return position < heading.position;
+}
+
+static bool headingBeforePosition(const OutlineHeading &heading, int position)
+{
+    return heading.position < position;
+}
+
+void OutlineModel::adjustPositions(int position, int charsRemoved, int charsAdded)
+{
+    if (charsRemoved == 0 && charsAdded == 0)
+        return;
+    int delta = charsAdded - charsRemoved;
+    QVector<OutlineHeading>::iterator it = std::lower_bound(headings.begin(), headings.end(),
+                                                            position, headingBeforePosition);
+    int changeEnd = position + charsRemoved;
+    for (; it != headings.end(); ++it)
+    {
+        // (A heading whose start was removed is wherever the edit was,
+        // until the next parse tells where it really is.)
+        if (it->position < changeEnd)
+            it->position = position;
+        else
+            it->position += delta;
+    }
+}
+
+int OutlineModel::rowForPosition(int position)
+{
+    QVector<OutlineHeading>::const_iterator it = std::upper_bound(headings.constBegin(),
+                                                                  headings.constEnd(),
+                                                                  position, positionBeforeHeading);
+    return (it - headings.constBegin()) - 1;
+}
+
+int OutlineModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return headings.size();
+}
+
+QVariant OutlineModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || headings.size() <= index.row())
+        return QVariant();
+    const OutlineHeading &heading = headings.at(index.row());
+    if (role == Qt::DisplayRole)
+        return QString(kIndentPerLevel * (heading.level - 1), ' ') + heading.text;
+    if (role == Qt::FontRole && heading.level == 1)
+    {
+        QFont font;
+        font.setBold(true);
+        return font;
+    }
+    return QVariant();
+}
+
+
+OutlinePanel::OutlinePanel(QWidget *parent) :
+    QDockWidget(tr("Outline"), parent)
+{
+    setObjectName("outlinePanel");
+    outlineModel = new OutlineModel(this);
+    listView = new QListView(this);
+    // Lets the view skip measuring every row (there can be thousands):
+    listView->setUniformItemSizes(true);
+    listView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    listView->setModel(outlineModel);
+    setWidget(listView);
+
+    connect(listView, SIGNAL(activated(QModelIndex)),
+            this, SLOT(rowActivated(QModelIndex)));
+    connect(listView, SIGNAL(clicked(QModelIndex)),
+            this, SLOT(rowActivated(QModelIndex)));
+}
+
+OutlineModel *OutlinePanel::model()
+{
+    return outlineModel;
+}
+
+void OutlinePanel::selectHeadingAt(int position)
+{
+    int row = outlineModel->rowForPosition(position);
+    if (row < 0)
+    {
+        listView->clearSelection();
+        return;
+    }
+    QModelIndex index = outlineModel->index(row);
+    listView->setCurrentIndex(index);
+    listView->scrollTo(index);
+}
+
+void OutlinePanel::rowActivated(const QModelIndex &index)
+{
+    OutlineHeading heading = outlineModel->headingAtRow(index.row());
+    if (heading.position < 0)
+        return;
+    emit headingActivated(heading.position);
+}
@@ -0,0 +1,79 @@
+#ifndef OUTLINEPANEL_H
+#define OUTLINEPANEL_H
+
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QVector>
+#include <QtGui/QTextDocument>
+#include <QtWidgets/QDockWidget>
+#include <QtWidgets/QListView>
+
+#include "editor/blockdata.h"
+
+/** @brief A heading of the document, as listed in the outline. */
+struct OutlineHeading
+{
+    int level;
+    QString text;
+    // Where the heading starts (as of the latest parse, moved along with
+    // the edits since):
+    int position;
+};
+
+/** @brief List model of the document's headings.
+  *
+  * Updating compares the new headings against the current ones and only
+  * replaces, inserts or removes the rows in between the unchanged ones
+  * at the start and the end, so that editing one section doesn't reset
+  * (and redraw) the whole list. Positions are not displayed, so headings
+  * that just moved are updated silently.
+  */
+class OutlineModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit OutlineModel(QObject *parent = 0);
+
+    void update(QTextDocument *document, const QVector<MarkdownStructureElement> &structure);
+    OutlineHeading headingAtRow(int row);
+    /** @brief The row of the last heading at or before position, or -1. */
+    int rowForPosition(int position);
+    /** @brief Move the headings' positions along with a change to the
+      * document (see QTextDocument::contentsChange()), until the next
+      * update(). */
+    void adjustPositions(int position, int charsRemoved, int charsAdded);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+    /** @brief The text of a heading line, without the ATX #s (closing
+      * ones only if they follow a space or tab, as in CommonMark). */
+    static QString headingText(QString line);
+
+private:
+    QVector<OutlineHeading> headings;
+};
+
+/** @brief Dock listing the headings of the document; activating one
+  * jumps to it. */
+class OutlinePanel : public QDockWidget
+{
+    Q_OBJECT
+public:
+    explicit OutlinePanel(QWidget *parent = 0);
+
+    OutlineModel *model();
+    /** @brief Select the heading of the section that position is in. */
+    void selectHeadingAt(int position);
+
+signals:
+    void headingActivated(int position);
+
+private slots:
+    void rowActivated(const QModelIndex &index);
+
+private:
+    QListView *listView;
+    OutlineModel *outlineModel;
+};
+
+#endif // OUTLINEPANEL_H
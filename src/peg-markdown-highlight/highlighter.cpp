@@ -2,30 +2,62 @@
 #include "highlighter.h"
 #include "logger.h"
 
+#include <algorithm>
+
 extern "C" {
 #include "pmh_styleparser.h"
 }
 
 
-// Convert unicode code point offsets (this is what we get from the parser) to
-// QString character offsets (QString uses UTF-16 units as characters, so
-// sometimes two characters (a "surrogate pair") are needed to represent one
-// code point):
-static void convertOffsets(pmh_element **elements, QString str)
+// Walk through the whole string only once, and gather all surrogate pair indexes
+// (technically, the indexes of the high characters (which come before the low
+// characters) in each pair):
+static QList<int> surrogatePairIndexes(QString str)
 {
-    // Walk through the whole string only once, and gather all surrogate pair indexes
-    // (technically, the indexes of the high characters (which come before the low
-    // characters) in each pair):
-    QList<int> surrogatePairIndexes;
+    QList<int> indexes;
     int strLen = str.length();
     int i = 0;
     while (i < strLen)
     {
         if (str.at(i).isHighSurrogate())
-            surrogatePairIndexes.append(i);
+            indexes.append(i);
         i++;
     }
+    return indexes;
+}
+
+// Same as above, but straight from UTF-8 bytes: only four-byte sequences
+// become surrogate pairs in UTF-16. A leading BOM is not part of the text.
+static QList<int> surrogatePairIndexes(const QByteArray &utf8)
+{
+    QList<int> indexes;
+    const unsigned char *c = (const unsigned char *)utf8.constData();
+    const unsigned char *end = c + utf8.size();
+    if (3 <= utf8.size() && c[0] == 0xEF && c[1] == 0xBB && c[2] == 0xBF)
+        c += 3;
+    int utf16Index = 0;
+    while (c < end)
+    {
+        if ((*c & 0xC0) != 0x80) // not a continuation byte
+        {
+            if (0xF0 <= *c)
+            {
+                indexes.append(utf16Index);
+                utf16Index++;
+            }
+            utf16Index++;
+        }
+        c++;
+    }
+    return indexes;
+}
 
+// Convert unicode code point offsets (this is what we get from the parser) to
+// QString character offsets (QString uses UTF-16 units as characters, so
+// sometimes two characters (a "surrogate pair") are needed to represent one
+// code point):
+static void convertOffsets(pmh_element **elements, QList<int> surrogatePairIndexes)
+{
     // If the text does not contain any surrogate pairs, we're done (the indexes
     // are already correct):
     if (surrogatePairIndexes.length() == 0)
@@ -73,12 +105,24 @@ WorkerThread::~WorkerThread()
 }
 void WorkerThread::run()
 {
+    if (!utf8Content.isNull())
+    {
+        // The parser does not modify its input, so the bytes can be
+        // handed over as they are:
+        pmh_markdown_to_elements_with_length((char *)utf8Content.constData(),
+                                             utf8Content.size(),
+                                             pmh_EXT_NONE, &result);
+        convertOffsets(result, surrogatePairIndexes(utf8Content));
+        utf8Content = QByteArray();
+        return;
+    }
+
     if (content.isNull())
         return;
     QByteArray ba = content.toUtf8();
-    char *content_cstring = strdup((char *)ba.data());
-    pmh_markdown_to_elements(content_cstring, pmh_EXT_NONE, &result);
-    convertOffsets(result, content);
+    pmh_markdown_to_elements_with_length(ba.data(), ba.size(),
+                                         pmh_EXT_NONE, &result);
+    convertOffsets(result, surrogatePairIndexes(content));
 }
 
 
@@ -90,7 +134,10 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(QTextDocument *parent,
     highlightingStyles = NULL;
     workerThread = NULL;
     cached_elements = NULL;
+    scheduler = NULL;
     _makeLinksClickable = false;
+    _suspended = false;
+    parsePending = false;
     styleParsingErrorList = new QList<QPair<int, QString> >();
     _waitIntervalMilliseconds = (int)(aWaitInterval*1000);
     timer = new QTimer(this);
@@ -105,10 +152,26 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(QTextDocument *parent,
 
 HGMarkdownHighlighter::~HGMarkdownHighlighter()
 {
+    if (scheduler != NULL)
+        scheduler->remove(this);
+    if (workerThread != NULL)
+    {
+        // (Highlighters of closed documents may be deleted mid-parse)
+        workerThread->disconnect(this);
+        workerThread->wait();
+        delete workerThread;
+    }
+    if (cached_elements != NULL)
+        pmh_free_elements(cached_elements);
     delete styleParsingErrorList;
     delete timer;
 }
 
+void HGMarkdownHighlighter::setParseScheduler(ParseScheduler *aScheduler)
+{
+    scheduler = aScheduler;
+}
+
 void HGMarkdownHighlighter::setStyles(QVector<HighlightingStyle> &styles)
 {
     this->highlightingStyles = &styles;
@@ -133,6 +196,27 @@ void HGMarkdownHighlighter::setMakeLinksClickable(bool value)
     _makeLinksClickable = value;
 }
 
+bool HGMarkdownHighlighter::suspended()
+{
+    return _suspended;
+}
+void HGMarkdownHighlighter::setSuspended(bool value)
+{
+    if (_suspended == value)
+        return;
+    _suspended = value;
+    if (_suspended)
+    {
+        timer->stop();
+        stopListeningForContentChanged();
+    }
+    else
+    {
+        beginListeningForContentChanged();
+        parse();
+    }
+}
+
 
 void HGMarkdownHighlighter::beginListeningForContentChanged()
 {
@@ -422,6 +506,9 @@ void HGMarkdownHighlighter::clearFormatting()
     while (block.isValid())
     {
         block.layout()->clearFormats();
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+        if (data != NULL)
+            data->links.clear();
         block = block.next();
     }
 }
@@ -445,6 +532,9 @@ void HGMarkdownHighlighter::highlight()
     // but it's probably too slow.
     unsigned long max_offset = document->characterCount() - 1;
 
+    // Blocks with links, whose links need to be sorted in the end:
+    QList<QTextBlock> linkBlocks;
+
     for (int i = 0; i < highlightingStyles->size(); i++)
     {
         HighlightingStyle style = highlightingStyles->at(i);
@@ -481,6 +571,8 @@ void HGMarkdownHighlighter::highlight()
                 QTextLayout::FormatRange r;
                 r.format = style.format;
 
+                bool isLink = false;
+                QString address;
                 if (_makeLinksClickable
                     && (elem_cursor->type == pmh_LINK
                         || elem_cursor->type == pmh_AUTO_LINK_URL
@@ -488,7 +580,8 @@ void HGMarkdownHighlighter::highlight()
                         || elem_cursor->type == pmh_REFERENCE)
                     && elem_cursor->address != NULL)
                 {
-                    QString address(elem_cursor->address);
+                    isLink = true;
+                    address = QString(elem_cursor->address);
                     if (elem_cursor->type == pmh_AUTO_LINK_EMAIL && !address.startsWith("mailto:"))
                         address = "mailto:" + address;
                     QTextCharFormat linkFormat(r.format);
@@ -513,12 +606,26 @@ void HGMarkdownHighlighter::highlight()
 
                 list.append(r);
                 layout->setFormats(list);
+
+                // Also indexed for the editor, so that finding the link
+                // under the mouse doesn't mean going through all the
+                // formats of a block:
+                if (isLink)
+                {
+                    QarkdownBlockData *data = QarkdownBlockData::forBlock(block, true);
+                    if (data->links.isEmpty())
+                        linkBlocks.append(block);
+                    data->addLink(r.start, r.start + r.length, address, block.revision());
+                }
             }
 
             elem_cursor = elem_cursor->next;
         }
     }
 
+    foreach (QTextBlock block, linkBlocks)
+        QarkdownBlockData::forBlock(block, false)->sortLinks();
+
     document->markContentsDirty(0, document->characterCount());
 }
 
@@ -528,6 +635,9 @@ void HGMarkdownHighlighter::parse()
         parsePending = true;
         return;
     }
+    // If it has to wait, the scheduler calls this again later:
+    if (scheduler != NULL && !scheduler->requestParse(this))
+        return;
 
     if (workerThread != NULL)
         delete workerThread;
@@ -538,19 +648,149 @@ void HGMarkdownHighlighter::parse()
     workerThread->start();
 }
 
+void HGMarkdownHighlighter::parseUtf8(QByteArray utf8)
+{
+    if (workerThread != NULL && workerThread->isRunning()) {
+        parsePending = true;
+        return;
+    }
+
+    // This parse supersedes the one scheduled by the change that put
+    // this text into the document:
+    timer->stop();
+    if (scheduler != NULL && !scheduler->requestParse(this))
+        return;
+
+    if (workerThread != NULL)
+        delete workerThread;
+    workerThread = new WorkerThread();
+    workerThread->utf8Content = utf8;
+    connect(workerThread, SIGNAL(finished()), this, SLOT(threadFinished()));
+    parsePending = false;
+    workerThread->start();
+}
+
 void HGMarkdownHighlighter::threadFinished()
 {
+    if (scheduler != NULL)
+        scheduler->parseFinished(this);
+
     if (parsePending) {
         this->parse();
         return;
     }
 
+    // A parse that was started before suspending is out of date
+    if (_suspended)
+        return;
+
     if (cached_elements != NULL)
         pmh_free_elements(cached_elements);
     cached_elements = workerThread->result;
     workerThread->result = NULL;
 
     this->highlight();
+    this->updateStructure();
+}
+
+static bool structureElementPrecedes(const MarkdownStructureElement &element,
+                                     const MarkdownStructureElement &other)
+{
+    return element.position < other.position;
+}
+
+void HGMarkdownHighlighter::updateStructure()
+{
+    _structure.clear();
+    if (cached_elements == NULL)
+        return;
+
+    pmh_element_type types[] = { pmh_H1, pmh_H2, pmh_H3, pmh_H4, pmh_H5, pmh_H6,
+                                 pmh_BLOCKQUOTE, pmh_VERBATIM,
+                                 pmh_LIST_BULLET, pmh_LIST_ENUMERATOR,
+                                 pmh_LINK, pmh_AUTO_LINK_URL, pmh_AUTO_LINK_EMAIL };
+    for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        for (pmh_element *elem = cached_elements[types[i]]; elem != NULL; elem = elem->next)
+        {
+            if (elem->end <= elem->pos)
+                continue;
+            MarkdownStructureElement element;
+            element.position = elem->pos;
+            element.end = elem->end;
+            element.headingLevel = 0;
+            if (types[i] == pmh_BLOCKQUOTE)
+                element.kind = MarkdownStructureElement::BlockQuote;
+            else if (types[i] == pmh_VERBATIM)
+                element.kind = MarkdownStructureElement::CodeBlock;
+            else if (types[i] == pmh_LIST_BULLET || types[i] == pmh_LIST_ENUMERATOR)
+                element.kind = MarkdownStructureElement::ListItem;
+            else if (types[i] == pmh_LINK || types[i] == pmh_AUTO_LINK_URL
+                     || types[i] == pmh_AUTO_LINK_EMAIL)
+                element.kind = MarkdownStructureElement::Link;
+            else
+            {
+                element.kind = MarkdownStructureElement::Heading;
+                element.headingLevel = types[i] - pmh_H1 + 1;
+            }
+            _structure.append(element);
+        }
+    }
+    std::stable_sort(_structure.begin(), _structure.end(), structureElementPrecedes);
+    emit structureUpdated();
+}
+
+QVector<MarkdownStructureElement> HGMarkdownHighlighter::structure()
+{
+    return _structure;
+}
+
+qint64 HGMarkdownHighlighter::parseResultsBytes()
+{
+    if (cached_elements == NULL)
+        return 0;
+    qint64 count = 0;
+    for (int i = 0; i < pmh_NUM_LANG_TYPES; i++)
+    {
+        for (pmh_element *elem = cached_elements[i]; elem != NULL; elem = elem->next)
+            count++;
+    }
+    return count * sizeof(pmh_element)
+           + _structure.size() * sizeof(MarkdownStructureElement);
+}
+
+bool HGMarkdownHighlighter::hasParseResults()
+{
+    return cached_elements != NULL;
+}
+
+void HGMarkdownHighlighter::clearHighlighting()
+{
+    clearFormatting();
+    document->markContentsDirty(0, document->characterCount());
+}
+
+void HGMarkdownHighlighter::releaseParseResults()
+{
+    if (cached_elements != NULL)
+        pmh_free_elements(cached_elements);
+    cached_elements = NULL;
+    _structure.clear();
+    _structure.squeeze();
+    clearHighlighting();
+}
+
+QColor HGMarkdownHighlighter::styleColor(pmh_element_type type, QColor fallback)
+{
+    if (highlightingStyles == NULL)
+        return fallback;
+    for (int i = 0; i < highlightingStyles->size(); i++)
+    {
+        const HighlightingStyle &style = highlightingStyles->at(i);
+        if (style.type == type && style.format.hasProperty(QTextFormat::ForegroundBrush))
+            return style.format.foreground().color();
+    }
+    return fallback;
 }
 
 void HGMarkdownHighlighter::handleContentsChange(int position, int charsRemoved,
@@ -6,6 +6,9 @@
 #include <QtCore/QPair>
 #include <QtWidgets/QPlainTextEdit>
 
+#include "editor/blockdata.h"
+#include "parsescheduler.h"
+
 extern "C" {
 #include "pmh_parser.h"
 }
@@ -20,6 +23,9 @@ public:
     ~WorkerThread();
     void run();
     QString content;
+    // If set, parsed instead of content (which is then ignored). Must be
+    // UTF-8 that decodes to exactly the document's text.
+    QByteArray utf8Content;
     pmh_element **result;
 };
 
@@ -43,6 +49,14 @@ public:
     void highlightNow();
     void parseAndHighlightNow();
 
+    /** @brief Parse the given UTF-8 text instead of the document contents.
+      *
+      * Saves converting the document back to UTF-8 when the caller already
+      * has the bytes it was decoded from (e.g. right after opening a file).
+      * Falls back to a regular parse if one is already in progress.
+      */
+    void parseUtf8(QByteArray utf8);
+
     void setStyles(QVector<HighlightingStyle> &styles);
     bool getStylesFromStylesheet(QString filePath, QPlainTextEdit *editor);
 
@@ -51,12 +65,44 @@ public:
     bool makeLinksClickable();
     void setMakeLinksClickable(bool value);
 
+    /** @brief Whether reparsing upon content changes is suspended.
+      *
+      * Useful while the document is being filled in many steps (e.g. when
+      * loading a large file); resuming triggers a single reparse.
+      */
+    bool suspended();
+    void setSuspended(bool value);
+
     void handleStyleParsingError(char *error_message, int line_number);
 
     static QString availableFontFamilyFromPreferenceList(QString familyList);
 
+    /** @brief The headings, block quotes, code blocks, list items and
+      * links found by the latest parse, in document order. */
+    QVector<MarkdownStructureElement> structure();
+
+    /** @brief The text color of the current style for elements of type,
+      * or fallback if the style doesn't set one. */
+    QColor styleColor(pmh_element_type type, QColor fallback);
+
+    /** @brief Parse only when the scheduler (shared with the highlighters
+      * of other documents) says so. NULL parses whenever needed. */
+    void setParseScheduler(ParseScheduler *scheduler);
+
+    /** @brief Approximate memory used by the latest parse results. */
+    qint64 parseResultsBytes();
+    bool hasParseResults();
+    /** @brief Remove the highlighting formats from the document (they
+      * can be recreated from the parse results with highlightNow()). */
+    void clearHighlighting();
+    /** @brief Drop the parse results (and the highlighting made from
+      * them); the next parseAndHighlightNow() recreates them. */
+    void releaseParseResults();
+
 signals:
     void styleParsingErrors(QList<QPair<int, QString> > *errors);
+    /** @brief Emitted after each parse, once structure() is up to date. */
+    void structureUpdated();
 
 protected:
     void beginListeningForContentChanged();
@@ -69,6 +115,7 @@ private slots:
 
 private:
     bool _makeLinksClickable;
+    bool _suspended;
     int _waitIntervalMilliseconds;
     QTimer *timer;
     QTextDocument *document;
@@ -77,11 +124,14 @@ private:
     pmh_element **cached_elements;
     QVector<HighlightingStyle> *highlightingStyles;
     QString cachedContent;
+    QVector<MarkdownStructureElement> _structure;
+    ParseScheduler *scheduler;
 
     void clearFormatting();
     void highlight();
     void parse();
     void setDefaultStyles();
+    void updateStructure();
 
 };
 
@@ -0,0 +1,105 @@
+#include "parsescheduler.h"
+#include "highlighter.h"
+
+#include <QtCore/QThread>
+
+// Background documents wait this long after the latest background
+// request or parse before (another) one of them is parsed:
+#define kBackgroundParseDelayMilliseconds 500
+
+
+ParseScheduler::ParseScheduler(QObject *parent) :
+    QObject(parent)
+{
+    // One core is left for the UI:
+    maxParses = qMax(1, QThread::idealThreadCount() - 1);
+    active = NULL;
+    backgroundTimer = new QTimer(this);
+    backgroundTimer->setSingleShot(true);
+    backgroundTimer->setInterval(kBackgroundParseDelayMilliseconds);
+    connect(backgroundTimer, SIGNAL(timeout()), this, SLOT(startQueuedParses()));
+}
+
+ParseScheduler::~ParseScheduler()
+{
+}
+
+void ParseScheduler::setActiveHighlighter(HGMarkdownHighlighter *highlighter)
+{
+    active = highlighter;
+    startQueuedParses();
+}
+
+HGMarkdownHighlighter *ParseScheduler::activeHighlighter()
+{
+    return active;
+}
+
+bool ParseScheduler::backgroundParseRunning()
+{
+    foreach (HGMarkdownHighlighter *highlighter, running)
+    {
+        if (highlighter != active)
+            return true;
+    }
+    return false;
+}
+
+bool ParseScheduler::requestParse(HGMarkdownHighlighter *highlighter)
+{
+    // Granted by start(), below:
+    if (running.contains(highlighter))
+        return true;
+
+    if (highlighter == active && running.size() < maxParses)
+    {
+        running.append(highlighter);
+        return true;
+    }
+    if (!queued.contains(highlighter))
+        queued.append(highlighter);
+    if (highlighter != active)
+        backgroundTimer->start();
+    return false;
+}
+
+void ParseScheduler::parseFinished(HGMarkdownHighlighter *highlighter)
+{
+    running.removeAll(highlighter);
+    if (highlighter != active)
+        backgroundTimer->start();
+    startQueuedParses();
+}
+
+void ParseScheduler::remove(HGMarkdownHighlighter *highlighter)
+{
+    running.removeAll(highlighter);
+    queued.removeAll(highlighter);
+    if (active == highlighter)
+        active = NULL;
+}
+
+void ParseScheduler::start(HGMarkdownHighlighter *highlighter)
+{
+    queued.removeAll(highlighter);
+    running.append(highlighter);
+    highlighter->parseAndHighlightNow();
+}
+
+void ParseScheduler::startQueuedParses()
+{
+    if (active != NULL && queued.contains(active) && running.size() < maxParses)
+        start(active);
+
+    if (backgroundTimer->isActive() || backgroundParseRunning()
+        || maxParses <= running.size())
+        return;
+    foreach (HGMarkdownHighlighter *highlighter, queued)
+    {
+        if (highlighter != active)
+        {
+            start(highlighter);
+            break;
+        }
+    }
+}
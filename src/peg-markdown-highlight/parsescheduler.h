@@ -0,0 +1,50 @@
+#ifndef PARSESCHEDULER_H
+#define PARSESCHEDULER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QTimer>
+
+class HGMarkdownHighlighter;
+
+/** @brief Shares a limited number of parser threads among the
+  * highlighters of all the open documents.
+  *
+  * The active (visible) document's highlighter parses as soon as a
+  * thread is free. The others are throttled: they parse one at a time,
+  * and only after the scheduler has had no new background requests (or
+  * finished background parses) for a moment, so that e.g. restyling many
+  * open documents doesn't compete with typing in the visible one.
+  */
+class ParseScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ParseScheduler(QObject *parent = 0);
+    ~ParseScheduler();
+
+    void setActiveHighlighter(HGMarkdownHighlighter *highlighter);
+    HGMarkdownHighlighter *activeHighlighter();
+
+    /** @brief Whether highlighter may start parsing right away. If not,
+      * it is queued, and its parse is started once it may. */
+    bool requestParse(HGMarkdownHighlighter *highlighter);
+    void parseFinished(HGMarkdownHighlighter *highlighter);
+    /** @brief Forget about highlighter (e.g. as it is being deleted). */
+    void remove(HGMarkdownHighlighter *highlighter);
+
+private slots:
+    void startQueuedParses();
+
+private:
+    int maxParses;
+    HGMarkdownHighlighter *active;
+    QList<HGMarkdownHighlighter *> running;
+    QList<HGMarkdownHighlighter *> queued;
+    QTimer *backgroundTimer;
+
+    bool backgroundParseRunning();
+    void start(HGMarkdownHighlighter *highlighter);
+};
+
+#endif // PARSESCHEDULER_H
@@ -92,6 +92,10 @@ typedef struct
     /* The original, unmodified UTF-8 input: */
     char *original_input;
     
+    /* The number of bytes in original_input (it may not be
+       NUL-terminated): */
+    size_t original_input_len;
+    
     /* The offsets of the bytes we have stripped from original_input: */
     unsigned long *strip_positions;
     size_t strip_positions_len;
@@ -122,6 +126,7 @@ typedef struct
 } parser_data;
 
 static parser_data *mk_parser_data(char *original_input,
+                                   size_t original_input_len,
                                    unsigned long *strip_positions,
                                    size_t strip_positions_len,
                                    char *charbuf,
@@ -134,6 +139,7 @@ static parser_data *mk_parser_data(char *original_input,
     parser_data *p_data = (parser_data *)malloc(sizeof(parser_data));
     p_data->extensions = extensions;
     p_data->original_input = original_input;
+    p_data->original_input_len = original_input_len;
     p_data->strip_positions = strip_positions;
     p_data->strip_positions_len = strip_positions_len;
     p_data->charbuf = charbuf;
@@ -356,6 +362,7 @@ static void process_raw_blocks(parser_data *p_data)
                 // Process subspan_list:
                 parser_data *raw_p_data = mk_parser_data(
                     p_data->original_input,
+                    p_data->original_input_len,
                     p_data->strip_positions,
                     p_data->strip_positions_len,
                     p_data->charbuf,
@@ -445,8 +452,9 @@ Copy `str` to `out`, while doing the following:
   - remove possible UTF-8 BOM (byte order mark)
   - append two newlines to the end (like peg-markdown does)
   - keep track of which bytes we have stripped (in strip_positions)
+`str` does not need to be NUL-terminated; at most `len` bytes are read.
 */
-static int strcpy_preformat(char *str, char **out,
+static int strcpy_preformat(char *str, size_t len, char **out,
                             unsigned long **out_strip_positions,
                             size_t *out_strip_positions_len)
 {
@@ -458,18 +466,19 @@ static int strcpy_preformat(char *str, char **out,
     
     
     // +2 in the following is due to the "\n\n" suffix:
-    char *new_str = (char *)malloc(sizeof(char) * strlen(str) + 1 + 2);
+    char *new_str = (char *)malloc(sizeof(char) * len + 1 + 2);
     char *c = str;
+    char *str_end = str + len;
     int i = 0;
     
-    if (HAS_UTF8_BOM(c)) {
+    if (3 <= len && HAS_UTF8_BOM(c)) {
         c += 3;
         ADD_STRIP_POS(0);
         ADD_STRIP_POS(1);
         ADD_STRIP_POS(2);
     }
     
-    while (*c != '\0')
+    while (c < str_end && *c != '\0')
     {
         if (!IS_CONTINUATION_BYTE(*c)) {
             *(new_str+i) = *c, i++;
@@ -493,11 +502,20 @@ static int strcpy_preformat(char *str, char **out,
 
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[])
+{
+    pmh_markdown_to_elements_with_length(text, strlen(text), extensions,
+                                         out_result);
+}
+
+void pmh_markdown_to_elements_with_length(char *text, size_t length,
+                                          int extensions,
+                                          pmh_element **out_result[])
 {
     char *text_copy = NULL;
     unsigned long *strip_positions = NULL;
     size_t strip_positions_len = 0;
-    int text_copy_len = strcpy_preformat(text, &text_copy, &strip_positions,
+    int text_copy_len = strcpy_preformat(text, length, &text_copy,
+                                         &strip_positions,
                                          &strip_positions_len);
     
     pmh_realelement *parsing_elem = (pmh_realelement *)
@@ -509,6 +527,7 @@ void pmh_markdown_to_elements(char *text, int extensions,
     
     parser_data *p_data = mk_parser_data(
         text,
+        length,
         strip_positions,
         strip_positions_len,
         text_copy,
@@ -917,6 +936,13 @@ static char *copy_input_span(parser_data *p_data,
         
         //printf("    adjusted: %ld - %ld\n", adjusted_pos, adjusted_end);
         
+        // The span may cover the "\n\n" suffix we added to charbuf, which
+        // does not exist in the original input:
+        if (p_data->original_input_len < adjusted_end)
+            adjusted_end = p_data->original_input_len;
+        if (adjusted_end < adjusted_pos)
+            adjusted_pos = adjusted_end;
+        
         // Copy span from original input:
         size_t adjusted_len = adjusted_end - adjusted_pos;
         char *str = (char *)malloc(sizeof(char)*adjusted_len + 1);
@@ -39,6 +39,29 @@
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[]);
 
+/**
+* \brief Parse Markdown text of known length, return elements
+* 
+* Like pmh_markdown_to_elements(), but reads at most `length` bytes of
+* `text`, which thus does not need to be NUL-terminated (it can e.g. point
+* directly into a read-only memory-mapped file). The text is not modified
+* and must stay valid until this function returns.
+* 
+* \param[in]  text        The UTF-8 Markdown text to parse for highlighting.
+* \param[in]  length      The number of bytes in `text`.
+* \param[in]  extensions  The extensions to use in parsing (a bitfield
+*                         of pmh_extensions values).
+* \param[out] out_result  A pmh_element array, indexed by type, containing
+*                         the results of the parsing (linked lists of elements).
+*                         You must pass this to pmh_free_elements() when it's
+*                         not needed anymore.
+* 
+* \sa pmh_markdown_to_elements
+*/
+void pmh_markdown_to_elements_with_length(char *text, size_t length,
+                                          int extensions,
+                                          pmh_element **out_result[]);
+
 /**
 * \brief Sort elements in list by start offset.
 * 
@@ -54,6 +54,14 @@ PreferencesDialog::PreferencesDialog(QSettings *appSettings,
     ui->notesInfoLabel->setFont(font);
 #endif
 
+#ifndef Q_OS_LINUX
+    // Resource limits are applied with setrlimit(), which we only do on Linux
+    ui->compilerCPULimitLabel->hide();
+    ui->compilerCPULimitSpinBox->hide();
+    ui->compilerMemoryLimitLabel->hide();
+    ui->compilerMemoryLimitSpinBox->hide();
+#endif
+
 #ifdef Q_OS_MACOS
     ui->linkInfoLabel->setText(tr("If enabled, you can click on links while "
                                   "holding the Command key."));
@@ -288,6 +296,7 @@ void PreferencesDialog::updateCompilerArgsFieldFromComboBoxSelection()
 {
     QString selectedCompilerPath = ui->compilersComboBox->itemData(ui->compilersComboBox->currentIndex()).toString();
     ui->compilerArgsField->setText(compiler->getSavedArgsForCompiler(selectedCompilerPath));
+    ui->compilerTimeoutSpinBox->setValue(compiler->getSavedTimeoutForCompiler(selectedCompilerPath));
 }
 
 
@@ -330,6 +339,8 @@ void PreferencesDialog::updateUIFromSettings()
     PREF_TO_UI_BOOL_CHECKBOX(SETTING_OPEN_TARGET_AFTER_COMPILING, DEF_OPEN_TARGET_AFTER_COMPILING, ui->openTargetAfterCompilingCheckBox);
     PREF_TO_UI_STRING(SETTING_EXTENSIONS, DEF_EXTENSIONS, ui->extensionsLineEdit);
     PREF_TO_UI_STRING(SETTING_NOTES_FOLDER, "", ui->notesFolderLineEdit);
+    PREF_TO_UI_INT(SETTING_COMPILER_CPU_LIMIT, DEF_COMPILER_CPU_LIMIT, ui->compilerCPULimitSpinBox);
+    PREF_TO_UI_INT(SETTING_COMPILER_MEMORY_LIMIT, DEF_COMPILER_MEMORY_LIMIT, ui->compilerMemoryLimitSpinBox);
 
     PREF_TO_UI_BOOL_CHECKBOX(SETTING_FORMAT_EMPH_WITH_UNDERSCORES, DEF_FORMAT_EMPH_WITH_UNDERSCORES, ui->emphUnderscoreRadioButton);
     ui->emphAsteriskRadioButton->setChecked(!ui->emphUnderscoreRadioButton->isChecked());
@@ -352,13 +363,18 @@ void PreferencesDialog::updateSettingsFromUI()
     settings->setValue(SETTING_FORMAT_EMPH_WITH_UNDERSCORES, ui->emphUnderscoreRadioButton->isChecked());
     settings->setValue(SETTING_FORMAT_STRONG_WITH_UNDERSCORES, ui->strongUnderscoreRadioButton->isChecked());
     settings->setValue(SETTING_NOTES_FOLDER, ui->notesFolderLineEdit->text());
+    settings->setValue(SETTING_COMPILER_CPU_LIMIT, ui->compilerCPULimitSpinBox->value());
+    settings->setValue(SETTING_COMPILER_MEMORY_LIMIT, ui->compilerMemoryLimitSpinBox->value());
 
     QString selectedCompilerPath = ui->compilersComboBox->itemData(ui->compilersComboBox->currentIndex()).toString();
     QMap<QString, QVariant> compilerArgsMap = settings->value(SETTING_COMPILER_ARGS).toMap();
     compilerArgsMap[selectedCompilerPath] = QVariant(ui->compilerArgsField->text());
+    QMap<QString, QVariant> compilerTimeoutsMap = settings->value(SETTING_COMPILER_TIMEOUTS).toMap();
+    compilerTimeoutsMap[selectedCompilerPath] = QVariant(ui->compilerTimeoutSpinBox->value());
 
     settings->setValue(SETTING_COMPILER, selectedCompilerPath);
     settings->setValue(SETTING_COMPILER_ARGS, compilerArgsMap);
+    settings->setValue(SETTING_COMPILER_TIMEOUTS, compilerTimeoutsMap);
 
     settings->sync();
 }
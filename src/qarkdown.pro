@@ -53,23 +53,51 @@ HEADERS += \
     peg-markdown-highlight/pmh_parser.h \
     peg-markdown-highlight/pmh_definitions.h \
     peg-markdown-highlight/highlighter.h \
+    peg-markdown-highlight/parsescheduler.h \
     editor/qarkdowntextedit.h \
     editor/linenumberingplaintextedit.h \
+    editor/blockdata.h \
+    editor/overviewmap.h \
     peg-markdown-highlight/pmh_styleparser.h \
     markdowncompiler.h \
     logger.h \
-    filesearchdialog.h
+    filesearchdialog.h \
+    batchexporter.h \
+    fileloader.h \
+    filesaver.h \
+    editjournal.h \
+    linediff.h \
+    notesindexer.h \
+    notestextindex.h \
+    notessearchdialog.h \
+    searchbar.h \
+    outlinepanel.h \
+    documenttab.h
 SOURCES += \
     qarkdownapplication.cpp \
     preferencesdialog.cpp \
     peg-markdown-highlight/pmh_parser.c\
     peg-markdown-highlight/highlighter.cpp \
+    peg-markdown-highlight/parsescheduler.cpp \
     editor/qarkdowntextedit.cpp \
     editor/linenumberingplaintextedit.cpp \
+    editor/blockdata.cpp \
+    editor/overviewmap.cpp \
     peg-markdown-highlight/pmh_styleparser.c \
     markdowncompiler.cpp \
     logger.cpp \
-    filesearchdialog.cpp
+    filesearchdialog.cpp \
+    batchexporter.cpp \
+    fileloader.cpp \
+    filesaver.cpp \
+    editjournal.cpp \
+    linediff.cpp \
+    notesindexer.cpp \
+    notestextindex.cpp \
+    notessearchdialog.cpp \
+    searchbar.cpp \
+    outlinepanel.cpp \
+    documenttab.cpp
 
 FORMS += \
     preferencesdialog.ui \
@@ -1,5 +1,6 @@
 #include "qarkdownapplication.h"
 #include "logger.h"
+#include "defines.h"
 #include <QtGui/QFileOpenEvent>
 #include <QtGui/QDesktopServices>
 #include <QStandardPaths>
@@ -23,8 +24,7 @@ QarkdownApplication::QarkdownApplication(int &argc, char **argv) :
 #ifdef Q_OS_LINUX
     setWindowIcon(QIcon(":/appIcon.png"));
 #endif
-    QCoreApplication::setApplicationName("QarkDown");
-    QCoreApplication::setApplicationVersion(QString("%1.%2.%3").arg(appVersion.major).arg(appVersion.minor).arg(appVersion.tiny));
+    setupApplicationInfo();
 }
 
 QarkdownApplication::~QarkdownApplication()
@@ -41,6 +41,14 @@ QString QarkdownApplication::websiteURL()
     return kWebsiteURL;
 }
 
+// Also called from the headless (no QApplication) code paths, which
+// need the name and version for storage and temp file paths:
+void QarkdownApplication::setupApplicationInfo()
+{
+    QCoreApplication::setApplicationName("QarkDown");
+    QCoreApplication::setApplicationVersion(QString("%1.%2.%3").arg(appVersion.major).arg(appVersion.minor).arg(appVersion.tiny));
+}
+
 QString QarkdownApplication::applicationStoragePath()
 {
     QString appName = QCoreApplication::applicationName();
@@ -83,6 +91,24 @@ bool QarkdownApplication::copyResourceToFile(QString resourcePath, QString targe
     return true;
 }
 
+QStringList QarkdownApplication::markdownFilesFilterList(QSettings *settings)
+{
+    QStringList extensions = settings->value(SETTING_EXTENSIONS, DEF_EXTENSIONS)
+                             .toString().split(' ', Qt::SkipEmptyParts);
+    if (extensions.count() == 0)
+        return QStringList("*.*");
+
+    QStringList filterList;
+    foreach (QString ext, extensions)
+    {
+        QString cleanExt = ext.trimmed();
+        if (cleanExt.startsWith("."))
+            cleanExt = cleanExt.remove(0,1);
+        filterList.append("*." + cleanExt);
+    }
+    return filterList;
+}
+
 bool QarkdownApplication::event(QEvent *event)
 {
     if (event->type() == QEvent::FileOpen && mainWindow) {
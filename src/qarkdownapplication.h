@@ -2,6 +2,7 @@
 #define QARKDOWNAPPLICATION_H
 
 #include <QtWidgets/QApplication>
+#include <QtCore/QSettings>
 #include "mainwindow.h"
 
 class QarkdownApplication : public QApplication
@@ -15,8 +16,10 @@ public:
 
     QString copyrightYear();
     QString websiteURL();
-    QString applicationStoragePath();
-    bool copyResourceToFile(QString resourcePath, QString targetFilePath);
+    static void setupApplicationInfo();
+    static QString applicationStoragePath();
+    static bool copyResourceToFile(QString resourcePath, QString targetFilePath);
+    static QStringList markdownFilesFilterList(QSettings *settings);
 
 protected:
     bool event(QEvent *event);
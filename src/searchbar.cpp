@@ -0,0 +1,757 @@
+#include "searchbar.h"
+#include "logger.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutexLocker>
+#include <QtGui/QKeyEvent>
+#include <QtGui/QTextBlock>
+#include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QPushButton>
+#include <QtWidgets/QStyle>
+
+// Matches are handed over to the GUI thread in batches of (at most)
+// this many, or this often:
+#define kBatchSize 5000
+#define kBatchIntervalMilliseconds 50
+
+// Searching starts once typing pauses for a moment:
+#define kSearchDelayMilliseconds 150
+// ..and is redone when the document has been edited:
+#define kResearchDelayMilliseconds 500
+
+
+TextSearchThread::TextSearchThread(QVector<TextSearchBlock> someBlocks,
+                                   QString aSearchString,
+                                   QTextDocument::FindFlags someFlags,
+                                   bool isRegularExpression,
+                                   QObject *parent) :
+    QThread(parent)
+{
+    blocks = someBlocks;
+    searchString = aSearchString;
+    flags = someFlags;
+    regularExpression = isRegularExpression;
+    notified = false;
+}
+
+TextSearchThread::~TextSearchThread()
+{
+    cancel();
+}
+
+void TextSearchThread::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+QVector<TextSearchMatch> TextSearchThread::takeMatches()
+{
+    QMutexLocker locker(&mutex);
+    QVector<TextSearchMatch> matches;
+    matches.swap(pendingMatches);
+    notified = false;
+    return matches;
+}
+
+QVector<TextSearchBlockResult> TextSearchThread::scannedBlocks()
+{
+    return _scannedBlocks;
+}
+
+QRegularExpression TextSearchThread::searchExpression(QString searchString,
+                                                      QTextDocument::FindFlags flags,
+                                                      bool regularExpression)
+{
+    QString pattern = regularExpression
+                      ? searchString
+                      : QRegularExpression::escape(searchString);
+    if (flags & QTextDocument::FindWholeWords)
+        pattern = "(?<!\\w)(?:" + pattern + ")(?!\\w)";
+
+    QRegularExpression::PatternOptions options = QRegularExpression::UseUnicodePropertiesOption;
+    if (!(flags & QTextDocument::FindCaseSensitively))
+        options |= QRegularExpression::CaseInsensitiveOption;
+    return QRegularExpression(pattern, options);
+}
+
+void TextSearchThread::deliver(const QVector<TextSearchMatch> &matches)
+{
+    if (matches.isEmpty())
+        return;
+    QMutexLocker locker(&mutex);
+    pendingMatches += matches;
+    if (notified)
+        return;
+    notified = true;
+    locker.unlock();
+    emit matchesAvailable();
+}
+
+void TextSearchThread::run()
+{
+    // Compiled (and JIT-compiled) once, up front, instead of lazily on
+    // first use:
+    QRegularExpression expression = searchExpression(searchString, flags, regularExpression);
+    expression.optimize();
+
+    QVector<TextSearchMatch> batch;
+    QElapsedTimer sinceLastBatch;
+    sinceLastBatch.start();
+    int count = blocks.count();
+    for (int b = 0; b < count; b++)
+    {
+        if (isInterruptionRequested())
+            return;
+        const TextSearchBlock &block = blocks.at(b);
+
+        QVector<TextSearchMatch> blockMatches;
+        if (block.cached)
+            blockMatches = block.cachedMatches;
+        else
+        {
+            QRegularExpressionMatchIterator i = expression.globalMatch(block.text);
+            while (i.hasNext())
+            {
+                QRegularExpressionMatch regexMatch = i.next();
+                if (regexMatch.capturedLength() == 0)
+                    continue; // nothing to highlight or select
+                TextSearchMatch match;
+                match.position = regexMatch.capturedStart();
+                match.length = regexMatch.capturedLength();
+                blockMatches.append(match);
+            }
+            TextSearchBlockResult result;
+            result.blockNumber = block.blockNumber;
+            result.revision = block.revision;
+            result.matches = blockMatches;
+            _scannedBlocks.append(result);
+        }
+
+        foreach (TextSearchMatch match, blockMatches)
+        {
+            match.position += block.position;
+            batch.append(match);
+        }
+        if (kBatchSize <= batch.count()
+            || (!batch.isEmpty() && kBatchIntervalMilliseconds <= sinceLastBatch.elapsed()))
+        {
+            deliver(batch);
+            batch.clear();
+            sinceLastBatch.restart();
+        }
+    }
+    deliver(batch);
+}
+
+
+SearchBar::SearchBar(QarkdownTextEdit *anEditor, QWidget *parent) :
+    QWidget(parent)
+{
+    editor = anEditor;
+    searchThread = NULL;
+    receivedMatches = false;
+    searchComplete = false;
+    jumpToMatchFrom = -1;
+    currentMatchIndex = -1;
+    searchGeneration = 0;
+
+    lineEdit = new QLineEdit(this);
+    lineEdit->setPlaceholderText(tr("Find"));
+    lineEdit->setClearButtonEnabled(true);
+    lineEdit->installEventFilter(this);
+    matchCountLabel = new QLabel(this);
+
+    caseSensitiveButton = new QToolButton(this);
+    caseSensitiveButton->setText("Aa");
+    caseSensitiveButton->setToolTip(tr("Match Case"));
+    wholeWordsButton = new QToolButton(this);
+    wholeWordsButton->setText("W");
+    wholeWordsButton->setToolTip(tr("Whole Words"));
+    regularExpressionButton = new QToolButton(this);
+    regularExpressionButton->setText(".*");
+    regularExpressionButton->setToolTip(tr("Regular Expression"));
+    foreach (QToolButton *button, QList<QToolButton *>() << caseSensitiveButton
+                                                          << wholeWordsButton
+                                                          << regularExpressionButton)
+    {
+        button->setCheckable(true);
+        button->setAutoRaise(true);
+        connect(button, SIGNAL(toggled(bool)), this, SLOT(searchOptionsChanged()));
+    }
+
+    QToolButton *previousButton = new QToolButton(this);
+    previousButton->setArrowType(Qt::UpArrow);
+    previousButton->setToolTip(tr("Find Previous"));
+    previousButton->setAutoRaise(true);
+    QToolButton *nextButton = new QToolButton(this);
+    nextButton->setArrowType(Qt::DownArrow);
+    nextButton->setToolTip(tr("Find Next"));
+    nextButton->setAutoRaise(true);
+    QToolButton *closeButton = new QToolButton(this);
+    closeButton->setIcon(style()->standardIcon(QStyle::SP_TitleBarCloseButton));
+    closeButton->setToolTip(tr("Close"));
+    closeButton->setAutoRaise(true);
+
+    replaceRow = new QWidget(this);
+    replaceLineEdit = new QLineEdit(replaceRow);
+    replaceLineEdit->setPlaceholderText(tr("Replace"));
+    replaceLineEdit->setClearButtonEnabled(true);
+    replaceLineEdit->installEventFilter(this);
+    QPushButton *replaceButton = new QPushButton(tr("Replace"), replaceRow);
+    QPushButton *replaceAllButton = new QPushButton(tr("Replace All"), replaceRow);
+    replaceRow->hide();
+    replaceRow->setEnabled(!editor->isReadOnly());
+
+    QHBoxLayout *findLayout = new QHBoxLayout();
+    findLayout->addWidget(lineEdit, 1);
+    findLayout->addWidget(caseSensitiveButton);
+    findLayout->addWidget(wholeWordsButton);
+    findLayout->addWidget(regularExpressionButton);
+    findLayout->addWidget(matchCountLabel);
+    findLayout->addWidget(previousButton);
+    findLayout->addWidget(nextButton);
+    findLayout->addWidget(closeButton);
+
+    QHBoxLayout *replaceLayout = new QHBoxLayout(replaceRow);
+    replaceLayout->setContentsMargins(0, 0, 0, 0);
+    replaceLayout->addWidget(replaceLineEdit, 1);
+    replaceLayout->addWidget(replaceButton);
+    replaceLayout->addWidget(replaceAllButton);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(4, 2, 4, 2);
+    layout->setSpacing(2);
+    layout->addLayout(findLayout);
+    layout->addWidget(replaceRow);
+
+    searchTimer = new QTimer(this);
+    searchTimer->setSingleShot(true);
+
+    connect(lineEdit, SIGNAL(textChanged(QString)), this, SLOT(searchTextEdited(QString)));
+    connect(previousButton, SIGNAL(clicked()), this, SLOT(findPrevious()));
+    connect(nextButton, SIGNAL(clicked()), this, SLOT(findNext()));
+    connect(closeButton, SIGNAL(clicked()), this, SLOT(deactivate()));
+    connect(replaceButton, SIGNAL(clicked()), this, SLOT(replace()));
+    connect(replaceAllButton, SIGNAL(clicked()), this, SLOT(replaceAll()));
+    connect(searchTimer, SIGNAL(timeout()), this, SLOT(startSearch()));
+    connect(editor->document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(documentContentsChanged(int,int,int)));
+    connect(editor, SIGNAL(documentSwitched(QTextDocument*)),
+            this, SLOT(editorDocumentSwitched(QTextDocument*)));
+    connect(editor, SIGNAL(readOnlyChanged(bool)),
+            this, SLOT(editorReadOnlyChanged(bool)));
+}
+
+SearchBar::~SearchBar()
+{
+    cancelSearch();
+}
+
+QString SearchBar::searchString()
+{
+    return lineEdit->text();
+}
+
+void SearchBar::activate()
+{
+    showBar(false);
+}
+
+void SearchBar::activateReplace()
+{
+    showBar(true);
+}
+
+void SearchBar::showBar(bool withReplaceRow)
+{
+    QTextCursor cursor = editor->textCursor();
+    if (cursor.hasSelection()
+        && editor->document()->findBlock(cursor.selectionStart()).contains(cursor.selectionEnd()))
+        lineEdit->setText(cursor.selectedText());
+
+    bool wasVisible = isVisible();
+    replaceRow->setVisible(withReplaceRow);
+    show();
+    // Go straight to the replacement if there's something to replace:
+    QLineEdit *focusLineEdit = (withReplaceRow && !lineEdit->text().isEmpty())
+                               ? replaceLineEdit : lineEdit;
+    focusLineEdit->setFocus();
+    focusLineEdit->selectAll();
+    if (!wasVisible && !lineEdit->text().isEmpty())
+        startSearch();
+}
+
+void SearchBar::deactivate()
+{
+    searchTimer->stop();
+    cancelSearch();
+    editor->clearSearchMatches();
+    receivedMatches = false;
+    searchComplete = false;
+    hide();
+    editor->setFocus();
+}
+
+void SearchBar::searchTextEdited(QString text)
+{
+    // Select the first match from where the cursor was, as you type:
+    jumpToMatchFrom = editor->textCursor().selectionStart();
+    replaceStatus.clear();
+    searchTimer->start(kSearchDelayMilliseconds);
+    emit searchStringChanged(text);
+}
+
+void SearchBar::searchOptionsChanged()
+{
+    jumpToMatchFrom = editor->textCursor().selectionStart();
+    replaceStatus.clear();
+    if (isVisible())
+        startSearch();
+}
+
+QTextDocument::FindFlags SearchBar::findFlags()
+{
+    QTextDocument::FindFlags flags;
+    if (caseSensitiveButton->isChecked())
+        flags |= QTextDocument::FindCaseSensitively;
+    if (wholeWordsButton->isChecked())
+        flags |= QTextDocument::FindWholeWords;
+    return flags;
+}
+
+void SearchBar::documentContentsChanged(int position, int charsRemoved, int charsAdded)
+{
+    Q_UNUSED(position);
+    if (!isVisible() || lineEdit->text().isEmpty() || (charsRemoved == 0 && charsAdded == 0))
+        return;
+    // The editor keeps the known matches up to date until the search
+    // has been redone; the results of a search running on a snapshot
+    // from before this edit would be off, though:
+    cancelSearch();
+    jumpToMatchFrom = -1;
+    currentMatchIndex = -1;
+    searchTimer->start(kResearchDelayMilliseconds);
+}
+
+void SearchBar::editorReadOnlyChanged(bool readOnly)
+{
+    // (replace() and replaceAll() check for it as well, as they can be
+    // called directly)
+    replaceRow->setEnabled(!readOnly);
+}
+
+void SearchBar::editorDocumentSwitched(QTextDocument *previousDocument)
+{
+    disconnect(previousDocument, SIGNAL(contentsChange(int,int,int)), this, 0);
+    connect(editor->document(), SIGNAL(contentsChange(int,int,int)),
+            this, SLOT(documentContentsChanged(int,int,int)));
+    // (Matches cached in the blocks of the other document stay valid for
+    // when it is shown again, as they are tagged with the search and the
+    // blocks' revisions.)
+    replaceStatus.clear();
+    if (isVisible())
+        startSearch();
+    else
+        cancelSearch();
+}
+
+void SearchBar::cancelSearch()
+{
+    if (searchThread == NULL)
+        return;
+    searchThread->cancel();
+    // deleteLater() so that an already queued signal can be told apart
+    // from the thread of a later search:
+    searchThread->deleteLater();
+    searchThread = NULL;
+}
+
+void SearchBar::startSearch()
+{
+    searchTimer->stop();
+    cancelSearch();
+    receivedMatches = false;
+    searchComplete = false;
+    currentMatchIndex = -1;
+
+    QString text = lineEdit->text();
+    expression = TextSearchThread::searchExpression(text, findFlags(),
+                                                    regularExpressionButton->isChecked());
+    if (text.isEmpty() || !expression.isValid())
+    {
+        editor->clearSearchMatches();
+        updateMatchCountLabel();
+        return;
+    }
+
+    QString generationKey = QString::number(int(expression.patternOptions()))
+                            + ":" + expression.pattern();
+    if (generationKey != searchGenerationKey)
+    {
+        searchGeneration++;
+        searchGenerationKey = generationKey;
+    }
+
+    // The worker gets its own copy of the text, so editing can go on
+    // while it searches. Blocks that haven't changed since they were
+    // last searched for the same thing are not copied or searched again:
+    QTextDocument *document = editor->document();
+    QVector<TextSearchBlock> blocks;
+    blocks.reserve(document->blockCount());
+    int blockNumber = 0;
+    int position = 0;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next())
+    {
+        TextSearchBlock searchBlock;
+        searchBlock.blockNumber = blockNumber++;
+        searchBlock.revision = block.revision();
+        searchBlock.position = position;
+        position += block.length();
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(block, false);
+        searchBlock.cached = (data != NULL
+                              && data->searchGeneration == searchGeneration
+                              && data->searchRevision == searchBlock.revision);
+        if (searchBlock.cached)
+            searchBlock.cachedMatches = data->searchMatches;
+        else
+            searchBlock.text = block.text();
+        blocks.append(searchBlock);
+    }
+
+    searchThread = new TextSearchThread(blocks, text, findFlags(),
+                                        regularExpressionButton->isChecked(), this);
+    connect(searchThread, SIGNAL(matchesAvailable()),
+            this, SLOT(searchThreadMatchesAvailable()));
+    connect(searchThread, SIGNAL(finished()), this, SLOT(searchThreadFinished()));
+    searchThread->start();
+    updateMatchCountLabel();
+}
+
+void SearchBar::searchThreadMatchesAvailable()
+{
+    if (searchThread == NULL || sender() != searchThread)
+        return;
+
+    QVector<TextSearchMatch> matches = searchThread->takeMatches();
+    // The previous search's matches stay highlighted until the first
+    // batch of this one comes in, to avoid flicker:
+    if (!receivedMatches)
+        editor->setSearchMatches(matches);
+    else
+        editor->appendSearchMatches(matches);
+    receivedMatches = true;
+
+    jumpToFirstMatchIfNeeded();
+    updateMatchCountLabel();
+}
+
+void SearchBar::searchThreadFinished()
+{
+    if (searchThread == NULL || sender() != searchThread)
+        return;
+
+    TextSearchThread *thread = searchThread;
+    searchThread = NULL;
+    thread->deleteLater();
+
+    QVector<TextSearchMatch> matches = thread->takeMatches();
+    if (!receivedMatches)
+        editor->setSearchMatches(matches);
+    else
+        editor->appendSearchMatches(matches);
+    receivedMatches = true;
+    searchComplete = true;
+    cacheScannedBlocks(thread);
+
+    jumpToFirstMatchIfNeeded();
+    updateMatchCountLabel();
+}
+
+void SearchBar::cacheScannedBlocks(TextSearchThread *thread)
+{
+    // The search was not canceled, so the document hasn't changed since
+    // the snapshot was taken -- but better safe than sorry, hence the
+    // revision check:
+    QVector<TextSearchBlockResult> results = thread->scannedBlocks();
+    QTextBlock block = editor->document()->begin();
+    int blockNumber = 0;
+    foreach (const TextSearchBlockResult &result, results)
+    {
+        while (block.isValid() && blockNumber < result.blockNumber)
+        {
+            block = block.next();
+            blockNumber++;
+        }
+        if (!block.isValid())
+            break;
+        if (block.revision() != result.revision)
+            continue;
+        QarkdownBlockData *data = QarkdownBlockData::forBlock(block, true);
+        data->searchGeneration = searchGeneration;
+        data->searchRevision = result.revision;
+        data->searchMatches = result.matches;
+    }
+}
+
+void SearchBar::jumpToFirstMatchIfNeeded()
+{
+    if (jumpToMatchFrom == -1 || !receivedMatches)
+        return;
+    const QVector<TextSearchMatch> &matches = editor->searchMatches();
+    int index = editor->searchMatchIndexAtOrAfter(jumpToMatchFrom);
+    if (index == matches.count())
+    {
+        // Wrap around, but only once we know there's nothing further down
+        if (!searchComplete || matches.isEmpty())
+            return;
+        index = 0;
+    }
+    jumpToMatchFrom = -1;
+    selectMatch(index);
+}
+
+void SearchBar::selectMatch(int index)
+{
+    const TextSearchMatch &match = editor->searchMatches().at(index);
+    QTextCursor cursor = editor->textCursor();
+    cursor.setPosition(match.position);
+    cursor.setPosition(match.position + match.length, QTextCursor::KeepAnchor);
+    editor->setTextCursor(cursor);
+    currentMatchIndex = index;
+    updateMatchCountLabel();
+}
+
+void SearchBar::findNext()
+{
+    findMatch(false);
+}
+
+void SearchBar::findPrevious()
+{
+    findMatch(true);
+}
+
+void SearchBar::findMatch(bool backward)
+{
+    if (lineEdit->text().isEmpty())
+        return;
+
+    // Until all the matches are known, fall back to searching the
+    // document directly:
+    if (!searchComplete || searchTimer->isActive())
+    {
+        if (expression.isValid())
+            editor->find(expression, backward ? QTextDocument::FindBackward
+                                              : QTextDocument::FindFlags());
+        return;
+    }
+
+    const QVector<TextSearchMatch> &matches = editor->searchMatches();
+    if (matches.isEmpty())
+        return;
+    QTextCursor cursor = editor->textCursor();
+    int index;
+    if (backward)
+    {
+        index = editor->searchMatchIndexAtOrAfter(cursor.selectionStart()) - 1;
+        if (index < 0)
+            index = matches.count() - 1;
+    }
+    else
+    {
+        index = editor->searchMatchIndexAtOrAfter(cursor.hasSelection()
+                                                  ? cursor.selectionStart() + 1
+                                                  : cursor.position());
+        if (index == matches.count())
+            index = 0;
+    }
+    selectMatch(index);
+}
+
+QString SearchBar::expandReplacement(QString replacement,
+                                     const QRegularExpressionMatch &match)
+{
+    QString expanded;
+    expanded.reserve(replacement.length());
+    for (int i = 0; i < replacement.length(); i++)
+    {
+        QChar c = replacement.at(i);
+        if (c != '\\' || i + 1 == replacement.length())
+        {
+            expanded.append(c);
+            continue;
+        }
+        QChar escaped = replacement.at(++i);
+        if ('0' <= escaped && escaped <= '9')
+            expanded.append(match.captured(escaped.digitValue()));
+        else if (escaped == 'n')
+            expanded.append('\n');
+        else if (escaped == 't')
+            expanded.append('\t');
+        else
+            expanded.append(escaped);
+    }
+    return expanded;
+}
+
+void SearchBar::replace()
+{
+    if (lineEdit->text().isEmpty() || editor->isReadOnly())
+        return;
+    if (searchTimer->isActive())
+        startSearch();
+
+    // Only replace what "Find Next" would have selected:
+    QTextCursor cursor = editor->textCursor();
+    if (cursor.hasSelection() && expression.isValid())
+    {
+        QString selectedText = cursor.selectedText();
+        QRegularExpressionMatch match = expression.match(
+            selectedText, 0, QRegularExpression::NormalMatch,
+            QRegularExpression::AnchorAtOffsetMatchOption);
+        if (match.hasMatch() && match.capturedLength() == selectedText.length())
+        {
+            QString replacement = replaceLineEdit->text();
+            if (regularExpressionButton->isChecked())
+                replacement = expandReplacement(replacement, match);
+            cursor.insertText(replacement);
+            editor->setTextCursor(cursor);
+        }
+    }
+    findMatch(false);
+}
+
+void SearchBar::replaceAll()
+{
+    if (lineEdit->text().isEmpty() || editor->isReadOnly())
+        return;
+    if (searchTimer->isActive())
+        startSearch();
+    if (!expression.isValid())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Replacing match by match would mean an undo step, a contentsChange
+    // (and thus a reparse) and a relayout for each one. Instead, the text
+    // from the first match to the last one is built anew in one go and
+    // put in place with a single edit.
+    //
+    // Raw text, so that nothing but the matches changes (toPlainText()
+    // would turn non-breaking spaces into ordinary ones); blocks are
+    // separated by QChar::ParagraphSeparator, which insertText() turns
+    // back into blocks:
+    QTextDocument *document = editor->document();
+    QString text = document->toRawText();
+    QString replacement = replaceLineEdit->text();
+    bool expand = regularExpressionButton->isChecked() && replacement.contains('\\');
+
+    QString replacedText;
+    int replaceStart = -1;
+    int copiedUpTo = -1;
+    int count = 0;
+    int blockStart = 0;
+    while (blockStart <= text.length())
+    {
+        int blockEnd = text.indexOf(QChar::ParagraphSeparator, blockStart);
+        if (blockEnd == -1)
+            blockEnd = text.length();
+
+        // Match block by block, just like the search does:
+        QRegularExpressionMatchIterator iterator = expression.globalMatch(
+            text.mid(blockStart, blockEnd - blockStart));
+        while (iterator.hasNext())
+        {
+            QRegularExpressionMatch match = iterator.next();
+            if (match.capturedLength() == 0)
+                continue;
+            int matchStart = blockStart + match.capturedStart();
+            if (replaceStart == -1)
+                replaceStart = copiedUpTo = matchStart;
+            replacedText.append(QStringView(text).mid(copiedUpTo, matchStart - copiedUpTo));
+            replacedText.append(expand ? expandReplacement(replacement, match) : replacement);
+            copiedUpTo = matchStart + match.capturedLength();
+            count++;
+        }
+        blockStart = blockEnd + 1;
+    }
+
+    if (count == 0)
+    {
+        replaceStatus.clear();
+        updateMatchCountLabel();
+        return;
+    }
+
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+    cursor.setPosition(replaceStart);
+    cursor.setPosition(copiedUpTo, QTextCursor::KeepAnchor);
+    cursor.insertText(replacedText);
+    cursor.endEditBlock();
+    editor->setTextCursor(cursor);
+
+    Logger::debug(QString("Replaced %1 matches in %2 ms").arg(count).arg(timer.elapsed()));
+    replaceStatus = tr("Replaced %n", "", count);
+    jumpToMatchFrom = -1;
+    updateMatchCountLabel();
+}
+
+void SearchBar::updateMatchCountLabel()
+{
+    matchCountLabel->setToolTip(QString());
+    if (lineEdit->text().isEmpty())
+    {
+        matchCountLabel->clear();
+        return;
+    }
+    if (!expression.isValid())
+    {
+        matchCountLabel->setText(tr("Invalid pattern"));
+        matchCountLabel->setToolTip(expression.errorString());
+        return;
+    }
+    int count = receivedMatches ? editor->searchMatches().count() : 0;
+    QString text;
+    if (!searchComplete)
+        text = tr("%n matches so far…", "", count);
+    else if (count == 0)
+        text = tr("No matches");
+    else if (0 <= currentMatchIndex && currentMatchIndex < count)
+        text = tr("%1 of %2").arg(currentMatchIndex + 1).arg(count);
+    else
+        text = tr("%n matches", "", count);
+    if (!replaceStatus.isEmpty())
+        text = replaceStatus + tr(" — ") + text;
+    matchCountLabel->setText(text);
+}
+
+bool SearchBar::eventFilter(QObject *obj, QEvent *event)
+{
+    if ((obj != lineEdit && obj != replaceLineEdit) || event->type() != QEvent::KeyPress)
+        return QWidget::eventFilter(obj, event);
+
+    QKeyEvent *keyEvent = static_cast<QKeyEvent *>(event);
+    if (obj == replaceLineEdit
+        && (keyEvent->key() == Qt::Key_Return || keyEvent->key() == Qt::Key_Enter))
+    {
+        replace();
+        return true;
+    }
+    if (keyEvent->key() == Qt::Key_Return || keyEvent->key() == Qt::Key_Enter)
+    {
+        if (searchTimer->isActive())
+            startSearch();
+        findMatch(keyEvent->modifiers() & Qt::ShiftModifier);
+        return true;
+    }
+    if (keyEvent->key() == Qt::Key_Escape)
+    {
+        deactivate();
+        return true;
+    }
+    return false;
+}
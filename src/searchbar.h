@@ -0,0 +1,169 @@
+#ifndef SEARCHBAR_H
+#define SEARCHBAR_H
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
+#include <QtCore/QRegularExpression>
+#include <QtGui/QTextDocument>
+#include <QtWidgets/QWidget>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QToolButton>
+
+#include "editor/qarkdowntextedit.h"
+
+/** @brief A block of the document, as handed to TextSearchThread. */
+struct TextSearchBlock
+{
+    int blockNumber;
+    int revision;
+    int position;
+    // Blocks whose matches are already known are not searched again:
+    bool cached;
+    QString text;
+    QVector<TextSearchMatch> cachedMatches;
+};
+
+/** @brief The matches found in one block (relative to its start). */
+struct TextSearchBlockResult
+{
+    int blockNumber;
+    int revision;
+    QVector<TextSearchMatch> matches;
+};
+
+/** @brief Finds all the matches of a search in a snapshot of the
+  * document's blocks, delivering them in batches as it goes.
+  */
+class TextSearchThread : public QThread
+{
+    Q_OBJECT
+public:
+    TextSearchThread(QVector<TextSearchBlock> blocks, QString searchString,
+                     QTextDocument::FindFlags flags, bool regularExpression,
+                     QObject *parent = 0);
+    ~TextSearchThread();
+    void cancel();
+
+    /** @brief The matches found since the previous call. */
+    QVector<TextSearchMatch> takeMatches();
+    /** @brief The blocks that were actually searched, and their matches. */
+    QVector<TextSearchBlockResult> scannedBlocks();
+
+    /** @brief The expression to search with (searchString is escaped,
+      * unless it is a regular expression already). FindBackward is
+      * ignored. */
+    static QRegularExpression searchExpression(QString searchString,
+                                               QTextDocument::FindFlags flags,
+                                               bool regularExpression);
+
+signals:
+    /** @brief Emitted when matches are waiting to be taken (but not
+      * again until they have been). */
+    void matchesAvailable();
+
+protected:
+    void run();
+
+private:
+    QVector<TextSearchBlock> blocks;
+    QString searchString;
+    QTextDocument::FindFlags flags;
+    bool regularExpression;
+    QVector<TextSearchBlockResult> _scannedBlocks;
+    QMutex mutex;
+    QVector<TextSearchMatch> pendingMatches;
+    bool notified;
+    void deliver(const QVector<TextSearchMatch> &matches);
+};
+
+/** @brief Incremental search bar shown below the editor, for plain text
+  * (optionally case sensitive and/or whole words) or regular expressions.
+  *
+  * All matches are found on a background thread, highlighted in the
+  * editor as they come in and counted; finding the next/previous match
+  * is then just a lookup in the list of matches.
+  *
+  * Optionally shows a second row for replacing matches; "Replace All"
+  * is done as a single edit (one undo step, one reparse).
+  */
+class SearchBar : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit SearchBar(QarkdownTextEdit *editor, QWidget *parent = 0);
+    ~SearchBar();
+
+    QString searchString();
+    bool eventFilter(QObject *obj, QEvent *event);
+
+    /** @brief The replacement text for a regular expression match, with
+      * \\0 - \\9 expanded to the captured groups and \\n, \\t to a
+      * newline and a tab. */
+    static QString expandReplacement(QString replacement,
+                                     const QRegularExpressionMatch &match);
+
+public slots:
+    /** @brief Show the bar and focus it, searching for the selected
+      * text if there is any. */
+    void activate();
+    /** @brief Like activate(), but with the replace row shown. */
+    void activateReplace();
+    void deactivate();
+    void findNext();
+    void findPrevious();
+    /** @brief Replace the selection, if it is a match, and find the next one. */
+    void replace();
+    void replaceAll();
+
+signals:
+    void searchStringChanged(QString searchString);
+
+private slots:
+    void searchTextEdited(QString text);
+    void searchOptionsChanged();
+    void startSearch();
+    void searchThreadMatchesAvailable();
+    void searchThreadFinished();
+    void documentContentsChanged(int position, int charsRemoved, int charsAdded);
+    void editorDocumentSwitched(QTextDocument *previousDocument);
+    void editorReadOnlyChanged(bool readOnly);
+
+private:
+    QarkdownTextEdit *editor;
+    QLineEdit *lineEdit;
+    QToolButton *caseSensitiveButton;
+    QToolButton *wholeWordsButton;
+    QToolButton *regularExpressionButton;
+    QLabel *matchCountLabel;
+    QWidget *replaceRow;
+    QLineEdit *replaceLineEdit;
+    // Shown along with the match count until the search is changed:
+    QString replaceStatus;
+    QRegularExpression expression;
+    // Identifies the pattern and options of the cached block matches:
+    int searchGeneration;
+    QString searchGenerationKey;
+    QTimer *searchTimer;
+    TextSearchThread *searchThread;
+    // Whether the matches in the editor are those of the current search
+    // (and whether the search has gone through the whole document):
+    bool receivedMatches;
+    bool searchComplete;
+    // Where to look for the first match to select while typing, or -1:
+    int jumpToMatchFrom;
+    int currentMatchIndex;
+
+    QTextDocument::FindFlags findFlags();
+    void showBar(bool withReplaceRow);
+    void cancelSearch();
+    void cacheScannedBlocks(TextSearchThread *thread);
+    void findMatch(bool backward);
+    void selectMatch(int index);
+    void jumpToFirstMatchIfNeeded();
+    void updateMatchCountLabel();
+};
+
+#endif // SEARCHBAR_H